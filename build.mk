@@ -24,7 +24,22 @@ SRCFILES := \
 	$(SRCDIR)/hev-socks5-session.c \
 	$(SRCDIR)/hev-socks5-session-tcp.c \
 	$(SRCDIR)/hev-socks5-session-udp.c \
+	$(SRCDIR)/hev-socks5-session-tproxy.c \
+	$(SRCDIR)/hev-socks5-proxy.c \
+	$(SRCDIR)/hev-connection-pool.c \
+	$(SRCDIR)/hev-socks5-upstream.c \
+	$(SRCDIR)/hev-socks5-udp-mux.c \
+	$(SRCDIR)/hev-udp-slab.c \
+	$(SRCDIR)/hev-slab.c \
+	$(SRCDIR)/hev-tcp-buffer.c \
+	$(SRCDIR)/hev-tcp-time-wait.c \
+	$(SRCDIR)/hev-timing-wheel.c \
+	$(SRCDIR)/hev-admission.c \
+	$(SRCDIR)/hev-tproxy.c \
+	$(SRCDIR)/hev-uring.c \
 	$(SRCDIR)/hev-mapped-dns.c \
+	$(SRCDIR)/hev-dns-cache.c \
+	$(SRCDIR)/hev-dns-tcp.c \
 	$(SRCDIR)/hev-thread-pool.c \
 	$(SRCDIR)/hev-tunnel-io.c \
 	$(SRCDIR)/hev-tunnel-linux.c \
@@ -41,7 +56,6 @@ ifeq ($(ENABLE_OPTIMIZATIONS),1)
 		$(SRCDIR)/hev-ring-buffer.c \
 		$(SRCDIR)/hev-memory-pool.c \
 		$(SRCDIR)/hev-simd.c \
-		$(SRCDIR)/hev-connection-pool.c \
 		$(SRCDIR)/hev-io-uring.c \
 		$(SRCDIR)/hev-cpu-affinity.c \
 		$(SRCDIR)/hev-ebpf-filter.c \
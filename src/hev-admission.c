@@ -0,0 +1,274 @@
+/*
+ ============================================================================
+ Name        : hev-admission.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Admission Control
+ ============================================================================
+ */
+
+#include <time.h>
+#include <string.h>
+
+#include <lwip/ip.h>
+#include <lwip/tcp.h>
+#include <lwip/priv/tcp_priv.h>
+
+#include "hev-config.h"
+#include "hev-logger.h"
+#include "hev-tcp-buffer.h"
+#include "hev-socks5-upstream.h"
+
+#include "hev-admission.h"
+
+#define SOURCE_BUCKETS (1024)
+#define PROBE_INTERVAL (1000)
+
+#define TCP_SYN (0x02)
+#define TCP_ACK (0x10)
+
+typedef struct _HevAdmissionBucket HevAdmissionBucket;
+
+struct _HevAdmissionBucket
+{
+    uint32_t stamp;
+    uint32_t tokens;
+};
+
+static int enabled;
+static int overloaded;
+static uint32_t probe_time;
+
+static int run_queue_limit;
+static int write_queue_limit;
+static int buffer_usage_limit;
+static int connect_latency_limit;
+static uint32_t source_rate;
+static uint32_t source_burst;
+
+static unsigned long resets;
+static unsigned long drops;
+static unsigned long sheds;
+
+/* Source addresses share buckets by hash, a collision only costs rate. */
+static HevAdmissionBucket buckets[SOURCE_BUCKETS];
+
+static uint32_t
+monotonic_msec (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int
+over (int value, int limit, int state)
+{
+    if (!limit)
+        return 0;
+
+    if (state)
+        return (value * 4) >= (limit * 3);
+
+    return value >= limit;
+}
+
+void
+hev_admission_update (int run_queue, int write_queue)
+{
+    int buffer_usage;
+    int latency;
+    int state;
+    int res;
+
+    if (!enabled)
+        return;
+
+    buffer_usage = hev_tcp_buffer_get_usage ();
+    latency = hev_socks5_upstream_get_latency () / 1000;
+    state = __atomic_load_n (&overloaded, __ATOMIC_RELAXED);
+
+    res = over (run_queue, run_queue_limit, state);
+    res |= over (write_queue, write_queue_limit, state);
+    res |= over (buffer_usage, buffer_usage_limit, state);
+    res |= over (latency, connect_latency_limit, state);
+    if (res == state)
+        return;
+
+    __atomic_store_n (&overloaded, res, __ATOMIC_RELAXED);
+    if (res)
+        LOG_W ("admission: overloaded, run queue %d write queue %d "
+               "buffer %d%% latency %d ms",
+               run_queue, write_queue, buffer_usage, latency);
+    else
+        LOG_I ("admission: recovered");
+}
+
+static int
+hev_admission_rate (const uint8_t *addr, int len, uint32_t now)
+{
+    HevAdmissionBucket *b;
+    uint64_t tokens;
+    uint32_t h = 2166136261u;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        h ^= addr[i];
+        h *= 16777619u;
+    }
+    b = &buckets[h & (SOURCE_BUCKETS - 1)];
+
+    /* Tokens are kept in thousandths, refilled at the rate per ms. */
+    tokens = b->tokens + (uint64_t)(now - b->stamp) * source_rate;
+    if (tokens > (source_burst * 1000))
+        tokens = source_burst * 1000;
+    b->stamp = now;
+
+    if (tokens < 1000) {
+        b->tokens = tokens;
+        return -1;
+    }
+
+    b->tokens = tokens - 1000;
+    return 0;
+}
+
+static void
+hev_admission_reset (const uint8_t *ip, const uint8_t *tcp, int v6)
+{
+    ip_addr_t local, remote;
+    uint32_t seqno;
+
+    memset (&local, 0, sizeof (local));
+    memset (&remote, 0, sizeof (remote));
+    if (v6) {
+        memcpy (ip_2_ip6 (&remote)->addr, &ip[8], 16);
+        memcpy (ip_2_ip6 (&local)->addr, &ip[24], 16);
+        IP_SET_TYPE_VAL (remote, IPADDR_TYPE_V6);
+        IP_SET_TYPE_VAL (local, IPADDR_TYPE_V6);
+    } else {
+        memcpy (&ip_2_ip4 (&remote)->addr, &ip[12], 4);
+        memcpy (&ip_2_ip4 (&local)->addr, &ip[16], 4);
+        IP_SET_TYPE_VAL (remote, IPADDR_TYPE_V4);
+        IP_SET_TYPE_VAL (local, IPADDR_TYPE_V4);
+    }
+
+    memcpy (&seqno, &tcp[4], 4);
+    tcp_rst (NULL, 0, ntohl (seqno) + 1, &local, &remote,
+             (tcp[2] << 8) | tcp[3], (tcp[0] << 8) | tcp[1]);
+}
+
+int
+hev_admission_filter (const struct pbuf *p)
+{
+    const uint8_t *ip = p->payload;
+    const uint8_t *tcp;
+    uint32_t now;
+    int v6;
+
+    if (!enabled || (p->len < 40))
+        return 0;
+
+    switch (ip[0] >> 4) {
+    case 4: {
+        int hlen = (ip[0] & 0xf) * 4;
+
+        if ((ip[9] != IP_PROTO_TCP) || (ip[6] & 0x1f) || ip[7] ||
+            (p->len < (hlen + 14)))
+            return 0;
+        tcp = ip + hlen;
+        v6 = 0;
+        break;
+    }
+    case 6:
+        if ((ip[6] != IP_PROTO_TCP) || (p->len < (40 + 14)))
+            return 0;
+        tcp = ip + 40;
+        v6 = 1;
+        break;
+    default:
+        return 0;
+    }
+
+    if ((tcp[13] & (TCP_SYN | TCP_ACK)) != TCP_SYN)
+        return 0;
+
+    now = monotonic_msec ();
+
+    if (__atomic_load_n (&overloaded, __ATOMIC_RELAXED)) {
+        if ((now - probe_time) >= PROBE_INTERVAL) {
+            probe_time = now;
+            return 0;
+        }
+        hev_admission_reset (ip, tcp, v6);
+        resets++;
+        return 1;
+    }
+
+    if (source_rate &&
+        (hev_admission_rate (v6 ? &ip[8] : &ip[12], v6 ? 16 : 4, now) < 0)) {
+        drops++;
+        return 1;
+    }
+
+    return 0;
+}
+
+int
+hev_admission_shed (void)
+{
+    if (!__atomic_load_n (&overloaded, __ATOMIC_RELAXED))
+        return 0;
+
+    __atomic_add_fetch (&sheds, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+int
+hev_admission_init (void)
+{
+    uint32_t now;
+    int i;
+
+    run_queue_limit = hev_config_get_admission_run_queue ();
+    write_queue_limit = hev_config_get_admission_write_queue ();
+    buffer_usage_limit = hev_config_get_admission_buffer_usage ();
+    connect_latency_limit = hev_config_get_admission_connect_latency ();
+    source_rate = hev_config_get_admission_source_rate ();
+    source_burst = hev_config_get_admission_source_burst ();
+
+    enabled = run_queue_limit || write_queue_limit || buffer_usage_limit ||
+              connect_latency_limit || source_rate;
+    if (!enabled)
+        return 0;
+
+    now = monotonic_msec ();
+    for (i = 0; i < SOURCE_BUCKETS; i++) {
+        buckets[i].stamp = now;
+        buckets[i].tokens = source_burst * 1000;
+    }
+
+    overloaded = 0;
+    probe_time = now;
+
+    LOG_I ("admission control initialized");
+
+    return 0;
+}
+
+void
+hev_admission_fini (void)
+{
+    if (!enabled)
+        return;
+
+    LOG_I ("admission: %lu resets %lu rate drops %lu udp sheds", resets,
+           drops, sheds);
+
+    enabled = 0;
+    resets = 0;
+    drops = 0;
+    sheds = 0;
+}
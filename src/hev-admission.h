@@ -0,0 +1,53 @@
+/*
+ ============================================================================
+ Name        : hev-admission.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Admission Control
+ ============================================================================
+ */
+
+#ifndef __HEV_ADMISSION_H__
+#define __HEV_ADMISSION_H__
+
+#include <lwip/pbuf.h>
+
+int hev_admission_init (void);
+void hev_admission_fini (void);
+
+/**
+ * hev_admission_update:
+ * @run_queue: sessions waiting for a worker thread
+ * @write_queue: packets waiting to be written to the tunnel
+ *
+ * Sample the load signals against the admission limits, together with
+ * the tcp buffer usage and the upstream connect latency. Called from the
+ * timer thread. Once over a limit, new flows stay refused until every
+ * signal is back under three quarters of its limit.
+ */
+void hev_admission_update (int run_queue, int write_queue);
+
+/**
+ * hev_admission_filter:
+ * @p: packet read from the TUN device
+ *
+ * Check a new TCP connection before lwIP sets up a pcb for it. While
+ * overloaded, the SYN is answered with a reset, except for one per
+ * second that keeps the signals fresh. A SYN over its source address
+ * rate is dropped, leaving the retry to the client's backoff. Must be
+ * called with the lwIP lock held.
+ *
+ * Returns: 1 if the caller should drop @p, 0 otherwise
+ */
+int hev_admission_filter (const struct pbuf *p);
+
+/**
+ * hev_admission_shed:
+ *
+ * Check whether a new UDP flow should be dropped.
+ *
+ * Returns: 1 while overloaded, 0 otherwise
+ */
+int hev_admission_shed (void);
+
+#endif /* __HEV_ADMISSION_H__ */
@@ -16,6 +16,7 @@
 
 static const int UDP_BUF_SIZE = 1500;
 static const int UDP_POOL_SIZE = 512;
+static const int DNS_BUF_SIZE = 4096;
 static const int TASK_STACK_SIZE = 20480;
 
 #endif /* __HEV_CONFIG_CONST_H__ */
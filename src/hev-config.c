@@ -27,7 +27,17 @@ static char tun_ipv6_address[64];
 static char tun_post_up_script[1024];
 static char tun_pre_down_script[1024];
 
-static HevConfigServer srv;
+#define MAX_SERVERS (16)
+#define MAX_PROFILES (16)
+
+static HevConfigServer srvs[MAX_SERVERS];
+static int srvs_num;
+static int socks5_balance;
+static int socks5_health_interval;
+static int socks5_health_fall = 3;
+static int socks5_health_rise = 2;
+static int socks5_race_delay;
+static int socks5_udp_shared_sockets;
 
 static int mapdns_address;
 static int mapdns_port;
@@ -35,13 +45,42 @@ static int mapdns_network;
 static int mapdns_netmask;
 static int mapdns_cache_size;
 
+static int dnscache_size;
+static int dnscache_min_ttl;
+static int dnscache_max_ttl = 86400;
+static int dnscache_prefetch = 10;
+
+static char dnstcp_address[256];
+static int dnstcp_port = 53;
+static int dnstcp_sessions = 2;
+static int dnstcp_timeout = 5000;
+static HevConfigProfile profiles[MAX_PROFILES];
+static int profiles_num;
+static char tproxy_address[256];
+static int tproxy_port;
+static int tproxy_redirect;
+static int admission_run_queue;
+static int admission_write_queue;
+static int admission_buffer_usage;
+static int admission_connect_latency;
+static int admission_source_rate;
+static int admission_source_burst = 32;
+
 static char log_file[1024];
 static char pid_file[1024];
 static int max_session_count;
-static int task_stack_size = 86016;
+static int task_stack_size = 20480;
 static int tcp_buffer_size = 65536;
+static int tcp_buffer_budget = 67108864;
+static int tcp_buffer_min_size = 4096;
+static int tcp_buffer_max_size;
+static int tcp_recv_into_pbuf;
+static int tcp_io_uring;
+static int tcp_zerocopy_threshold;
+static int tcp_time_wait;
 static int udp_recv_buffer_size = 524288;
 static int udp_copy_buffer_nums = 10;
+static int udp_share_association = 1;
 static int connect_timeout = 10000;
 static int tcp_read_write_timeout = 300000;
 static int udp_read_write_timeout = 60000;
@@ -167,10 +206,97 @@ hev_config_parse_tunnel (yaml_document_t *doc, yaml_node_t *base)
     return 0;
 }
 
+static int
+hev_config_parse_server (yaml_document_t *doc, yaml_node_t *base,
+                         HevConfigServer *srv, int index)
+{
+    static char _users[MAX_SERVERS][256];
+    static char _passes[MAX_SERVERS][256];
+    yaml_node_pair_t *pair;
+    const char *addr = NULL;
+    const char *port = NULL;
+    const char *udpa = NULL;
+    const char *user = NULL;
+    const char *pass = NULL;
+
+    if (!base || YAML_MAPPING_NODE != base->type)
+        return -1;
+
+    for (pair = base->data.mapping.pairs.start;
+         pair < base->data.mapping.pairs.top; pair++) {
+        yaml_node_t *node;
+        const char *key, *value;
+
+        if (!pair->key || !pair->value)
+            break;
+
+        node = yaml_document_get_node (doc, pair->key);
+        if (!node || YAML_SCALAR_NODE != node->type)
+            break;
+        key = (const char *)node->data.scalar.value;
+
+        node = yaml_document_get_node (doc, pair->value);
+        if (!node || YAML_SCALAR_NODE != node->type)
+            break;
+        value = (const char *)node->data.scalar.value;
+
+        if (0 == strcmp (key, "port"))
+            port = value;
+        else if (0 == strcmp (key, "address"))
+            addr = value;
+        else if (0 == strcmp (key, "udp-address"))
+            udpa = value;
+        else if (0 == strcmp (key, "username"))
+            user = value;
+        else if (0 == strcmp (key, "password"))
+            pass = value;
+    }
+
+    if (!port || !addr) {
+        fprintf (stderr, "Must be set socks5.servers address and port!\n");
+        return -1;
+    }
+
+    if ((user && !pass) || (!user && pass)) {
+        fprintf (stderr, "Must be set both socks5 username and password!\n");
+        return -1;
+    }
+
+    strncpy (srv->addr, addr, 256 - 1);
+    srv->port = strtoul (port, NULL, 10);
+
+    if (udpa)
+        strncpy (srv->udp_addr, udpa, 256 - 1);
+
+    if (user && pass) {
+        strncpy (_users[index], user, 256 - 1);
+        strncpy (_passes[index], pass, 256 - 1);
+        srv->user = _users[index];
+        srv->pass = _passes[index];
+    }
+
+    return 0;
+}
+
+static int
+hev_config_parse_balance (const char *value)
+{
+    if (0 == strcmp (value, "least-sessions"))
+        return HEV_CONFIG_BALANCE_LEAST_SESSIONS;
+    else if (0 == strcmp (value, "latency"))
+        return HEV_CONFIG_BALANCE_LATENCY;
+    else if (0 == strcmp (value, "hash"))
+        return HEV_CONFIG_BALANCE_HASH;
+
+    return HEV_CONFIG_BALANCE_ROUND_ROBIN;
+}
+
 static int
 hev_config_parse_socks5 (yaml_document_t *doc, yaml_node_t *base)
 {
     yaml_node_pair_t *pair;
+    yaml_node_t *list = NULL;
+    HevConfigServer srv = { 0 };
     static char _user[256];
     static char _pass[256];
     const char *addr = NULL;
@@ -181,6 +307,16 @@ hev_config_parse_socks5 (yaml_document_t *doc, yaml_node_t *base)
     const char *pass = NULL;
     const char *mark = NULL;
     const char *pipe = NULL;
+    const char *edat = NULL;
+    const char *tfo = NULL;
+    const char *pool = NULL;
+    const char *pidl = NULL;
+    const char *bal = NULL;
+    const char *hint = NULL;
+    const char *hfal = NULL;
+    const char *hris = NULL;
+    const char *race = NULL;
+    const char *usks = NULL;
 
     if (!base || YAML_MAPPING_NODE != base->type)
         return -1;
@@ -199,6 +335,11 @@ hev_config_parse_socks5 (yaml_document_t *doc, yaml_node_t *base)
         key = (const char *)node->data.scalar.value;
 
         node = yaml_document_get_node (doc, pair->value);
+        if (node && (YAML_SEQUENCE_NODE == node->type) &&
+            (0 == strcmp (key, "servers"))) {
+            list = node;
+            continue;
+        }
         if (!node || YAML_SCALAR_NODE != node->type)
             break;
         value = (const char *)node->data.scalar.value;
@@ -213,22 +354,44 @@ hev_config_parse_socks5 (yaml_document_t *doc, yaml_node_t *base)
             udpa = value;
         else if (0 == strcmp (key, "pipeline"))
             pipe = value;
+        else if (0 == strcmp (key, "early-data"))
+            edat = value;
+        else if (0 == strcmp (key, "fast-open"))
+            tfo = value;
         else if (0 == strcmp (key, "username"))
             user = value;
         else if (0 == strcmp (key, "password"))
             pass = value;
         else if (0 == strcmp (key, "mark"))
             mark = value;
+        else if (0 == strcmp (key, "pool"))
+            pool = value;
+        else if (0 == strcmp (key, "pool-idle"))
+            pidl = value;
+        else if (0 == strcmp (key, "balance"))
+            bal = value;
+        else if (0 == strcmp (key, "health-interval"))
+            hint = value;
+        else if (0 == strcmp (key, "health-fall"))
+            hfal = value;
+        else if (0 == strcmp (key, "health-rise"))
+            hris = value;
+        else if (0 == strcmp (key, "race-delay"))
+            race = value;
+        else if (0 == strcmp (key, "udp-shared-sockets"))
+            usks = value;
     }
 
-    if (!port) {
-        fprintf (stderr, "Can't found socks5.port!\n");
-        return -1;
-    }
+    if (!list) {
+        if (!port) {
+            fprintf (stderr, "Can't found socks5.port!\n");
+            return -1;
+        }
 
-    if (!addr) {
-        fprintf (stderr, "Can't found socks5.address!\n");
-        return -1;
+        if (!addr) {
+            fprintf (stderr, "Can't found socks5.address!\n");
+            return -1;
+        }
     }
 
     if ((user && !pass) || (!user && pass)) {
@@ -236,12 +399,15 @@ hev_config_parse_socks5 (yaml_document_t *doc, yaml_node_t *base)
         return -1;
     }
 
-    strncpy (srv.addr, addr, 256 - 1);
-    srv.port = strtoul (port, NULL, 10);
-
     if (pipe && (strcasecmp (pipe, "true") == 0))
         srv.pipeline = 1;
 
+    if (edat && (strcasecmp (edat, "true") == 0))
+        srv.early_data = 1;
+
+    if (tfo && (strcasecmp (tfo, "true") == 0))
+        srv.fast_open = 1;
+
     if (udpm && (strcasecmp (udpm, "udp") == 0))
         srv.udp_in_udp = 1;
 
@@ -258,6 +424,68 @@ hev_config_parse_socks5 (yaml_document_t *doc, yaml_node_t *base)
     if (mark)
         srv.mark = strtoul (mark, NULL, 0);
 
+    if (pool)
+        srv.pool = strtoul (pool, NULL, 10);
+
+    srv.pool_idle = 30;
+    if (pidl)
+        srv.pool_idle = strtoul (pidl, NULL, 10);
+    if (!srv.pool_idle)
+        srv.pool_idle = 1;
+
+    if (bal)
+        socks5_balance = hev_config_parse_balance (bal);
+
+    if (hint)
+        socks5_health_interval = strtoul (hint, NULL, 10);
+    if (hfal)
+        socks5_health_fall = strtoul (hfal, NULL, 10);
+    if (hris)
+        socks5_health_rise = strtoul (hris, NULL, 10);
+    if (race)
+        socks5_race_delay = strtoul (race, NULL, 10);
+    if (usks)
+        socks5_udp_shared_sockets = strtoul (usks, NULL, 10);
+
+    if (socks5_health_fall <= 0)
+        socks5_health_fall = 1;
+    if (socks5_health_rise <= 0)
+        socks5_health_rise = 1;
+
+    /* Entries of socks5.servers inherit every option set above. */
+    srvs_num = 0;
+    if (addr && port) {
+        srvs[0] = srv;
+        strncpy (srvs[0].addr, addr, 256 - 1);
+        srvs[0].port = strtoul (port, NULL, 10);
+        srvs_num++;
+    }
+
+    if (list) {
+        yaml_node_item_t *item;
+
+        for (item = list->data.sequence.items.start;
+             item < list->data.sequence.items.top; item++) {
+            yaml_node_t *node = yaml_document_get_node (doc, *item);
+
+            if (srvs_num == MAX_SERVERS) {
+                fprintf (stderr, "Too many socks5.servers!\n");
+                return -1;
+            }
+
+            srvs[srvs_num] = srv;
+            if (hev_config_parse_server (doc, node, &srvs[srvs_num],
+                                         srvs_num) < 0)
+                return -1;
+            srvs_num++;
+        }
+    }
+
+    if (!srvs_num) {
+        fprintf (stderr, "Can't found socks5.servers!\n");
+        return -1;
+    }
+
     return 0;
 }
 
@@ -305,6 +533,289 @@ hev_config_parse_mapdns (yaml_document_t *doc, yaml_node_t *base)
     return 0;
 }
 
+static int
+hev_config_parse_dnscache (yaml_document_t *doc, yaml_node_t *base)
+{
+    yaml_node_pair_t *pair;
+
+    if (!base || YAML_MAPPING_NODE != base->type)
+        return -1;
+
+    for (pair = base->data.mapping.pairs.start;
+         pair < base->data.mapping.pairs.top; pair++) {
+        yaml_node_t *node;
+        const char *key, *value;
+
+        if (!pair->key || !pair->value)
+            break;
+
+        node = yaml_document_get_node (doc, pair->key);
+        if (!node || YAML_SCALAR_NODE != node->type)
+            break;
+        key = (const char *)node->data.scalar.value;
+
+        node = yaml_document_get_node (doc, pair->value);
+        if (!node || YAML_SCALAR_NODE != node->type)
+            break;
+        value = (const char *)node->data.scalar.value;
+
+        if (0 == strcmp (key, "cache-size"))
+            dnscache_size = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "min-ttl"))
+            dnscache_min_ttl = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "max-ttl"))
+            dnscache_max_ttl = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "prefetch"))
+            dnscache_prefetch = strtoul (value, NULL, 10);
+    }
+
+    if (dnscache_prefetch > 100)
+        dnscache_prefetch = 100;
+
+    return 0;
+}
+
+static int
+hev_config_parse_dnstcp (yaml_document_t *doc, yaml_node_t *base)
+{
+    yaml_node_pair_t *pair;
+
+    if (!base || YAML_MAPPING_NODE != base->type)
+        return -1;
+
+    for (pair = base->data.mapping.pairs.start;
+         pair < base->data.mapping.pairs.top; pair++) {
+        yaml_node_t *node;
+        const char *key, *value;
+
+        if (!pair->key || !pair->value)
+            break;
+
+        node = yaml_document_get_node (doc, pair->key);
+        if (!node || YAML_SCALAR_NODE != node->type)
+            break;
+        key = (const char *)node->data.scalar.value;
+
+        node = yaml_document_get_node (doc, pair->value);
+        if (!node || YAML_SCALAR_NODE != node->type)
+            break;
+        value = (const char *)node->data.scalar.value;
+
+        if (0 == strcmp (key, "address"))
+            strncpy (dnstcp_address, value, 256 - 1);
+        else if (0 == strcmp (key, "port"))
+            dnstcp_port = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "sessions"))
+            dnstcp_sessions = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "timeout"))
+            dnstcp_timeout = strtoul (value, NULL, 10);
+    }
+
+    if (dnstcp_sessions <= 0)
+        dnstcp_sessions = 1;
+
+    return 0;
+}
+
+static int
+hev_config_parse_ports (HevConfigProfile *profile, const char *value)
+{
+    const char *ptr = value;
+    int max = sizeof (profile->ports) / sizeof (profile->ports[0]);
+
+    while (*ptr) {
+        unsigned long lo, hi;
+        char *end;
+
+        lo = strtoul (ptr, &end, 10);
+        hi = lo;
+        if (*end == '-')
+            hi = strtoul (end + 1, &end, 10);
+        if ((end == ptr) || (lo > hi) || (hi > 65535) ||
+            (profile->ports_num == max)) {
+            fprintf (stderr, "Invalid profiles ports: %s\n", value);
+            return -1;
+        }
+
+        profile->ports[profile->ports_num][0] = lo;
+        profile->ports[profile->ports_num][1] = hi;
+        profile->ports_num++;
+
+        while ((*end == ',') || (*end == ' '))
+            end++;
+        ptr = end;
+    }
+
+    return 0;
+}
+
+static int
+hev_config_parse_profile (yaml_document_t *doc, yaml_node_t *base,
+                          HevConfigProfile *profile)
+{
+    yaml_node_pair_t *pair;
+
+    if (!base || YAML_MAPPING_NODE != base->type)
+        return -1;
+
+    profile->nodelay = -1;
+    profile->notsent_lowat = -1;
+    profile->busy_poll = -1;
+    profile->priority = -1;
+    profile->keepalive = -1;
+
+    for (pair = base->data.mapping.pairs.start;
+         pair < base->data.mapping.pairs.top; pair++) {
+        yaml_node_t *node;
+        const char *key, *value;
+
+        if (!pair->key || !pair->value)
+            break;
+
+        node = yaml_document_get_node (doc, pair->key);
+        if (!node || YAML_SCALAR_NODE != node->type)
+            break;
+        key = (const char *)node->data.scalar.value;
+
+        node = yaml_document_get_node (doc, pair->value);
+        if (!node || YAML_SCALAR_NODE != node->type)
+            break;
+        value = (const char *)node->data.scalar.value;
+
+        if (0 == strcmp (key, "ports")) {
+            if (hev_config_parse_ports (profile, value) < 0)
+                return -1;
+        } else if (0 == strcmp (key, "nodelay"))
+            profile->nodelay = !strcasecmp (value, "true");
+        else if (0 == strcmp (key, "notsent-lowat"))
+            profile->notsent_lowat = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "congestion"))
+            strncpy (profile->congestion, value, 16 - 1);
+        else if (0 == strcmp (key, "busy-poll"))
+            profile->busy_poll = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "priority"))
+            profile->priority = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "keepalive"))
+            profile->keepalive = strtoul (value, NULL, 10);
+    }
+
+    return 0;
+}
+
+static int
+hev_config_parse_profiles (yaml_document_t *doc, yaml_node_t *base)
+{
+    yaml_node_item_t *item;
+
+    if (!base || YAML_SEQUENCE_NODE != base->type)
+        return -1;
+
+    profiles_num = 0;
+    for (item = base->data.sequence.items.start;
+         item < base->data.sequence.items.top; item++) {
+        yaml_node_t *node = yaml_document_get_node (doc, *item);
+
+        if (profiles_num == MAX_PROFILES) {
+            fprintf (stderr, "Too many profiles!\n");
+            return -1;
+        }
+
+        if (hev_config_parse_profile (doc, node, &profiles[profiles_num]) < 0)
+            return -1;
+        profiles_num++;
+    }
+
+    return 0;
+}
+
+static int
+hev_config_parse_tproxy (yaml_document_t *doc, yaml_node_t *base)
+{
+    yaml_node_pair_t *pair;
+
+    if (!base || YAML_MAPPING_NODE != base->type)
+        return -1;
+
+    for (pair = base->data.mapping.pairs.start;
+         pair < base->data.mapping.pairs.top; pair++) {
+        yaml_node_t *node;
+        const char *key, *value;
+
+        if (!pair->key || !pair->value)
+            break;
+
+        node = yaml_document_get_node (doc, pair->key);
+        if (!node || YAML_SCALAR_NODE != node->type)
+            break;
+        key = (const char *)node->data.scalar.value;
+
+        node = yaml_document_get_node (doc, pair->value);
+        if (!node || YAML_SCALAR_NODE != node->type)
+            break;
+        value = (const char *)node->data.scalar.value;
+
+        if (0 == strcmp (key, "address"))
+            strncpy (tproxy_address, value, 256 - 1);
+        else if (0 == strcmp (key, "port"))
+            tproxy_port = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "mode"))
+            tproxy_redirect = !strcmp (value, "redirect");
+    }
+
+    if (!tproxy_address[0])
+        strcpy (tproxy_address, "::");
+
+    return 0;
+}
+
+static int
+hev_config_parse_admission (yaml_document_t *doc, yaml_node_t *base)
+{
+    yaml_node_pair_t *pair;
+
+    if (!base || YAML_MAPPING_NODE != base->type)
+        return -1;
+
+    for (pair = base->data.mapping.pairs.start;
+         pair < base->data.mapping.pairs.top; pair++) {
+        yaml_node_t *node;
+        const char *key, *value;
+
+        if (!pair->key || !pair->value)
+            break;
+
+        node = yaml_document_get_node (doc, pair->key);
+        if (!node || YAML_SCALAR_NODE != node->type)
+            break;
+        key = (const char *)node->data.scalar.value;
+
+        node = yaml_document_get_node (doc, pair->value);
+        if (!node || YAML_SCALAR_NODE != node->type)
+            break;
+        value = (const char *)node->data.scalar.value;
+
+        if (0 == strcmp (key, "run-queue"))
+            admission_run_queue = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "write-queue"))
+            admission_write_queue = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "buffer-usage"))
+            admission_buffer_usage = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "connect-latency"))
+            admission_connect_latency = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "source-rate"))
+            admission_source_rate = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "source-burst"))
+            admission_source_burst = strtoul (value, NULL, 10);
+    }
+
+    if (admission_buffer_usage > 100)
+        admission_buffer_usage = 100;
+    if (admission_source_burst <= 0)
+        admission_source_burst = 1;
+
+    return 0;
+}
+
 static int
 hev_config_parse_log_level (const char *value)
 {
@@ -351,10 +862,26 @@ hev_config_parse_misc (yaml_document_t *doc, yaml_node_t *base)
             task_stack_size = strtoul (value, NULL, 10);
         else if (0 == strcmp (key, "tcp-buffer-size"))
             tcp_buffer_size = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "tcp-buffer-budget"))
+            tcp_buffer_budget = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "tcp-buffer-min-size"))
+            tcp_buffer_min_size = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "tcp-buffer-max-size"))
+            tcp_buffer_max_size = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "tcp-recv-into-pbuf"))
+            tcp_recv_into_pbuf = !strcasecmp (value, "true");
+        else if (0 == strcmp (key, "tcp-io-uring"))
+            tcp_io_uring = !strcasecmp (value, "true");
+        else if (0 == strcmp (key, "tcp-zerocopy-threshold"))
+            tcp_zerocopy_threshold = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "tcp-time-wait"))
+            tcp_time_wait = strtoul (value, NULL, 10);
         else if (0 == strcmp (key, "udp-recv-buffer-size"))
             udp_recv_buffer_size = strtoul (value, NULL, 10);
         else if (0 == strcmp (key, "udp-copy-buffer-nums"))
             udp_copy_buffer_nums = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "udp-share-association"))
+            udp_share_association = strcasecmp (value, "false");
         else if (0 == strcmp (key, "max-session-count"))
             max_session_count = strtoul (value, NULL, 10);
         else if (0 == strcmp (key, "connect-timeout"))
@@ -422,6 +949,16 @@ hev_config_parse_doc (yaml_document_t *doc)
             res = hev_config_parse_socks5 (doc, node);
         else if (0 == strcmp (key, "mapdns"))
             res = hev_config_parse_mapdns (doc, node);
+        else if (0 == strcmp (key, "dnscache"))
+            res = hev_config_parse_dnscache (doc, node);
+        else if (0 == strcmp (key, "dnstcp"))
+            res = hev_config_parse_dnstcp (doc, node);
+        else if (0 == strcmp (key, "tproxy"))
+            res = hev_config_parse_tproxy (doc, node);
+        else if (0 == strcmp (key, "admission"))
+            res = hev_config_parse_admission (doc, node);
+        else if (0 == strcmp (key, "profiles"))
+            res = hev_config_parse_profiles (doc, node);
         else if (0 == strcmp (key, "misc"))
             res = hev_config_parse_misc (doc, node);
 
@@ -432,12 +969,19 @@ hev_config_parse_doc (yaml_document_t *doc)
     if (tcp_buffer_size > TCP_SND_BUF)
         tcp_buffer_size = TCP_SND_BUF;
 
-    udp_buffer_size = UDP_BUF_SIZE * udp_copy_buffer_nums;
+    if (tcp_buffer_max_size > 0) {
+        if (tcp_buffer_min_size < 4096)
+            tcp_buffer_min_size = 4096;
+        if (tcp_buffer_max_size < tcp_buffer_min_size)
+            tcp_buffer_max_size = tcp_buffer_min_size;
+    }
 
-    if (tcp_buffer_size > udp_buffer_size)
-        min_task_stack_size = TASK_STACK_SIZE + tcp_buffer_size;
-    else
-        min_task_stack_size = TASK_STACK_SIZE + udp_buffer_size;
+    /*
+     * TCP buffers are borrowed from the shared pool and UDP buffers live
+     * in the slab, only the UDP buffer descriptors are stacked.
+     */
+    udp_buffer_size = 64 * udp_copy_buffer_nums;
+    min_task_stack_size = TASK_STACK_SIZE + udp_buffer_size;
 
     if (task_stack_size < min_task_stack_size)
         task_stack_size = min_task_stack_size;
@@ -570,7 +1114,51 @@ hev_config_get_tunnel_pre_down_script (void)
 HevConfigServer *
 hev_config_get_socks5_server (void)
 {
-    return &srv;
+    return &srvs[0];
+}
+
+HevConfigServer *
+hev_config_get_socks5_servers (int *num)
+{
+    *num = srvs_num;
+
+    return srvs;
+}
+
+int
+hev_config_get_socks5_balance (void)
+{
+    return socks5_balance;
+}
+
+int
+hev_config_get_socks5_health_interval (void)
+{
+    return socks5_health_interval;
+}
+
+int
+hev_config_get_socks5_health_fall (void)
+{
+    return socks5_health_fall;
+}
+
+int
+hev_config_get_socks5_health_rise (void)
+{
+    return socks5_health_rise;
+}
+
+int
+hev_config_get_socks5_race_delay (void)
+{
+    return socks5_race_delay;
+}
+
+int
+hev_config_get_socks5_udp_shared_sockets (void)
+{
+    return socks5_udp_shared_sockets;
 }
 
 int
@@ -603,6 +1191,131 @@ hev_config_get_mapdns_cache_size (void)
     return mapdns_cache_size;
 }
 
+int
+hev_config_get_dnscache_cache_size (void)
+{
+    return dnscache_size;
+}
+
+int
+hev_config_get_dnscache_min_ttl (void)
+{
+    return dnscache_min_ttl;
+}
+
+int
+hev_config_get_dnscache_max_ttl (void)
+{
+    return dnscache_max_ttl;
+}
+
+int
+hev_config_get_dnscache_prefetch (void)
+{
+    return dnscache_prefetch;
+}
+
+const char *
+hev_config_get_dnstcp_address (void)
+{
+    if (!dnstcp_address[0])
+        return NULL;
+
+    return dnstcp_address;
+}
+
+int
+hev_config_get_dnstcp_port (void)
+{
+    return dnstcp_port;
+}
+
+int
+hev_config_get_dnstcp_sessions (void)
+{
+    return dnstcp_sessions;
+}
+
+int
+hev_config_get_dnstcp_timeout (void)
+{
+    return dnstcp_timeout;
+}
+
+HevConfigProfile *
+hev_config_get_profile (unsigned short port)
+{
+    int i, j;
+
+    for (i = 0; i < profiles_num; i++) {
+        HevConfigProfile *profile = &profiles[i];
+
+        if (!profile->ports_num)
+            return profile;
+
+        for (j = 0; j < profile->ports_num; j++)
+            if ((port >= profile->ports[j][0]) &&
+                (port <= profile->ports[j][1]))
+                return profile;
+    }
+
+    return NULL;
+}
+
+const char *
+hev_config_get_tproxy_address (void)
+{
+    return tproxy_address;
+}
+
+int
+hev_config_get_tproxy_port (void)
+{
+    return tproxy_port;
+}
+
+int
+hev_config_get_tproxy_redirect (void)
+{
+    return tproxy_redirect;
+}
+
+int
+hev_config_get_admission_run_queue (void)
+{
+    return admission_run_queue;
+}
+
+int
+hev_config_get_admission_write_queue (void)
+{
+    return admission_write_queue;
+}
+
+int
+hev_config_get_admission_buffer_usage (void)
+{
+    return admission_buffer_usage;
+}
+
+int
+hev_config_get_admission_connect_latency (void)
+{
+    return admission_connect_latency;
+}
+
+int
+hev_config_get_admission_source_rate (void)
+{
+    return admission_source_rate;
+}
+
+int
+hev_config_get_admission_source_burst (void)
+{
+    return admission_source_burst;
+}
+
 int
 hev_config_get_misc_task_stack_size (void)
 {
@@ -615,6 +1328,48 @@ hev_config_get_misc_tcp_buffer_size (void)
     return tcp_buffer_size;
 }
 
+int
+hev_config_get_misc_tcp_buffer_budget (void)
+{
+    return tcp_buffer_budget;
+}
+
+int
+hev_config_get_misc_tcp_buffer_min_size (void)
+{
+    return tcp_buffer_min_size;
+}
+
+int
+hev_config_get_misc_tcp_buffer_max_size (void)
+{
+    return tcp_buffer_max_size;
+}
+
+int
+hev_config_get_misc_tcp_recv_into_pbuf (void)
+{
+    return tcp_recv_into_pbuf;
+}
+
+int
+hev_config_get_misc_tcp_io_uring (void)
+{
+    return tcp_io_uring;
+}
+
+int
+hev_config_get_misc_tcp_zerocopy_threshold (void)
+{
+    return tcp_zerocopy_threshold;
+}
+
+int
+hev_config_get_misc_tcp_time_wait (void)
+{
+    return tcp_time_wait;
+}
+
 int
 hev_config_get_misc_udp_recv_buffer_size (void)
 {
@@ -627,6 +1382,12 @@ hev_config_get_misc_udp_copy_buffer_nums (void)
     return udp_copy_buffer_nums;
 }
 
+int
+hev_config_get_misc_udp_share_association (void)
+{
+    return udp_share_association;
+}
+
 int
 hev_config_get_misc_max_session_count (void)
 {
@@ -11,6 +11,15 @@
 #define __HEV_CONFIG_H__
 
 typedef struct _HevConfigServer HevConfigServer;
+typedef struct _HevConfigProfile HevConfigProfile;
+
+enum
+{
+    HEV_CONFIG_BALANCE_ROUND_ROBIN,
+    HEV_CONFIG_BALANCE_LEAST_SESSIONS,
+    HEV_CONFIG_BALANCE_LATENCY,
+    HEV_CONFIG_BALANCE_HASH,
+};
 
 struct _HevConfigServer
 {
@@ -19,11 +28,28 @@ struct _HevConfigServer
     unsigned int mark;
     short udp_in_udp;
     unsigned short port;
+    unsigned short pool;
+    unsigned short pool_idle;
     unsigned char pipeline;
+    unsigned char early_data;
+    unsigned char fast_open;
     char udp_addr[256];
     char addr[256];
 };
 
+/* Upstream socket options, -1 or empty keeps the system default. */
+struct _HevConfigProfile
+{
+    int nodelay;
+    int notsent_lowat;
+    int busy_poll;
+    int priority;
+    int keepalive;
+    char congestion[16];
+    int ports_num;
+    unsigned short ports[16][2];
+};
+
 int hev_config_init_from_file (const char *config_path);
 int hev_config_init_from_str (const unsigned char *config_str,
                               unsigned int config_len);
@@ -40,6 +66,13 @@ const char *hev_config_get_tunnel_post_up_script (void);
 const char *hev_config_get_tunnel_pre_down_script (void);
 
 HevConfigServer *hev_config_get_socks5_server (void);
+HevConfigServer *hev_config_get_socks5_servers (int *num);
+int hev_config_get_socks5_balance (void);
+int hev_config_get_socks5_health_interval (void);
+int hev_config_get_socks5_health_fall (void);
+int hev_config_get_socks5_health_rise (void);
+int hev_config_get_socks5_race_delay (void);
+int hev_config_get_socks5_udp_shared_sockets (void);
 
 int hev_config_get_mapdns_address (void);
 int hev_config_get_mapdns_port (void);
@@ -47,10 +80,48 @@ int hev_config_get_mapdns_network (void);
 int hev_config_get_mapdns_netmask (void);
 int hev_config_get_mapdns_cache_size (void);
 
+int hev_config_get_dnscache_cache_size (void);
+int hev_config_get_dnscache_min_ttl (void);
+int hev_config_get_dnscache_max_ttl (void);
+int hev_config_get_dnscache_prefetch (void);
+
+const char *hev_config_get_dnstcp_address (void);
+int hev_config_get_dnstcp_port (void);
+int hev_config_get_dnstcp_sessions (void);
+int hev_config_get_dnstcp_timeout (void);
+
+/**
+ * hev_config_get_profile:
+ * @port: destination port
+ *
+ * Returns: the first profile listing @port or listing no ports, NULL if
+ * none matches
+ */
+HevConfigProfile *hev_config_get_profile (unsigned short port);
+
+const char *hev_config_get_tproxy_address (void);
+int hev_config_get_tproxy_port (void);
+int hev_config_get_tproxy_redirect (void);
+
+int hev_config_get_admission_run_queue (void);
+int hev_config_get_admission_write_queue (void);
+int hev_config_get_admission_buffer_usage (void);
+int hev_config_get_admission_connect_latency (void);
+int hev_config_get_admission_source_rate (void);
+int hev_config_get_admission_source_burst (void);
+
 int hev_config_get_misc_task_stack_size (void);
 int hev_config_get_misc_tcp_buffer_size (void);
+int hev_config_get_misc_tcp_buffer_budget (void);
+int hev_config_get_misc_tcp_buffer_min_size (void);
+int hev_config_get_misc_tcp_buffer_max_size (void);
+int hev_config_get_misc_tcp_recv_into_pbuf (void);
+int hev_config_get_misc_tcp_io_uring (void);
+int hev_config_get_misc_tcp_zerocopy_threshold (void);
+int hev_config_get_misc_tcp_time_wait (void);
 int hev_config_get_misc_udp_recv_buffer_size (void);
 int hev_config_get_misc_udp_copy_buffer_nums (void);
+int hev_config_get_misc_udp_share_association (void);
 int hev_config_get_misc_max_session_count (void);
 int hev_config_get_misc_connect_timeout (void);
 int hev_config_get_misc_tcp_read_write_timeout (void);
@@ -1,256 +1,310 @@
 /*
  ============================================================================
  Name        : hev-connection-pool.c
- Author      : Performance Optimization Team
- Copyright   : Copyright (c) 2025
- Description : Connection Pool Implementation
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Socks5 Warm Connection Pool
  ============================================================================
  */
 
-#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#include <fcntl.h>
+
+#include <hev-memory-allocator.h>
+
+#include "hev-logger.h"
+#include "hev-socks5-proxy.h"
 
 #include "hev-connection-pool.h"
 
-HevConnectionPool *
-hev_connection_pool_new(size_t size)
+#define MAX_SCALE (4)
+#define RATE_WINDOW (1000)
+#define REFILL_INTERVAL (100)
+#define RETRY_DELAY (1000)
+
+typedef struct _HevConnectionPoolSlot HevConnectionPoolSlot;
+
+struct _HevConnectionPoolSlot
 {
-    HevConnectionPool *pool;
-    
-    if (size > CONN_POOL_SIZE)
-        size = CONN_POOL_SIZE;
-    
-    pool = calloc(1, sizeof(HevConnectionPool));
-    if (!pool)
-        return NULL;
-    
-    pool->size = size;
-    pthread_mutex_init(&pool->mutex, NULL);
-    
-    for (size_t i = 0; i < size; i++) {
-        pool->conns[i].fd = -1;
-        pool->conns[i].in_use = false;
-    }
-    
-    return pool;
+    int fd;
+    long created;
+};
+
+struct _HevConnectionPool
+{
+    int run;
+    int min;
+    int max;
+    int idle;
+    int num;
+    int target;
+    int accepts;
+    long window;
+    long retry;
+
+    unsigned int rate;
+    unsigned int handshake;
+
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long opened;
+    unsigned long expired;
+    unsigned long long saved;
+
+    HevConfigServer *srv;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+
+    HevConnectionPoolSlot slots[0];
+};
+
+static long
+monotonic_msec (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
-void
-hev_connection_pool_destroy(HevConnectionPool *pool)
+static long
+monotonic_usec (void)
 {
-    if (!pool)
-        return;
-    
-    pthread_mutex_lock(&pool->mutex);
-    
-    for (size_t i = 0; i < pool->size; i++) {
-        if (pool->conns[i].fd >= 0) {
-            close(pool->conns[i].fd);
-            pool->conns[i].fd = -1;
-        }
-    }
-    
-    pthread_mutex_unlock(&pool->mutex);
-    pthread_mutex_destroy(&pool->mutex);
-    
-    free(pool);
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int
+hev_connection_pool_alive (int fd)
+{
+    char b;
+    ssize_t s;
+
+    /* The server never speaks first after auth, so any data is an error. */
+    s = recv (fd, &b, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (s < 0)
+        return (errno == EAGAIN) || (errno == EWOULDBLOCK);
+
+    return 0;
 }
 
 int
-hev_connection_pool_get(HevConnectionPool *pool, 
-                       const char *server, 
-                       uint16_t port)
+hev_connection_pool_take (HevConnectionPool *self)
 {
-    if (!pool)
-        return -1;
-    
-    time_t now = time(NULL);
     int fd = -1;
-    
-    pthread_mutex_lock(&pool->mutex);
-    pool->total_requests++;
-    
-    /* Try to find existing connection */
-    for (size_t i = 0; i < pool->size; i++) {
-        if (pool->conns[i].fd >= 0 && 
-            !pool->conns[i].in_use &&
-            (now - pool->conns[i].last_used) < CONN_IDLE_TIMEOUT) {
-            
-            /* Test if connection is still alive */
-            char buf[1];
-            int ret = recv(pool->conns[i].fd, buf, 1, 
-                          MSG_PEEK | MSG_DONTWAIT);
-            
-            if (ret == 0 || (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
-                /* Connection closed, remove it */
-                close(pool->conns[i].fd);
-                pool->conns[i].fd = -1;
-                pool->evictions++;
-                continue;
-            }
-            
-            /* Reuse this connection */
-            pool->conns[i].in_use = true;
-            pool->conns[i].last_used = now;
-            pool->conns[i].use_count++;
-            fd = pool->conns[i].fd;
-            pool->cache_hits++;
+
+    pthread_mutex_lock (&self->mutex);
+    self->accepts++;
+
+    while (self->num) {
+        HevConnectionPoolSlot *slot = &self->slots[--self->num];
+
+        if (hev_connection_pool_alive (slot->fd)) {
+            fd = slot->fd;
             break;
         }
+
+        close (slot->fd);
+        self->expired++;
     }
-    
-    pthread_mutex_unlock(&pool->mutex);
-    
-    /* Create new connection if none available */
-    if (fd < 0) {
-        fd = socket(AF_INET, SOCK_STREAM, 0);
-        if (fd < 0)
-            return -1;
-        
-        /* Set non-blocking */
-        int flags = fcntl(fd, F_GETFL, 0);
-        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
-        
-        /* Connect to server */
-        struct sockaddr_in addr;
-        memset(&addr, 0, sizeof(addr));
-        addr.sin_family = AF_INET;
-        addr.sin_port = htons(port);
-        inet_pton(AF_INET, server, &addr.sin_addr);
-        
-        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-            if (errno != EINPROGRESS) {
-                close(fd);
-                return -1;
-            }
-        }
-        
-        pthread_mutex_lock(&pool->mutex);
-        pool->cache_misses++;
-        pthread_mutex_unlock(&pool->mutex);
+
+    if (fd >= 0) {
+        self->hits++;
+        self->saved += self->handshake;
+    } else {
+        self->misses++;
     }
-    
+
+    pthread_cond_signal (&self->cond);
+    pthread_mutex_unlock (&self->mutex);
+
     return fd;
 }
 
-void
-hev_connection_pool_release(HevConnectionPool *pool, int fd)
+static int
+hev_connection_pool_open (HevConnectionPool *self, unsigned int *usec)
 {
-    if (!pool || fd < 0)
-        return;
-    
-    time_t now = time(NULL);
-    
-    pthread_mutex_lock(&pool->mutex);
-    
-    /* Find connection in pool */
-    bool found = false;
-    for (size_t i = 0; i < pool->size; i++) {
-        if (pool->conns[i].fd == fd) {
-            pool->conns[i].in_use = false;
-            pool->conns[i].last_used = now;
-            found = true;
-            break;
-        }
+    int timeout = hev_config_get_misc_connect_timeout ();
+    long start = monotonic_usec ();
+    int fd;
+
+    fd = hev_socks5_proxy_connect (self->srv, timeout);
+    if (fd < 0)
+        return -1;
+
+    if (hev_socks5_proxy_handshake (fd, self->srv, timeout) < 0) {
+        close (fd);
+        return -1;
     }
-    
-    /* Add to pool if not found */
-    if (!found) {
-        for (size_t i = 0; i < pool->size; i++) {
-            if (pool->conns[i].fd < 0) {
-                pool->conns[i].fd = fd;
-                pool->conns[i].in_use = false;
-                pool->conns[i].last_used = now;
-                pool->conns[i].created = now;
-                pool->conns[i].use_count = 1;
-                found = true;
-                break;
-            }
-        }
-        
-        /* Pool is full, close this connection */
-        if (!found) {
-            close(fd);
-            pool->evictions++;
-        }
+
+    if (self->srv->fast_open)
+        hev_socks5_proxy_fast_open_done (fd);
+
+    *usec = monotonic_usec () - start;
+
+    return fd;
+}
+
+/*
+ * Called with self->mutex held. Keeps enough warm connections to cover
+ * the arrivals during two handshakes, on top of the configured minimum.
+ */
+static void
+hev_connection_pool_update (HevConnectionPool *self, long now)
+{
+    unsigned long need;
+    long span = now - self->window;
+
+    if (span >= RATE_WINDOW) {
+        unsigned int rate = self->accepts * 1000 / span;
+
+        self->rate = (self->rate * 3 + rate) / 4;
+        self->accepts = 0;
+        self->window = now;
+    }
+
+    need = (unsigned long)self->rate * self->handshake * 2 / 1000000;
+    self->target = self->min + need;
+    if (self->target > self->max)
+        self->target = self->max;
+
+    while (self->num && ((now - self->slots[0].created) >= self->idle)) {
+        close (self->slots[0].fd);
+        self->num--;
+        self->expired++;
+        memmove (&self->slots[0], &self->slots[1],
+                 sizeof (HevConnectionPoolSlot) * self->num);
     }
-    
-    pthread_mutex_unlock(&pool->mutex);
 }
 
-void
-hev_connection_pool_remove(HevConnectionPool *pool, int fd)
+static void *
+hev_connection_pool_thread (void *data)
 {
-    if (!pool || fd < 0)
-        return;
-    
-    pthread_mutex_lock(&pool->mutex);
-    
-    for (size_t i = 0; i < pool->size; i++) {
-        if (pool->conns[i].fd == fd) {
-            close(pool->conns[i].fd);
-            pool->conns[i].fd = -1;
-            pool->conns[i].in_use = false;
-            pool->evictions++;
-            break;
+    HevConnectionPool *self = data;
+
+    pthread_mutex_lock (&self->mutex);
+    while (self->run) {
+        struct timespec ts;
+        long now;
+
+        clock_gettime (CLOCK_REALTIME, &ts);
+        ts.tv_nsec += REFILL_INTERVAL * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait (&self->cond, &self->mutex, &ts);
+
+        now = monotonic_msec ();
+        hev_connection_pool_update (self, now);
+
+        while (self->run && (self->num < self->target) &&
+               (now >= self->retry)) {
+            unsigned int usec;
+            int fd;
+
+            pthread_mutex_unlock (&self->mutex);
+            fd = hev_connection_pool_open (self, &usec);
+            pthread_mutex_lock (&self->mutex);
+
+            now = monotonic_msec ();
+            if (fd < 0) {
+                LOG_W ("%p connection pool refill", self);
+                self->retry = now + RETRY_DELAY;
+                break;
+            }
+
+            if (!self->run || (self->num == self->max)) {
+                close (fd);
+                break;
+            }
+
+            self->slots[self->num].fd = fd;
+            self->slots[self->num].created = now;
+            self->num++;
+            self->opened++;
+
+            if (self->handshake)
+                self->handshake = (self->handshake * 7 + usec) / 8;
+            else
+                self->handshake = usec;
         }
     }
-    
-    pthread_mutex_unlock(&pool->mutex);
+    pthread_mutex_unlock (&self->mutex);
+
+    return NULL;
 }
 
-void
-hev_connection_pool_cleanup(HevConnectionPool *pool)
+HevConnectionPool *
+hev_connection_pool_new (HevConfigServer *srv)
 {
-    if (!pool)
-        return;
-    
-    time_t now = time(NULL);
-    
-    pthread_mutex_lock(&pool->mutex);
-    
-    for (size_t i = 0; i < pool->size; i++) {
-        if (pool->conns[i].fd >= 0 &&
-            !pool->conns[i].in_use &&
-            (now - pool->conns[i].last_used) >= CONN_IDLE_TIMEOUT) {
-            
-            close(pool->conns[i].fd);
-            pool->conns[i].fd = -1;
-            pool->evictions++;
-        }
+    HevConnectionPool *self;
+    int max;
+
+    max = srv->pool * MAX_SCALE;
+
+    self = hev_malloc0 (sizeof (HevConnectionPool) +
+                        sizeof (HevConnectionPoolSlot) * max);
+    if (!self)
+        return NULL;
+
+    self->run = 1;
+    self->srv = srv;
+    self->min = srv->pool;
+    self->max = max;
+    self->target = srv->pool;
+    self->idle = srv->pool_idle * 1000;
+    self->window = monotonic_msec ();
+
+    pthread_mutex_init (&self->mutex, NULL);
+    pthread_cond_init (&self->cond, NULL);
+
+    if (pthread_create (&self->thread, NULL, hev_connection_pool_thread,
+                        self) != 0) {
+        pthread_cond_destroy (&self->cond);
+        pthread_mutex_destroy (&self->mutex);
+        hev_free (self);
+        return NULL;
     }
-    
-    pthread_mutex_unlock(&pool->mutex);
+
+    LOG_D ("%p connection pool new", self);
+
+    return self;
 }
 
 void
-hev_connection_pool_stats(HevConnectionPool *pool,
-                         uint64_t *hits,
-                         uint64_t *misses,
-                         float *hit_rate)
+hev_connection_pool_destroy (HevConnectionPool *self)
 {
-    if (!pool)
-        return;
-    
-    pthread_mutex_lock(&pool->mutex);
-    
-    if (hits)
-        *hits = pool->cache_hits;
-    
-    if (misses)
-        *misses = pool->cache_misses;
-    
-    if (hit_rate) {
-        if (pool->total_requests > 0)
-            *hit_rate = (float)pool->cache_hits * 100.0f / pool->total_requests;
-        else
-            *hit_rate = 0.0f;
-    }
-    
-    pthread_mutex_unlock(&pool->mutex);
+    unsigned long total;
+    int i;
+
+    LOG_D ("%p connection pool destroy", self);
+
+    pthread_mutex_lock (&self->mutex);
+    self->run = 0;
+    pthread_cond_signal (&self->cond);
+    pthread_mutex_unlock (&self->mutex);
+    pthread_join (self->thread, NULL);
+
+    for (i = 0; i < self->num; i++)
+        close (self->slots[i].fd);
+
+    total = self->hits + self->misses;
+    LOG_I ("connection pool: %lu hits %lu misses (%lu%%) %llu ms saved "
+           "%lu opened %lu expired",
+           self->hits, self->misses, total ? self->hits * 100 / total : 0,
+           self->saved / 1000, self->opened, self->expired);
+
+    pthread_cond_destroy (&self->cond);
+    pthread_mutex_destroy (&self->mutex);
+    hev_free (self);
 }
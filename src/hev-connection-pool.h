@@ -1,130 +1,49 @@
 /*
  ============================================================================
  Name        : hev-connection-pool.h
- Author      : Performance Optimization Team
- Copyright   : Copyright (c) 2025
- Description : Connection Pool for SOCKS5
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Socks5 Warm Connection Pool
  ============================================================================
  */
 
 #ifndef __HEV_CONNECTION_POOL_H__
 #define __HEV_CONNECTION_POOL_H__
 
-#include <stddef.h>
-#include <stdint.h>
-#include <time.h>
-#include <pthread.h>
+#include "hev-config.h"
 
-#define CONN_POOL_SIZE 128
-#define CONN_IDLE_TIMEOUT 60
-
-typedef struct _HevConnection HevConnection;
 typedef struct _HevConnectionPool HevConnectionPool;
 
-struct _HevConnection {
-    int fd;
-    time_t last_used;
-    time_t created;
-    bool in_use;
-    uint32_t use_count;
-};
-
-struct _HevConnectionPool {
-    HevConnection conns[CONN_POOL_SIZE];
-    pthread_mutex_t mutex;
-    size_t size;
-    
-    /* Statistics */
-    uint64_t total_requests;
-    uint64_t cache_hits;
-    uint64_t cache_misses;
-    uint64_t evictions;
-};
-
 /**
  * hev_connection_pool_new:
- * @size: pool size
- *
- * Create new connection pool
+ * @srv: socks5 server
  *
- * Returns: HevConnectionPool or NULL
+ * Create a pool that keeps connections to @srv open and already past the
+ * method selection and authentication stage, so a new session only has to
+ * send its request. The number of warm connections follows the rate at
+ * which connections are taken, starting from the configured pool size.
  *
- * Since: 2.0
+ * Returns: new pool instance
  */
-HevConnectionPool *hev_connection_pool_new(size_t size);
+HevConnectionPool *hev_connection_pool_new (HevConfigServer *srv);
 
 /**
  * hev_connection_pool_destroy:
- * @pool: HevConnectionPool
- *
- * Destroy connection pool
- *
- * Since: 2.0
- */
-void hev_connection_pool_destroy(HevConnectionPool *pool);
-
-/**
- * hev_connection_pool_get:
- * @pool: HevConnectionPool
- * @server: server address
- * @port: server port
- *
- * Get connection from pool or create new
- *
- * Returns: file descriptor or -1
- *
- * Since: 2.0
- */
-int hev_connection_pool_get(HevConnectionPool *pool, 
-                           const char *server, 
-                           uint16_t port);
-
-/**
- * hev_connection_pool_release:
- * @pool: HevConnectionPool
- * @fd: file descriptor
- *
- * Release connection back to pool
- *
- * Since: 2.0
- */
-void hev_connection_pool_release(HevConnectionPool *pool, int fd);
-
-/**
- * hev_connection_pool_remove:
- * @pool: HevConnectionPool
- * @fd: file descriptor
- *
- * Remove connection from pool (on error)
- *
- * Since: 2.0
- */
-void hev_connection_pool_remove(HevConnectionPool *pool, int fd);
-
-/**
- * hev_connection_pool_cleanup:
- * @pool: HevConnectionPool
- *
- * Clean up idle connections
+ * @self: pool instance
  *
- * Since: 2.0
+ * Stop refilling and close all warm connections.
  */
-void hev_connection_pool_cleanup(HevConnectionPool *pool);
+void hev_connection_pool_destroy (HevConnectionPool *self);
 
 /**
- * hev_connection_pool_stats:
- * @pool: HevConnectionPool
- * @hits: (out) cache hits
- * @misses: (out) cache misses
- * @hit_rate: (out) hit rate percentage
+ * hev_connection_pool_take:
+ * @self: pool instance
  *
- * Get pool statistics
+ * Take a warm connection. The socket is non-blocking and owned by the
+ * caller from now on.
  *
- * Since: 2.0
+ * Returns: socket on hit, -1 when the pool is empty
  */
-void hev_connection_pool_stats(HevConnectionPool *pool,
-                              uint64_t *hits,
-                              uint64_t *misses,
-                              float *hit_rate);
+int hev_connection_pool_take (HevConnectionPool *self);
 
 #endif /* __HEV_CONNECTION_POOL_H__ */
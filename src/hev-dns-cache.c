@@ -0,0 +1,554 @@
+/*
+ ============================================================================
+ Name        : hev-dns-cache.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : DNS Cache
+ ============================================================================
+ */
+
+#include <time.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include <lwip/udp.h>
+
+#include <hev-compiler.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-logger.h"
+#include "hev-config-const.h"
+
+#include "hev-dns-cache.h"
+
+#define MAX_KEY (255 + 4)
+#define MAX_MSG (4096)
+#define MAX_TTLS (32)
+#define UDP_SIZE (512)
+
+static HevDNSCache *singleton;
+
+typedef struct _DNSHdr DNSHdr;
+typedef struct _HevDNSCacheNode HevDNSCacheNode;
+
+struct _DNSHdr
+{
+    uint16_t id;
+    uint16_t fl;
+    uint16_t qd;
+    uint16_t an;
+    uint16_t ns;
+    uint16_t ar;
+};
+
+struct _HevDNSCacheNode
+{
+    HevRBTreeNode tree;
+    HevListNode list;
+    time_t stored;
+    time_t expire;
+    int ttl;
+    int hits;
+    int refreshing;
+    int klen;
+    int rlen;
+    int ntl;
+    uint16_t tlo[MAX_TTLS];
+    uint8_t data[0];
+};
+
+HevDNSCache *
+hev_dns_cache_new (int max, int min_ttl, int max_ttl, int prefetch)
+{
+    HevDNSCache *self;
+    int res;
+
+    self = hev_malloc0 (sizeof (HevDNSCache));
+    if (!self)
+        return NULL;
+
+    res = hev_dns_cache_construct (self, max, min_ttl, max_ttl, prefetch);
+    if (res < 0) {
+        hev_free (self);
+        return NULL;
+    }
+
+    LOG_D ("%p dns cache new", self);
+
+    return self;
+}
+
+HevDNSCache *
+hev_dns_cache_get (void)
+{
+    return singleton;
+}
+
+void
+hev_dns_cache_put (HevDNSCache *self)
+{
+    singleton = self;
+}
+
+static inline uint16_t
+read_u16 (const uint8_t *p)
+{
+    return ((uint16_t)p[0] << 8) | p[1];
+}
+
+static inline uint32_t
+read_u32 (const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void
+write_u32 (uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static time_t
+monotonic_time (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec;
+}
+
+static int
+dns_question_key (const uint8_t *msg, int len, uint8_t *key, int *qend)
+{
+    int off = sizeof (DNSHdr);
+    int klen = 0;
+
+    for (;;) {
+        int l, i;
+
+        if (off >= len)
+            return -1;
+
+        l = msg[off++];
+        key[klen++] = l;
+        if (!l)
+            break;
+
+        if ((l & 0xc0) || ((off + l) > len) || ((klen + l) >= 256))
+            return -1;
+
+        for (i = 0; i < l; i++)
+            key[klen++] = tolower (msg[off + i]);
+        off += l;
+    }
+
+    if ((off + 4) > len)
+        return -1;
+
+    memcpy (&key[klen], &msg[off], 4);
+    *qend = off + 4;
+
+    return klen + 4;
+}
+
+static int
+dns_skip_name (const uint8_t *msg, int len, int off)
+{
+    while (off < len) {
+        int l = msg[off];
+
+        if ((l & 0xc0) == 0xc0)
+            return off + 2;
+        if (l & 0xc0)
+            return -1;
+        if (!l)
+            return off + 1;
+
+        off += 1 + l;
+    }
+
+    return -1;
+}
+
+int
+hev_dns_cache_udp_size (const void *req, int len)
+{
+    const DNSHdr *hdr = req;
+    const uint8_t *msg = req;
+    int off = sizeof (DNSHdr);
+    int rrs, i;
+
+    if (len < sizeof (DNSHdr))
+        return UDP_SIZE;
+
+    for (i = ntohs (hdr->qd); i > 0; i--) {
+        off = dns_skip_name (msg, len, off);
+        if (off < 0)
+            return UDP_SIZE;
+        off += 4;
+    }
+
+    /* The class field of the OPT pseudo record is the payload size. */
+    rrs = ntohs (hdr->an) + ntohs (hdr->ns) + ntohs (hdr->ar);
+    for (i = 0; i < rrs; i++) {
+        off = dns_skip_name (msg, len, off);
+        if ((off < 0) || ((off + 10) > len))
+            break;
+
+        if (read_u16 (&msg[off]) == 41) {
+            int size = read_u16 (&msg[off + 2]);
+
+            return (size > UDP_SIZE) ? size : UDP_SIZE;
+        }
+
+        off += 10 + read_u16 (&msg[off + 8]);
+    }
+
+    return UDP_SIZE;
+}
+
+int
+hev_dns_cache_truncate (void *res, int len)
+{
+    DNSHdr *hdr = res;
+    uint8_t *msg = res;
+    int off = sizeof (DNSHdr);
+    int i;
+
+    if (len < sizeof (DNSHdr))
+        return len;
+
+    for (i = ntohs (hdr->qd); i > 0; i--) {
+        off = dns_skip_name (msg, len, off);
+        if ((off < 0) || ((off + 4) > len)) {
+            off = sizeof (DNSHdr);
+            hdr->qd = 0;
+            break;
+        }
+        off += 4;
+    }
+
+    hdr->fl |= htons (0x0200);
+    hdr->an = 0;
+    hdr->ns = 0;
+    hdr->ar = 0;
+
+    return off;
+}
+
+static HevDNSCacheNode *
+hev_dns_cache_find (HevDNSCache *self, const uint8_t *key, int klen,
+                    HevRBTreeNode **parent, HevRBTreeNode ***link)
+{
+    HevRBTreeNode **new = &self->tree.root, *p = NULL;
+
+    while (*new) {
+        HevDNSCacheNode *node;
+        int res;
+
+        node = container_of (*new, HevDNSCacheNode, tree);
+        res = node->klen - klen;
+        if (!res)
+            res = memcmp (node->data, key, klen);
+        p = *new;
+
+        if (res < 0) {
+            new = &((*new)->left);
+        } else if (res > 0) {
+            new = &((*new)->right);
+        } else {
+            return node;
+        }
+    }
+
+    if (parent)
+        *parent = p;
+    if (link)
+        *link = new;
+
+    return NULL;
+}
+
+static void
+hev_dns_cache_remove (HevDNSCache *self, HevDNSCacheNode *node)
+{
+    hev_rbtree_erase (&self->tree, &node->tree);
+    hev_list_del (&self->list, &node->list);
+    hev_free (node);
+    self->use--;
+}
+
+int
+hev_dns_cache_lookup (HevDNSCache *self, const void *req, int qlen,
+                      void *res, int slen, int *refresh)
+{
+    const DNSHdr *qhdr = req;
+    HevDNSCacheNode *node;
+    uint8_t key[MAX_KEY];
+    uint8_t *sb = res;
+    time_t now, left;
+    int klen, qend;
+    int i;
+
+    *refresh = 0;
+
+    if (qlen < sizeof (DNSHdr))
+        return -1;
+    if ((ntohs (qhdr->fl) & 0x8000) || (ntohs (qhdr->qd) != 1))
+        return -1;
+
+    klen = dns_question_key (req, qlen, key, &qend);
+    if (klen < 0)
+        return -1;
+
+    node = hev_dns_cache_find (self, key, klen, NULL, NULL);
+    if (!node) {
+        self->misses++;
+        return 0;
+    }
+
+    now = monotonic_time ();
+    left = node->expire - now;
+    if (left <= 0) {
+        hev_dns_cache_remove (self, node);
+        self->misses++;
+        return 0;
+    }
+
+    if (node->rlen > slen)
+        return 0;
+
+    memcpy (sb, node->data + node->klen, node->rlen);
+
+    /* Answer with the query id, RD bit and the client's 0x20 casing. */
+    memcpy (sb, req, 2);
+    sb[2] = (sb[2] & ~0x01) | (((const uint8_t *)req)[2] & 0x01);
+    memcpy (sb + sizeof (DNSHdr), (const uint8_t *)req + sizeof (DNSHdr),
+            qend - sizeof (DNSHdr));
+
+    for (i = 0; i < node->ntl; i++) {
+        uint8_t *p = sb + node->tlo[i];
+        long ttl = (long)read_u32 (p) - (now - node->stored);
+
+        if ((ttl <= 0) || (ttl > left))
+            ttl = left;
+        write_u32 (p, ttl);
+    }
+
+    hev_list_del (&self->list, &node->list);
+    hev_list_add_tail (&self->list, &node->list);
+
+    self->hits++;
+    node->hits++;
+
+    if (self->prefetch && (node->hits > 1) && !node->refreshing &&
+        ((left * 100) < ((long)node->ttl * self->prefetch))) {
+        node->refreshing = 1;
+        self->prefetches++;
+        *refresh = 1;
+    }
+
+    return node->rlen;
+}
+
+void
+hev_dns_cache_store (HevDNSCache *self, const void *res, int len)
+{
+    const DNSHdr *hdr = res;
+    const uint8_t *msg = res;
+    HevRBTreeNode **link = NULL, *parent = NULL;
+    HevDNSCacheNode *node;
+    uint16_t tlo[MAX_TTLS];
+    uint8_t key[MAX_KEY];
+    int klen, off, rrs;
+    int ttl = INT32_MAX;
+    int ntl = 0;
+    int fl, i;
+
+    if ((len < sizeof (DNSHdr)) || (len > MAX_MSG))
+        return;
+
+    /* Only complete NOERROR and NXDOMAIN answers are cacheable. */
+    fl = ntohs (hdr->fl);
+    if (!(fl & 0x8000) || (fl & 0x0200))
+        return;
+    if (((fl & 0xf) != 0) && ((fl & 0xf) != 3))
+        return;
+    if (ntohs (hdr->qd) != 1)
+        return;
+
+    klen = dns_question_key (msg, len, key, &off);
+    if (klen < 0)
+        return;
+
+    rrs = ntohs (hdr->an) + ntohs (hdr->ns) + ntohs (hdr->ar);
+    for (i = 0; i < rrs; i++) {
+        uint32_t t;
+
+        off = dns_skip_name (msg, len, off);
+        if ((off < 0) || ((off + 10) > len))
+            return;
+
+        /* The TTL field of OPT pseudo records holds EDNS flags. */
+        if (read_u16 (&msg[off]) != 41) {
+            if (ntl == MAX_TTLS)
+                return;
+
+            t = read_u32 (&msg[off + 4]);
+            if (t > INT32_MAX)
+                t = 0;
+            if (t < ttl)
+                ttl = t;
+            tlo[ntl++] = off + 4;
+        }
+
+        off += 10 + read_u16 (&msg[off + 8]);
+        if (off > len)
+            return;
+    }
+
+    if (!ntl)
+        return;
+
+    if (ttl < self->min_ttl)
+        ttl = self->min_ttl;
+    if (self->max_ttl && (ttl > self->max_ttl))
+        ttl = self->max_ttl;
+    if (ttl <= 0)
+        return;
+
+    node = hev_dns_cache_find (self, key, klen, &parent, &link);
+    if (node) {
+        hev_dns_cache_remove (self, node);
+        hev_dns_cache_find (self, key, klen, &parent, &link);
+    }
+
+    node = hev_malloc (sizeof (HevDNSCacheNode) + klen + len);
+    if (!node)
+        return;
+
+    memset (node, 0, sizeof (HevDNSCacheNode));
+    node->stored = monotonic_time ();
+    node->expire = node->stored + ttl;
+    node->ttl = ttl;
+    node->klen = klen;
+    node->rlen = len;
+    node->ntl = ntl;
+    memcpy (node->tlo, tlo, sizeof (uint16_t) * ntl);
+    memcpy (node->data, key, klen);
+    memcpy (node->data + klen, res, len);
+
+    hev_rbtree_node_link (&node->tree, parent, link);
+    hev_rbtree_insert_color (&self->tree, &node->tree);
+    hev_list_add_tail (&self->list, &node->list);
+    self->use++;
+
+    if (self->use > self->max) {
+        HevListNode *nl = hev_list_first (&self->list);
+
+        hev_dns_cache_remove (self, container_of (nl, HevDNSCacheNode, list));
+    }
+}
+
+int
+hev_dns_cache_construct (HevDNSCache *self, int max, int min_ttl, int max_ttl,
+                         int prefetch)
+{
+    int res;
+
+    res = hev_object_construct (&self->base);
+    if (res < 0)
+        return res;
+
+    LOG_D ("%p dns cache construct", self);
+
+    HEV_OBJECT (self)->klass = HEV_DNS_CACHE_TYPE;
+
+    if (max <= 0)
+        return -1;
+
+    self->max = max;
+    self->min_ttl = min_ttl;
+    self->max_ttl = max_ttl;
+    self->prefetch = prefetch;
+
+    return 0;
+}
+
+static void
+hev_dns_cache_destruct (HevObject *base)
+{
+    HevDNSCache *self = HEV_DNS_CACHE (base);
+    HevListNode *n;
+
+    LOG_D ("%p dns cache destruct", self);
+
+    n = hev_list_first (&self->list);
+    while (n) {
+        HevDNSCacheNode *t;
+
+        t = container_of (n, HevDNSCacheNode, list);
+        n = hev_list_node_next (n);
+        hev_free (t);
+    }
+
+    HEV_OBJECT_TYPE->destruct (base);
+    hev_free (base);
+}
+
+HevObjectClass *
+hev_dns_cache_class (void)
+{
+    static HevDNSCacheClass klass;
+    HevDNSCacheClass *kptr = &klass;
+    HevObjectClass *okptr = HEV_OBJECT_CLASS (kptr);
+
+    if (!okptr->name) {
+        memcpy (kptr, HEV_OBJECT_TYPE, sizeof (HevObjectClass));
+
+        okptr->name = "HevDNSCache";
+        okptr->destruct = hev_dns_cache_destruct;
+    }
+
+    return okptr;
+}
+
+int
+hev_dns_cache_reply (HevDNSCache *self, struct udp_pcb *pcb, struct pbuf *p,
+                     int *refresh)
+{
+    struct pbuf *b;
+    int size;
+    int res;
+
+    *refresh = 0;
+
+    if ((pcb->local_port != 53) || (p->len != p->tot_len))
+        return 0;
+
+    b = pbuf_alloc (PBUF_TRANSPORT, DNS_BUF_SIZE, PBUF_RAM);
+    if (!b)
+        return 0;
+
+    /* Answers over the client's UDP size go upstream to be truncated. */
+    size = hev_dns_cache_udp_size (p->payload, p->len);
+    if (size > b->len)
+        size = b->len;
+
+    res = hev_dns_cache_lookup (self, p->payload, p->len, b->payload, size,
+                                refresh);
+    if (res > 0) {
+        pbuf_realloc (b, res);
+        udp_sendfrom (pcb, b, &pcb->local_ip, pcb->local_port);
+    }
+    pbuf_free (b);
+
+    return res;
+}
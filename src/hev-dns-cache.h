@@ -0,0 +1,138 @@
+/*
+ ============================================================================
+ Name        : hev-dns-cache.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : DNS Cache
+ ============================================================================
+ */
+
+#ifndef __HEV_DNS_CACHE_H__
+#define __HEV_DNS_CACHE_H__
+
+#include <lwip/udp.h>
+#include <lwip/pbuf.h>
+
+#include <hev-list.h>
+#include <hev-rbtree.h>
+#include <hev-object.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HEV_DNS_CACHE(p) ((HevDNSCache *)p)
+#define HEV_DNS_CACHE_CLASS(p) ((HevDNSCacheClass *)p)
+#define HEV_DNS_CACHE_TYPE (hev_dns_cache_class ())
+
+typedef struct _HevDNSCache HevDNSCache;
+typedef struct _HevDNSCacheClass HevDNSCacheClass;
+
+struct _HevDNSCache
+{
+    HevObject base;
+
+    int use;
+    int max;
+    int min_ttl;
+    int max_ttl;
+    int prefetch;
+
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long prefetches;
+
+    HevList list;
+    HevRBTree tree;
+};
+
+struct _HevDNSCacheClass
+{
+    HevObjectClass base;
+};
+
+HevObjectClass *hev_dns_cache_class (void);
+
+int hev_dns_cache_construct (HevDNSCache *self, int max, int min_ttl,
+                             int max_ttl, int prefetch);
+
+HevDNSCache *hev_dns_cache_new (int max, int min_ttl, int max_ttl,
+                                int prefetch);
+
+HevDNSCache *hev_dns_cache_get (void);
+void hev_dns_cache_put (HevDNSCache *self);
+
+/**
+ * hev_dns_cache_lookup:
+ * @self: a #HevDNSCache
+ * @req: DNS query message
+ * @qlen: query length
+ * @res: buffer for the response message
+ * @slen: response buffer size
+ * @refresh: (out): set when the entry is hot and close to expiry
+ *
+ * Answer a query from the cache. The response carries the query id and
+ * question of @req and TTLs reduced by the time spent in the cache.
+ *
+ * When @refresh is set, the caller should still forward the query upstream
+ * and feed the answer back with hev_dns_cache_store, but must not deliver
+ * that answer to the client again.
+ *
+ * Returns: response length on hit, 0 on miss, -1 on malformed query.
+ */
+int hev_dns_cache_lookup (HevDNSCache *self, const void *req, int qlen,
+                          void *res, int slen, int *refresh);
+
+/**
+ * hev_dns_cache_store:
+ * @self: a #HevDNSCache
+ * @res: DNS response message
+ * @len: response length
+ *
+ * Cache a positive or NXDOMAIN response for the smallest TTL it carries,
+ * clamped to the configured bounds. Truncated responses are ignored.
+ */
+void hev_dns_cache_store (HevDNSCache *self, const void *res, int len);
+
+/**
+ * hev_dns_cache_udp_size:
+ * @req: DNS query message
+ * @len: query length
+ *
+ * Returns: the largest response the client accepts over UDP, the EDNS
+ * payload size of @req or 512 without one.
+ */
+int hev_dns_cache_udp_size (const void *req, int len);
+
+/**
+ * hev_dns_cache_truncate:
+ * @res: DNS response message
+ * @len: response length
+ *
+ * Cut @res down to its header and question and set the TC bit, telling
+ * the client to retry over TCP.
+ *
+ * Returns: the new response length.
+ */
+int hev_dns_cache_truncate (void *res, int len);
+
+/**
+ * hev_dns_cache_reply:
+ * @self: a #HevDNSCache
+ * @pcb: UDP flow the query arrived on
+ * @p: DNS query packet
+ * @refresh: (out): as for hev_dns_cache_lookup
+ *
+ * Answer a query on port 53 from the cache straight back to the client
+ * through @pcb. The caller must hold the lwIP lock.
+ *
+ * Returns: response length on hit, 0 on miss, -1 on malformed query.
+ */
+int hev_dns_cache_reply (HevDNSCache *self, struct udp_pcb *pcb,
+                         struct pbuf *p, int *refresh);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_DNS_CACHE_H__ */
@@ -0,0 +1,755 @@
+/*
+ ============================================================================
+ Name        : hev-dns-tcp.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : DNS over TCP Forwarder
+ ============================================================================
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/uio.h>
+
+#include <hev-list.h>
+#include <hev-compiler.h>
+#include <hev-socks5-misc.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-utils.h"
+#include "hev-config.h"
+#include "hev-logger.h"
+#include "hev-dns-cache.h"
+#include "hev-socks5-proxy.h"
+#include "hev-socks5-upstream.h"
+
+#include "hev-dns-tcp.h"
+
+#define QUERY_BUCKETS (1024)
+#define MAX_QUERIES (4096)
+#define MAX_MSG (65535)
+#define WRITE_BATCH (64)
+#define RETRY_DELAY (1000)
+#define POLL_INTERVAL (500)
+
+typedef struct _HevDNSTCPFlow HevDNSTCPFlow;
+typedef struct _HevDNSTCPQuery HevDNSTCPQuery;
+typedef struct _HevDNSTCPConn HevDNSTCPConn;
+
+struct _HevDNSTCPFlow
+{
+    HevDNSTCP *owner;
+    struct udp_pcb *pcb;
+    int refs;
+};
+
+struct _HevDNSTCPQuery
+{
+    HevListNode node;
+    HevDNSTCPQuery *hnext;
+    HevDNSTCPFlow *flow;
+    HevDNSTCPConn *conn;
+    long deadline;
+    int refresh;
+    int udp_size;
+    int sent;
+    int len;
+    uint16_t id;
+    uint8_t cid[2];
+    uint8_t data[0];
+};
+
+struct _HevDNSTCPConn
+{
+    HevDNSTCP *owner;
+    HevSocks5Upstream *upstream;
+    pthread_t thread;
+    int fd;
+    int event[2];
+    int tx_off;
+    int rx_len;
+    HevList pending;
+    HevList inflight;
+    unsigned long long tx_bytes;
+    unsigned long long rx_bytes;
+    uint8_t rx[2 + MAX_MSG];
+};
+
+struct _HevDNSTCP
+{
+    int run;
+    int queries;
+    int timeout;
+    int next_conn;
+    int conns_num;
+    unsigned int hash;
+    uint16_t next_id;
+
+    unsigned long answers;
+    unsigned long timeouts;
+    unsigned long reconnects;
+
+    HevSocks5Addr addr;
+    pthread_mutex_t mutex;
+    pthread_mutex_t *lwip_mutex;
+
+    HevDNSTCPQuery *buckets[QUERY_BUCKETS];
+    HevDNSTCPConn *conns[0];
+};
+
+static long
+monotonic_msec (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static long
+monotonic_usec (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static HevDNSTCPQuery **
+hev_dns_tcp_query_slot (HevDNSTCP *self, uint16_t id)
+{
+    HevDNSTCPQuery **q = &self->buckets[id % QUERY_BUCKETS];
+
+    while (*q && ((*q)->id != id))
+        q = &(*q)->hnext;
+
+    return q;
+}
+
+static void
+hev_dns_tcp_flow_unref (HevDNSTCPFlow *flow)
+{
+    if (--flow->refs)
+        return;
+
+    udp_recv (flow->pcb, NULL, NULL);
+    udp_remove (flow->pcb);
+    hev_free (flow);
+}
+
+static void
+hev_dns_tcp_conn_wake (HevDNSTCPConn *conn)
+{
+    char b = 0;
+
+    if (write (conn->event[1], &b, 1) < 0)
+        LOG_D ("%p dns tcp wake", conn);
+}
+
+/*
+ * Called with self->mutex held. The query leaves both the id table and
+ * the connection lists; the caller owns it afterwards.
+ */
+static void
+hev_dns_tcp_query_detach (HevDNSTCP *self, HevList *list, HevDNSTCPQuery *q)
+{
+    HevDNSTCPQuery **slot;
+
+    slot = hev_dns_tcp_query_slot (self, q->id);
+    if (*slot)
+        *slot = q->hnext;
+    hev_list_del (list, &q->node);
+    self->queries--;
+}
+
+static int
+hev_dns_tcp_flow_submit (HevDNSTCPFlow *flow, struct pbuf *p, int refresh)
+{
+    HevDNSTCP *self = flow->owner;
+    HevDNSTCPConn *conn;
+    HevDNSTCPQuery *q;
+    int i;
+
+    if ((p->tot_len < 12) || (p->tot_len > MAX_MSG))
+        return -1;
+
+    q = hev_malloc (sizeof (HevDNSTCPQuery) + 2 + p->tot_len);
+    if (!q)
+        return -1;
+
+    memset (q, 0, sizeof (HevDNSTCPQuery));
+    q->flow = flow;
+    q->refresh = refresh;
+    q->len = 2 + p->tot_len;
+    q->deadline = monotonic_msec () + self->timeout;
+    q->data[0] = p->tot_len >> 8;
+    q->data[1] = p->tot_len;
+    pbuf_copy_partial (p, &q->data[2], p->tot_len, 0);
+    memcpy (q->cid, &q->data[2], 2);
+    q->udp_size = hev_dns_cache_udp_size (&q->data[2], p->tot_len);
+
+    pthread_mutex_lock (&self->mutex);
+    if (self->queries >= MAX_QUERIES) {
+        pthread_mutex_unlock (&self->mutex);
+        hev_free (q);
+        return -1;
+    }
+
+    /* Queries from all clients share a session, so ids are rewritten. */
+    for (i = 0; i < MAX_QUERIES; i++) {
+        q->id = self->next_id++;
+        if (!*hev_dns_tcp_query_slot (self, q->id))
+            break;
+    }
+    q->data[2] = q->id >> 8;
+    q->data[3] = q->id;
+
+    q->hnext = self->buckets[q->id % QUERY_BUCKETS];
+    self->buckets[q->id % QUERY_BUCKETS] = q;
+    self->queries++;
+
+    conn = self->conns[self->next_conn++ % self->conns_num];
+    q->conn = conn;
+    hev_list_add_tail (&conn->pending, &q->node);
+    pthread_mutex_unlock (&self->mutex);
+
+    flow->refs++;
+    hev_dns_tcp_conn_wake (conn);
+
+    return 0;
+}
+
+static void
+hev_dns_tcp_recv_handler (void *arg, struct udp_pcb *pcb, struct pbuf *p,
+                          const ip_addr_t *addr, u16_t port)
+{
+    HevDNSTCPFlow *flow = arg;
+    HevDNSCache *cache;
+    int refresh = 0;
+
+    if (!p)
+        return;
+
+    /* Follow-up queries on the same flow */
+    cache = hev_dns_cache_get ();
+    if (!cache || (hev_dns_cache_reply (cache, pcb, p, &refresh) <= 0) ||
+        refresh)
+        hev_dns_tcp_flow_submit (flow, p, refresh);
+
+    pbuf_free (p);
+}
+
+int
+hev_dns_tcp_submit (HevDNSTCP *self, struct udp_pcb *pcb, struct pbuf *p,
+                    int refresh)
+{
+    HevDNSTCPFlow *flow;
+
+    flow = hev_malloc0 (sizeof (HevDNSTCPFlow));
+    if (!flow)
+        return -1;
+
+    flow->owner = self;
+    flow->pcb = pcb;
+
+    if (hev_dns_tcp_flow_submit (flow, p, refresh) < 0) {
+        hev_free (flow);
+        return -1;
+    }
+
+    udp_recv (pcb, hev_dns_tcp_recv_handler, flow);
+
+    return 0;
+}
+
+static void
+hev_dns_tcp_deliver (HevDNSTCP *self, HevDNSTCPQuery *q, uint8_t *msg,
+                     int len)
+{
+    HevDNSTCPFlow *flow = q->flow;
+    HevDNSCache *cache;
+
+    memcpy (msg, q->cid, 2);
+
+    pthread_mutex_lock (self->lwip_mutex);
+    cache = hev_dns_cache_get ();
+    if (cache)
+        hev_dns_cache_store (cache, msg, len);
+
+    if (!q->refresh) {
+        struct pbuf *b;
+
+        /* Tell the client to come back over TCP for the full answer. */
+        if (len > q->udp_size)
+            len = hev_dns_cache_truncate (msg, len);
+
+        b = pbuf_alloc (PBUF_TRANSPORT, len, PBUF_RAM);
+        if (b) {
+            memcpy (b->payload, msg, len);
+            udp_sendfrom (flow->pcb, b, &flow->pcb->local_ip,
+                          flow->pcb->local_port);
+            pbuf_free (b);
+        }
+    }
+
+    hev_dns_tcp_flow_unref (flow);
+    pthread_mutex_unlock (self->lwip_mutex);
+
+    hev_free (q);
+}
+
+static void
+hev_dns_tcp_drop (HevDNSTCP *self, HevList *list)
+{
+    HevListNode *n;
+
+    n = hev_list_first (list);
+    if (!n)
+        return;
+
+    pthread_mutex_lock (self->lwip_mutex);
+    while (n) {
+        HevDNSTCPQuery *q = container_of (n, HevDNSTCPQuery, node);
+
+        n = hev_list_node_next (n);
+        hev_dns_tcp_flow_unref (q->flow);
+        hev_free (q);
+    }
+    pthread_mutex_unlock (self->lwip_mutex);
+}
+
+static void
+hev_dns_tcp_conn_expire (HevDNSTCPConn *conn, HevList *list, long now,
+                         HevList *expired)
+{
+    HevDNSTCP *self = conn->owner;
+    HevListNode *n;
+
+    /* Both lists are ordered by submit time. */
+    while ((n = hev_list_first (list))) {
+        HevDNSTCPQuery *q = container_of (n, HevDNSTCPQuery, node);
+
+        if (q->deadline > now)
+            break;
+
+        hev_dns_tcp_query_detach (self, list, q);
+        hev_list_add_tail (expired, &q->node);
+        self->timeouts++;
+    }
+}
+
+static void
+hev_dns_tcp_conn_sweep (HevDNSTCPConn *conn)
+{
+    HevDNSTCP *self = conn->owner;
+    HevList expired = { 0 };
+    long now = monotonic_msec ();
+
+    pthread_mutex_lock (&self->mutex);
+    hev_dns_tcp_conn_expire (conn, &conn->inflight, now, &expired);
+    /* A partially written head stays until the session is reset. */
+    if (!conn->tx_off || (conn->fd < 0))
+        hev_dns_tcp_conn_expire (conn, &conn->pending, now, &expired);
+    pthread_mutex_unlock (&self->mutex);
+
+    hev_dns_tcp_drop (self, &expired);
+}
+
+static void
+hev_dns_tcp_conn_reset (HevDNSTCPConn *conn)
+{
+    HevDNSTCP *self = conn->owner;
+    HevListNode *n;
+
+    if (conn->fd >= 0) {
+        close (conn->fd);
+        conn->fd = -1;
+    }
+
+    if (conn->upstream) {
+        hev_socks5_upstream_release (conn->upstream, conn->tx_bytes,
+                                     conn->rx_bytes);
+        conn->upstream = NULL;
+        conn->tx_bytes = 0;
+        conn->rx_bytes = 0;
+    }
+
+    /* Unanswered queries are resent on the next session, in order. */
+    pthread_mutex_lock (&self->mutex);
+    while ((n = hev_list_first (&conn->pending))) {
+        hev_list_del (&conn->pending, n);
+        hev_list_add_tail (&conn->inflight, n);
+    }
+    for (n = hev_list_first (&conn->inflight); n; n = hev_list_node_next (n))
+        container_of (n, HevDNSTCPQuery, node)->sent = 0;
+    conn->pending = conn->inflight;
+    memset (&conn->inflight, 0, sizeof (HevList));
+    conn->tx_off = 0;
+    conn->rx_len = 0;
+    pthread_mutex_unlock (&self->mutex);
+}
+
+static int
+hev_dns_tcp_conn_connect (HevDNSTCPConn *conn, HevSocks5Upstream *up)
+{
+    HevDNSTCP *self = conn->owner;
+    HevConfigServer *srv = up->srv;
+    long start = monotonic_usec ();
+    int timeout;
+    int fd;
+
+    timeout = hev_config_get_misc_connect_timeout ();
+
+    fd = hev_socks5_proxy_connect (srv, timeout);
+    if (fd < 0)
+        goto error;
+
+    if ((hev_socks5_proxy_handshake (fd, srv, timeout) < 0) ||
+        (hev_socks5_proxy_request (fd, HEV_SOCKS5_PROXY_CMD_CONNECT,
+                                   &self->addr, NULL, timeout) < 0)) {
+        close (fd);
+        goto error;
+    }
+
+    hev_socks5_upstream_report (up, monotonic_usec () - start);
+    return fd;
+
+error:
+    hev_socks5_upstream_report (up, -1);
+    return -1;
+}
+
+static int
+hev_dns_tcp_conn_open (HevDNSTCPConn *conn)
+{
+    HevDNSTCP *self = conn->owner;
+    HevSocks5Upstream *up, *next;
+    int fd;
+
+    up = hev_socks5_upstream_select (self->hash);
+    fd = hev_dns_tcp_conn_connect (conn, up);
+
+    /* Queries are waiting, try the next healthy server right away. */
+    if ((fd < 0) && (next = hev_socks5_upstream_alternate (up, self->hash))) {
+        hev_socks5_upstream_switch (up, next);
+        up = next;
+        fd = hev_dns_tcp_conn_connect (conn, up);
+    }
+
+    if (fd < 0) {
+        hev_socks5_upstream_release (up, 0, 0);
+        return -1;
+    }
+
+    set_sock_nodelay (fd);
+    conn->fd = fd;
+    conn->upstream = up;
+    __atomic_add_fetch (&self->reconnects, 1, __ATOMIC_RELAXED);
+
+    LOG_D ("%p dns tcp connected %s", conn, up->srv->addr);
+
+    return 0;
+}
+
+static int
+hev_dns_tcp_conn_write (HevDNSTCPConn *conn)
+{
+    HevDNSTCP *self = conn->owner;
+    struct iovec iov[WRITE_BATCH];
+    HevListNode *n;
+    ssize_t s;
+    int i = 0;
+
+    pthread_mutex_lock (&self->mutex);
+    n = hev_list_first (&conn->pending);
+    for (; n && (i < WRITE_BATCH); n = hev_list_node_next (n), i++) {
+        HevDNSTCPQuery *q = container_of (n, HevDNSTCPQuery, node);
+        int off = i ? 0 : conn->tx_off;
+
+        iov[i].iov_base = q->data + off;
+        iov[i].iov_len = q->len - off;
+    }
+
+    if (!i) {
+        pthread_mutex_unlock (&self->mutex);
+        return 0;
+    }
+
+    s = writev (conn->fd, iov, i);
+    if (s < 0) {
+        pthread_mutex_unlock (&self->mutex);
+        return ((errno == EAGAIN) || (errno == EINTR)) ? 0 : -1;
+    }
+
+    conn->tx_bytes += s;
+    while ((n = hev_list_first (&conn->pending))) {
+        HevDNSTCPQuery *q = container_of (n, HevDNSTCPQuery, node);
+        int left = q->len - conn->tx_off;
+
+        if (s < left) {
+            conn->tx_off += s;
+            break;
+        }
+
+        s -= left;
+        q->sent = 1;
+        conn->tx_off = 0;
+        hev_list_del (&conn->pending, n);
+        hev_list_add_tail (&conn->inflight, n);
+    }
+    pthread_mutex_unlock (&self->mutex);
+
+    return 0;
+}
+
+static int
+hev_dns_tcp_conn_read (HevDNSTCPConn *conn)
+{
+    HevDNSTCP *self = conn->owner;
+    uint8_t *p = conn->rx;
+    ssize_t s;
+
+    s = read (conn->fd, conn->rx + conn->rx_len,
+              sizeof (conn->rx) - conn->rx_len);
+    if (s == 0)
+        return -1;
+    if (s < 0)
+        return ((errno == EAGAIN) || (errno == EINTR)) ? 0 : -1;
+
+    conn->rx_len += s;
+    conn->rx_bytes += s;
+
+    for (;;) {
+        HevDNSTCPQuery **slot, *q;
+        int left = conn->rx + conn->rx_len - p;
+        int mlen;
+
+        if (left < 2)
+            break;
+        mlen = (p[0] << 8) | p[1];
+        if (left < (2 + mlen))
+            break;
+
+        q = NULL;
+        if (mlen >= 12) {
+            pthread_mutex_lock (&self->mutex);
+            slot = hev_dns_tcp_query_slot (self, (p[2] << 8) | p[3]);
+            q = *slot;
+            /* Late answers may carry an id reused on another session. */
+            if (q && ((q->conn != conn) || !q->sent))
+                q = NULL;
+            if (q) {
+                hev_dns_tcp_query_detach (self, &conn->inflight, q);
+                self->answers++;
+            }
+            pthread_mutex_unlock (&self->mutex);
+        }
+
+        if (q)
+            hev_dns_tcp_deliver (self, q, p + 2, mlen);
+
+        p += 2 + mlen;
+    }
+
+    conn->rx_len = conn->rx + conn->rx_len - p;
+    memmove (conn->rx, p, conn->rx_len);
+
+    return 0;
+}
+
+static int
+hev_dns_tcp_conn_pending (HevDNSTCPConn *conn)
+{
+    HevDNSTCP *self = conn->owner;
+    int res;
+
+    pthread_mutex_lock (&self->mutex);
+    res = !!hev_list_first (&conn->pending);
+    pthread_mutex_unlock (&self->mutex);
+
+    return res;
+}
+
+static void *
+hev_dns_tcp_conn_thread (void *data)
+{
+    HevDNSTCPConn *conn = data;
+    HevDNSTCP *self = conn->owner;
+
+    while (self->run) {
+        struct pollfd pfds[2];
+        char buf[64];
+        int nfds = 1;
+        int timeout;
+        int res;
+
+        pfds[0].fd = conn->event[0];
+        pfds[0].events = POLLIN;
+        timeout = POLL_INTERVAL;
+
+        if (conn->fd < 0) {
+            if (hev_dns_tcp_conn_pending (conn) &&
+                (hev_dns_tcp_conn_open (conn) < 0)) {
+                LOG_W ("%p dns tcp connect failed", conn);
+                timeout = RETRY_DELAY;
+            }
+        }
+
+        if (conn->fd >= 0) {
+            pfds[1].fd = conn->fd;
+            pfds[1].events = POLLIN;
+            if (hev_dns_tcp_conn_pending (conn))
+                pfds[1].events |= POLLOUT;
+            nfds = 2;
+        }
+
+        res = poll (pfds, nfds, timeout);
+        if ((res < 0) && (errno != EINTR))
+            break;
+
+        if ((res > 0) && (pfds[0].revents & POLLIN)) {
+            while (read (conn->event[0], buf, sizeof (buf)) == sizeof (buf))
+                ;
+        }
+
+        if ((res > 0) && (nfds == 2)) {
+            short ev = pfds[1].revents;
+
+            if ((ev & POLLIN) && (hev_dns_tcp_conn_read (conn) < 0))
+                hev_dns_tcp_conn_reset (conn);
+            else if (ev & (POLLERR | POLLHUP))
+                hev_dns_tcp_conn_reset (conn);
+        }
+
+        if ((conn->fd >= 0) && (hev_dns_tcp_conn_write (conn) < 0))
+            hev_dns_tcp_conn_reset (conn);
+
+        hev_dns_tcp_conn_sweep (conn);
+    }
+
+    return NULL;
+}
+
+static int
+hev_dns_tcp_resolver (HevSocks5Addr *addr)
+{
+    const char *address = hev_config_get_dnstcp_address ();
+    int port = hev_config_get_dnstcp_port ();
+    struct in6_addr in6;
+    struct in_addr in4;
+
+    if (inet_pton (AF_INET, address, &in4) == 1)
+        hev_socks5_addr_from_ipv4 (addr, &in4, htons (port));
+    else if (inet_pton (AF_INET6, address, &in6) == 1)
+        hev_socks5_addr_from_ipv6 (addr, &in6, htons (port));
+    else
+        return -1;
+
+    return 0;
+}
+
+HevDNSTCP *
+hev_dns_tcp_new (pthread_mutex_t *mutex)
+{
+    HevDNSTCP *self;
+    int sessions;
+    int i;
+
+    sessions = hev_config_get_dnstcp_sessions ();
+
+    self = hev_malloc0 (sizeof (HevDNSTCP) +
+                        sizeof (HevDNSTCPConn *) * sessions);
+    if (!self)
+        return NULL;
+
+    if (hev_dns_tcp_resolver (&self->addr) < 0) {
+        LOG_E ("dns tcp: invalid resolver address");
+        hev_free (self);
+        return NULL;
+    }
+
+    self->hash = hev_socks5_upstream_hash (
+        &self->addr, hev_socks5_addr_len (&self->addr) - 2);
+    self->run = 1;
+    self->timeout = hev_config_get_dnstcp_timeout ();
+    self->lwip_mutex = mutex;
+    pthread_mutex_init (&self->mutex, NULL);
+
+    for (i = 0; i < sessions; i++) {
+        HevDNSTCPConn *conn;
+
+        conn = hev_malloc0 (sizeof (HevDNSTCPConn));
+        if (!conn)
+            goto error;
+
+        conn->owner = self;
+        conn->fd = -1;
+        self->conns[i] = conn;
+        self->conns_num++;
+
+        if (pipe2 (conn->event, O_NONBLOCK | O_CLOEXEC) < 0) {
+            conn->event[0] = -1;
+            conn->event[1] = -1;
+            goto error;
+        }
+
+        if (pthread_create (&conn->thread, NULL, hev_dns_tcp_conn_thread,
+                            conn) != 0) {
+            close (conn->event[0]);
+            close (conn->event[1]);
+            conn->event[0] = -1;
+            goto error;
+        }
+    }
+
+    LOG_D ("%p dns tcp new", self);
+
+    return self;
+
+error:
+    hev_dns_tcp_destroy (self);
+    return NULL;
+}
+
+void
+hev_dns_tcp_destroy (HevDNSTCP *self)
+{
+    int i;
+
+    LOG_D ("%p dns tcp destroy", self);
+
+    self->run = 0;
+
+    for (i = 0; i < self->conns_num; i++) {
+        HevDNSTCPConn *conn = self->conns[i];
+
+        if (conn->event[0] >= 0) {
+            hev_dns_tcp_conn_wake (conn);
+            pthread_join (conn->thread, NULL);
+            close (conn->event[0]);
+            close (conn->event[1]);
+        }
+
+        hev_dns_tcp_conn_reset (conn);
+        hev_dns_tcp_drop (self, &conn->pending);
+        hev_free (conn);
+    }
+
+    LOG_I ("dns tcp: %lu answers %lu timeouts %lu connects", self->answers,
+           self->timeouts, self->reconnects);
+
+    pthread_mutex_destroy (&self->mutex);
+    hev_free (self);
+}
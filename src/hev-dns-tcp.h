@@ -0,0 +1,55 @@
+/*
+ ============================================================================
+ Name        : hev-dns-tcp.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : DNS over TCP Forwarder
+ ============================================================================
+ */
+
+#ifndef __HEV_DNS_TCP_H__
+#define __HEV_DNS_TCP_H__
+
+#include <pthread.h>
+
+#include <lwip/udp.h>
+
+typedef struct _HevDNSTCP HevDNSTCP;
+
+/**
+ * hev_dns_tcp_new:
+ * @mutex: the lwip mutex
+ *
+ * Create a forwarder that pipelines UDP DNS queries as DNS-over-TCP
+ * messages (RFC 7766) over a small pool of persistent socks5 CONNECT
+ * sessions to the configured resolver.
+ *
+ * Returns: new forwarder instance
+ */
+HevDNSTCP *hev_dns_tcp_new (pthread_mutex_t *mutex);
+
+/**
+ * hev_dns_tcp_destroy:
+ * @self: forwarder instance
+ *
+ * Stop all upstream sessions and drop outstanding queries.
+ */
+void hev_dns_tcp_destroy (HevDNSTCP *self);
+
+/**
+ * hev_dns_tcp_submit:
+ * @self: forwarder instance
+ * @pcb: UDP flow of the query
+ * @p: query message
+ * @refresh: only refresh the DNS cache, do not answer the client
+ *
+ * Take over @pcb and queue the query. The answer is injected back to the
+ * client through @pcb, which is removed once no queries are outstanding.
+ * Must be called with the lwip mutex held. @p is not consumed.
+ *
+ * Returns: 0 on success, -1 when the caller keeps ownership of @pcb
+ */
+int hev_dns_tcp_submit (HevDNSTCP *self, struct udp_pcb *pcb, struct pbuf *p,
+                        int refresh);
+
+#endif /* __HEV_DNS_TCP_H__ */
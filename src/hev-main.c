@@ -37,10 +37,9 @@ hev_socks5_tunnel_main_inner (int tun_fd)
 
     res = hev_config_get_misc_connect_timeout ();
     hev_socks5_set_connect_timeout (res);
-    res = hev_config_get_misc_tcp_read_write_timeout ();
-    hev_socks5_set_tcp_timeout (res);
-    res = hev_config_get_misc_udp_read_write_timeout ();
-    hev_socks5_set_udp_timeout (res);
+    /* Idle sessions are expired by the tunnel, not per task. */
+    hev_socks5_set_tcp_timeout (-1);
+    hev_socks5_set_udp_timeout (-1);
 
     res = hev_config_get_misc_udp_recv_buffer_size ();
     hev_socks5_set_udp_recv_buffer_size (res);
@@ -83,6 +83,20 @@ void hev_socks5_tunnel_quit (void);
 void hev_socks5_tunnel_stats (size_t *tx_packets, size_t *tx_bytes,
                               size_t *rx_packets, size_t *rx_bytes);
 
+/**
+ * hev_socks5_tunnel_tcp_stats:
+ * @states (out): tunnel tcp connection count of each state, 11 entries:
+ *                closed, listen, syn-sent, syn-rcvd, established,
+ *                fin-wait-1, fin-wait-2, close-wait, closing, last-ack
+ *                and time-wait
+ * @time_wait (out): closed connections kept in the compact TIME_WAIT table
+ *
+ * Retrieve tunnel tcp connection state gauges.
+ *
+ * Since: 2.15.0
+ */
+void hev_socks5_tunnel_tcp_stats (size_t *states, size_t *time_wait);
+
 #ifdef __cplusplus
 }
 #endif
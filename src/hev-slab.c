@@ -0,0 +1,270 @@
+/*
+ ============================================================================
+ Name        : hev-slab.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Fixed Size Object Slab
+ ============================================================================
+ */
+
+#include <pthread.h>
+
+#include <hev-memory-allocator.h>
+
+#include "hev-logger.h"
+
+#include "hev-slab.h"
+
+#define CACHE_BATCH (32)
+#define CHUNK_OBJECTS (64)
+#define OBJECT_ALIGN (16)
+
+typedef struct _HevSlabChunk HevSlabChunk;
+typedef struct _HevSlabCache HevSlabCache;
+
+struct _HevSlabChunk
+{
+    HevSlabChunk *next;
+} __attribute__ ((aligned (OBJECT_ALIGN)));
+
+struct _HevSlabCache
+{
+    HevSlab *slab;
+    void *free;
+    int num;
+
+    unsigned long allocs;
+    unsigned long frees;
+};
+
+struct _HevSlab
+{
+    const char *name;
+    unsigned int size;
+
+    pthread_key_t key;
+    pthread_mutex_t mutex;
+    HevSlabChunk *chunks;
+    void *depot;
+
+    unsigned long allocs;
+    unsigned long frees;
+    unsigned long refills;
+    unsigned long drains;
+    unsigned long chunks_num;
+};
+
+/* Called with self->mutex held. */
+static int
+hev_slab_grow (HevSlab *self)
+{
+    HevSlabChunk *chunk;
+    char *base;
+    int i;
+
+    chunk = hev_malloc (sizeof (HevSlabChunk) +
+                        (size_t)self->size * CHUNK_OBJECTS);
+    if (!chunk)
+        return -1;
+
+    chunk->next = self->chunks;
+    self->chunks = chunk;
+    self->chunks_num++;
+
+    base = (char *)(chunk + 1);
+    for (i = 0; i < CHUNK_OBJECTS; i++) {
+        void **obj = (void **)(base + (size_t)self->size * i);
+
+        *obj = self->depot;
+        self->depot = obj;
+    }
+
+    return 0;
+}
+
+/* Called with self->mutex held. */
+static void
+hev_slab_fold (HevSlab *self, HevSlabCache *cache)
+{
+    self->allocs += cache->allocs;
+    self->frees += cache->frees;
+    cache->allocs = 0;
+    cache->frees = 0;
+}
+
+static void
+hev_slab_refill (HevSlab *self, HevSlabCache *cache)
+{
+    int i;
+
+    pthread_mutex_lock (&self->mutex);
+    for (i = 0; i < CACHE_BATCH; i++) {
+        void **obj;
+
+        if (!self->depot && (hev_slab_grow (self) < 0))
+            break;
+
+        obj = self->depot;
+        self->depot = *obj;
+        *obj = cache->free;
+        cache->free = obj;
+        cache->num++;
+    }
+    self->refills++;
+    hev_slab_fold (self, cache);
+    pthread_mutex_unlock (&self->mutex);
+}
+
+static void
+hev_slab_drain (HevSlab *self, HevSlabCache *cache, int num)
+{
+    int i;
+
+    pthread_mutex_lock (&self->mutex);
+    for (i = 0; (i < num) && cache->free; i++) {
+        void **obj = cache->free;
+
+        cache->free = *obj;
+        cache->num--;
+        *obj = self->depot;
+        self->depot = obj;
+    }
+    self->drains++;
+    hev_slab_fold (self, cache);
+    pthread_mutex_unlock (&self->mutex);
+}
+
+static void
+hev_slab_cache_destroy (void *data)
+{
+    HevSlabCache *cache = data;
+
+    hev_slab_drain (cache->slab, cache, cache->num);
+    hev_free (cache);
+}
+
+static HevSlabCache *
+hev_slab_cache_get (HevSlab *self)
+{
+    HevSlabCache *cache;
+
+    cache = pthread_getspecific (self->key);
+    if (cache)
+        return cache;
+
+    cache = hev_malloc0 (sizeof (HevSlabCache));
+    if (!cache)
+        return NULL;
+
+    cache->slab = self;
+    if (pthread_setspecific (self->key, cache) != 0) {
+        hev_free (cache);
+        return NULL;
+    }
+
+    return cache;
+}
+
+void *
+hev_slab_alloc (HevSlab *self)
+{
+    HevSlabCache *cache;
+    void **obj;
+
+    cache = hev_slab_cache_get (self);
+    if (!cache)
+        return NULL;
+
+    if (!cache->free)
+        hev_slab_refill (self, cache);
+
+    obj = cache->free;
+    if (!obj)
+        return NULL;
+
+    cache->free = *obj;
+    cache->num--;
+    cache->allocs++;
+
+    return obj;
+}
+
+void
+hev_slab_free (HevSlab *self, void *ptr)
+{
+    HevSlabCache *cache;
+
+    cache = hev_slab_cache_get (self);
+    if (!cache) {
+        pthread_mutex_lock (&self->mutex);
+        *(void **)ptr = self->depot;
+        self->depot = ptr;
+        self->frees++;
+        pthread_mutex_unlock (&self->mutex);
+        return;
+    }
+
+    *(void **)ptr = cache->free;
+    cache->free = ptr;
+    cache->num++;
+    cache->frees++;
+
+    if (cache->num >= (CACHE_BATCH * 2))
+        hev_slab_drain (self, cache, CACHE_BATCH);
+}
+
+HevSlab *
+hev_slab_new (const char *name, unsigned int size)
+{
+    HevSlab *self;
+
+    self = hev_malloc0 (sizeof (HevSlab));
+    if (!self)
+        return NULL;
+
+    if (size < sizeof (void *))
+        size = sizeof (void *);
+    self->size = (size + OBJECT_ALIGN - 1) & ~(OBJECT_ALIGN - 1);
+    self->name = name;
+
+    if (pthread_key_create (&self->key, hev_slab_cache_destroy) != 0) {
+        hev_free (self);
+        return NULL;
+    }
+    pthread_mutex_init (&self->mutex, NULL);
+
+    LOG_D ("%p slab %s new", self, name);
+
+    return self;
+}
+
+void
+hev_slab_destroy (HevSlab *self)
+{
+    HevSlabCache *cache;
+
+    LOG_D ("%p slab %s destroy", self, self->name);
+
+    /* Caches of threads that are still alive only have counters left. */
+    cache = pthread_getspecific (self->key);
+    if (cache) {
+        hev_slab_fold (self, cache);
+        hev_free (cache);
+    }
+    pthread_key_delete (self->key);
+
+    LOG_I ("slab %s: %lu allocs %lu frees %lu refills %lu drains %lu "
+           "chunks of %u bytes",
+           self->name, self->allocs, self->frees, self->refills, self->drains,
+           self->chunks_num, self->size * CHUNK_OBJECTS);
+
+    while (self->chunks) {
+        HevSlabChunk *chunk = self->chunks;
+
+        self->chunks = chunk->next;
+        hev_free (chunk);
+    }
+
+    pthread_mutex_destroy (&self->mutex);
+    hev_free (self);
+}
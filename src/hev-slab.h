@@ -0,0 +1,40 @@
+/*
+ ============================================================================
+ Name        : hev-slab.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Fixed Size Object Slab
+ ============================================================================
+ */
+
+#ifndef __HEV_SLAB_H__
+#define __HEV_SLAB_H__
+
+typedef struct _HevSlab HevSlab;
+
+/**
+ * hev_slab_new:
+ * @name: name used in the statistics log
+ * @size: object size
+ *
+ * Create a slab for objects of @size bytes. Each thread keeps a small
+ * cache of free objects and trades batches with a shared depot, so most
+ * allocations and frees take no lock. Objects may be freed on a thread
+ * other than the one that allocated them.
+ *
+ * Returns: new slab instance
+ */
+HevSlab *hev_slab_new (const char *name, unsigned int size);
+
+/**
+ * hev_slab_destroy:
+ * @self: slab instance
+ *
+ * Log the counters and release all memory, objects still in use included.
+ */
+void hev_slab_destroy (HevSlab *self);
+
+void *hev_slab_alloc (HevSlab *self);
+void hev_slab_free (HevSlab *self, void *ptr);
+
+#endif /* __HEV_SLAB_H__ */
@@ -0,0 +1,353 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-proxy.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Socks5 Proxy Wire Helpers
+ ============================================================================
+ */
+
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+
+#include <hev-socks5-misc.h>
+
+#include "hev-utils.h"
+#include "hev-logger.h"
+
+#include "hev-socks5-proxy.h"
+
+static unsigned long fast_open_hits;
+static unsigned long fast_open_misses;
+
+int
+hev_socks5_proxy_encode_greeting (HevConfigServer *srv, uint8_t *buf)
+{
+    buf[0] = 5;
+    buf[1] = 1;
+    buf[2] = (srv->user && srv->pass) ? 2 : 0;
+
+    return 3;
+}
+
+int
+hev_socks5_proxy_encode_auth (HevConfigServer *srv, uint8_t *buf)
+{
+    size_t ulen, plen;
+
+    if (!srv->user || !srv->pass)
+        return 0;
+
+    ulen = strlen (srv->user);
+    plen = strlen (srv->pass);
+    if (ulen > 255)
+        ulen = 255;
+    if (plen > 255)
+        plen = 255;
+
+    buf[0] = 1;
+    buf[1] = ulen;
+    memcpy (&buf[2], srv->user, ulen);
+    buf[2 + ulen] = plen;
+    memcpy (&buf[3 + ulen], srv->pass, plen);
+
+    return 3 + ulen + plen;
+}
+
+int
+hev_socks5_proxy_encode_request (int cmd, const HevSocks5Addr *addr,
+                                 uint8_t *buf)
+{
+    int len = hev_socks5_addr_len (addr);
+
+    buf[0] = 5;
+    buf[1] = cmd;
+    buf[2] = 0;
+    memcpy (&buf[3], addr, len);
+
+    return 3 + len;
+}
+
+int
+hev_socks5_proxy_decode_greeting (HevConfigServer *srv, const uint8_t *buf,
+                                  int len)
+{
+    int method = (srv->user && srv->pass) ? 2 : 0;
+
+    if (len < 2)
+        return 0;
+    if ((buf[0] != 5) || (buf[1] != method))
+        return -1;
+
+    return 2;
+}
+
+int
+hev_socks5_proxy_decode_auth (HevConfigServer *srv, const uint8_t *buf,
+                              int len)
+{
+    if (!srv->user || !srv->pass)
+        return 0;
+    if (len < 2)
+        return 0;
+    if ((buf[0] != 1) || (buf[1] != 0))
+        return -1;
+
+    return 2;
+}
+
+int
+hev_socks5_proxy_reply_len (const uint8_t *buf, int len)
+{
+    if (len < 5)
+        return 5;
+
+    switch (buf[3]) {
+    case HEV_SOCKS5_ADDR_TYPE_IPV4:
+        return 4 + 4 + 2;
+    case HEV_SOCKS5_ADDR_TYPE_IPV6:
+        return 4 + 16 + 2;
+    case HEV_SOCKS5_ADDR_TYPE_NAME:
+        return 4 + 1 + buf[4] + 2;
+    }
+
+    return -1;
+}
+
+int
+hev_socks5_proxy_decode_reply (const uint8_t *buf, int len,
+                               HevSocks5Addr *bind)
+{
+    int rlen;
+
+    if (len < 2)
+        return 0;
+    if ((buf[0] != 5) || (buf[1] != 0))
+        return -1;
+
+    rlen = hev_socks5_proxy_reply_len (buf, len);
+    if (rlen < 0)
+        return -1;
+    if (len < rlen)
+        return 0;
+
+    if (bind)
+        memcpy (bind, &buf[3], rlen - 3);
+
+    return rlen;
+}
+
+int
+hev_socks5_proxy_resolve (HevConfigServer *srv, struct sockaddr_storage *saddr,
+                          socklen_t *saddr_len)
+{
+    struct addrinfo hints = { 0 };
+    struct addrinfo *result;
+    char port[8];
+    int res;
+
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf (port, sizeof (port), "%u", srv->port);
+
+    res = getaddrinfo (srv->addr, port, &hints, &result);
+    if (res != 0)
+        return -1;
+
+    memcpy (saddr, result->ai_addr, result->ai_addrlen);
+    *saddr_len = result->ai_addrlen;
+    freeaddrinfo (result);
+
+    return 0;
+}
+
+static int
+proxy_wait (int fd, short events, int timeout)
+{
+    struct pollfd pfd = { .fd = fd, .events = events };
+    int res;
+
+    do {
+        res = poll (&pfd, 1, timeout);
+    } while ((res < 0) && (errno == EINTR));
+
+    if (res == 0)
+        errno = ETIMEDOUT;
+
+    return (res > 0) ? 0 : -1;
+}
+
+static int
+proxy_send (int fd, const uint8_t *buf, int len, int timeout)
+{
+    int off = 0;
+
+    while (off < len) {
+        ssize_t s = send (fd, buf + off, len - off, MSG_NOSIGNAL);
+        if (s < 0) {
+            /* Fast open without a cookie only sent a bare SYN. */
+            if ((errno != EAGAIN) && (errno != EINTR) &&
+                (errno != EINPROGRESS))
+                return -1;
+            if (proxy_wait (fd, POLLOUT, timeout) < 0)
+                return -1;
+            continue;
+        }
+        off += s;
+    }
+
+    return 0;
+}
+
+static int
+proxy_recv (int fd, uint8_t *buf, int len, int timeout)
+{
+    int off = 0;
+
+    while (off < len) {
+        ssize_t s = recv (fd, buf + off, len - off, 0);
+        if (s == 0)
+            return -1;
+        if (s < 0) {
+            if ((errno != EAGAIN) && (errno != EINTR))
+                return -1;
+            if (proxy_wait (fd, POLLIN, timeout) < 0)
+                return -1;
+            continue;
+        }
+        off += s;
+    }
+
+    return 0;
+}
+
+int
+hev_socks5_proxy_connect (HevConfigServer *srv, int timeout)
+{
+    struct sockaddr_storage saddr;
+    socklen_t saddr_len;
+    socklen_t len;
+    int fd, res;
+    int err = 0;
+
+    res = hev_socks5_proxy_resolve (srv, &saddr, &saddr_len);
+    if (res < 0)
+        return -1;
+
+    fd = socket (saddr.ss_family, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+
+    if (srv->mark && (set_sock_mark (fd, srv->mark) < 0))
+        goto error;
+
+    if (srv->fast_open && (set_sock_fast_open (fd) < 0))
+        LOG_D ("socks5 proxy fast open unsupported");
+
+    res = connect (fd, (struct sockaddr *)&saddr, saddr_len);
+    if ((res < 0) && (errno != EINPROGRESS))
+        goto error;
+
+    if (proxy_wait (fd, POLLOUT, timeout) < 0)
+        goto error;
+
+    len = sizeof (err);
+    getsockopt (fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err) {
+        errno = err;
+        goto error;
+    }
+
+    return fd;
+
+error:
+    close (fd);
+    return -1;
+}
+
+int
+hev_socks5_proxy_handshake (int fd, HevConfigServer *srv, int timeout)
+{
+    uint8_t buf[HEV_SOCKS5_PROXY_BUF_SIZE];
+    int len, alen;
+
+    len = hev_socks5_proxy_encode_greeting (srv, buf);
+    alen = hev_socks5_proxy_encode_auth (srv, buf + len);
+
+    if (srv->pipeline) {
+        if (proxy_send (fd, buf, len + alen, timeout) < 0)
+            return -1;
+        alen = 0;
+    } else {
+        if (proxy_send (fd, buf, len, timeout) < 0)
+            return -1;
+        memmove (buf + 3, buf + len, alen);
+    }
+
+    if (proxy_recv (fd, buf, 2, timeout) < 0)
+        return -1;
+    if (hev_socks5_proxy_decode_greeting (srv, buf, 2) <= 0)
+        return -1;
+
+    if (!srv->user || !srv->pass)
+        return 0;
+
+    if (alen && (proxy_send (fd, buf + 3, alen, timeout) < 0))
+        return -1;
+
+    if (proxy_recv (fd, buf, 2, timeout) < 0)
+        return -1;
+    if (hev_socks5_proxy_decode_auth (srv, buf, 2) <= 0)
+        return -1;
+
+    return 0;
+}
+
+void
+hev_socks5_proxy_fast_open_done (int fd)
+{
+    int res = get_sock_fast_open (fd);
+
+    if (res > 0)
+        __atomic_add_fetch (&fast_open_hits, 1, __ATOMIC_RELAXED);
+    else if (res == 0)
+        __atomic_add_fetch (&fast_open_misses, 1, __ATOMIC_RELAXED);
+}
+
+void
+hev_socks5_proxy_fast_open_stats (unsigned long *hits, unsigned long *misses)
+{
+    *hits = __atomic_load_n (&fast_open_hits, __ATOMIC_RELAXED);
+    *misses = __atomic_load_n (&fast_open_misses, __ATOMIC_RELAXED);
+}
+
+int
+hev_socks5_proxy_request (int fd, int cmd, const HevSocks5Addr *addr,
+                          HevSocks5Addr *bind, int timeout)
+{
+    uint8_t buf[HEV_SOCKS5_PROXY_BUF_SIZE];
+    int len;
+
+    len = hev_socks5_proxy_encode_request (cmd, addr, buf);
+    if (proxy_send (fd, buf, len, timeout) < 0)
+        return -1;
+
+    if (proxy_recv (fd, buf, 5, timeout) < 0)
+        return -1;
+
+    len = hev_socks5_proxy_reply_len (buf, 5);
+    if ((len < 0) || (proxy_recv (fd, buf + 5, len - 5, timeout) < 0))
+        return -1;
+
+    if (hev_socks5_proxy_decode_reply (buf, len, bind) <= 0)
+        return -1;
+
+    return 0;
+}
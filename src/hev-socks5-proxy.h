@@ -0,0 +1,77 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-proxy.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Socks5 Proxy Wire Helpers
+ ============================================================================
+ */
+
+#ifndef __HEV_SOCKS5_PROXY_H__
+#define __HEV_SOCKS5_PROXY_H__
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include <hev-socks5-proto.h>
+
+#include "hev-config.h"
+
+#define HEV_SOCKS5_PROXY_BUF_SIZE (3 + 513 + 3 + 262)
+
+enum
+{
+    HEV_SOCKS5_PROXY_CMD_CONNECT = 1,
+    HEV_SOCKS5_PROXY_CMD_UDP_ASSOCIATE = 3,
+};
+
+/*
+ * Encoders for the client side messages. Each returns the number of bytes
+ * written into @buf, which must hold at least HEV_SOCKS5_PROXY_BUF_SIZE.
+ */
+int hev_socks5_proxy_encode_greeting (HevConfigServer *srv, uint8_t *buf);
+int hev_socks5_proxy_encode_auth (HevConfigServer *srv, uint8_t *buf);
+int hev_socks5_proxy_encode_request (int cmd, const HevSocks5Addr *addr,
+                                     uint8_t *buf);
+
+/*
+ * Reply decoders. Each returns the number of bytes consumed, 0 when more
+ * bytes are needed, or -1 when the server refused.
+ */
+int hev_socks5_proxy_decode_greeting (HevConfigServer *srv, const uint8_t *buf,
+                                      int len);
+int hev_socks5_proxy_decode_auth (HevConfigServer *srv, const uint8_t *buf,
+                                  int len);
+int hev_socks5_proxy_decode_reply (const uint8_t *buf, int len,
+                                   HevSocks5Addr *bind);
+
+/*
+ * Size of a request reply, known once its first 5 bytes are in @buf.
+ * Returns -1 for an unknown address type.
+ */
+int hev_socks5_proxy_reply_len (const uint8_t *buf, int len);
+
+int hev_socks5_proxy_resolve (HevConfigServer *srv,
+                              struct sockaddr_storage *saddr,
+                              socklen_t *saddr_len);
+
+/*
+ * Blocking helpers for background threads. @timeout is in milliseconds and
+ * applies to each step. The returned socket is non-blocking.
+ */
+int hev_socks5_proxy_connect (HevConfigServer *srv, int timeout);
+int hev_socks5_proxy_handshake (int fd, HevConfigServer *srv, int timeout);
+int hev_socks5_proxy_request (int fd, int cmd, const HevSocks5Addr *addr,
+                              HevSocks5Addr *bind, int timeout);
+
+/*
+ * TCP Fast Open accounting. Call on a connected socket once the server
+ * has answered: a hit means the data in the SYN was accepted, a miss that
+ * the kernel had no cookie yet or the server refused it and the data was
+ * resent after the handshake.
+ */
+void hev_socks5_proxy_fast_open_done (int fd);
+void hev_socks5_proxy_fast_open_stats (unsigned long *hits,
+                                       unsigned long *misses);
+
+#endif /* __HEV_SOCKS5_PROXY_H__ */
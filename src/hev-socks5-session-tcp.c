@@ -7,10 +7,13 @@
  ============================================================================
  */
 
+#include <poll.h>
+#include <time.h>
 #include <errno.h>
 #include <string.h>
 
 #include <lwip/tcp.h>
+#include <lwip/priv/tcp_priv.h>
 
 #include <hev-task.h>
 #include <hev-task-io.h>
@@ -22,38 +25,257 @@
 #include "hev-utils.h"
 #include "hev-config.h"
 #include "hev-logger.h"
+#include "hev-uring.h"
 #include "hev-config-const.h"
+#include "hev-tcp-time-wait.h"
+#include "hev-socks5-proxy.h"
 #include "hev-socks5-tunnel.h"
 
 #include "hev-socks5-session-tcp.h"
 
+#define ADAPT_INTERVAL (1000000)
+#define PBUF_IOVS (16)
+#define URING_F (1)
+#define URING_B (2)
+#define OUTPUT_SEGS (4)
+#define ZEROCOPY_WAIT (1000000)
+
+static long
+monotonic_usec (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 static int
 task_io_yielder (HevTaskYieldType type, void *data)
 {
-    HevSocks5Session *self = data;
-    HevListNode *node;
-    int res;
+    return hev_socks5_session_yielder (type, data);
+}
 
-    res = hev_socks5_task_io_yielder (type, data);
-    node = hev_socks5_session_get_node (self);
-    hev_socks5_tunnel_update_session (node);
+static unsigned long zc_sends;
+static unsigned long zc_zerocopy;
+static unsigned long zc_copied;
+static unsigned long zc_nobufs;
 
-    return res;
+static int
+tcp_splice_f_prepare (HevSocks5SessionTCP *self, struct iovec *iov,
+                      size_t skip)
+{
+    struct pbuf *p;
+    int iovc = 0;
+
+    for (p = self->queue; p && (skip >= p->len); p = p->next)
+        skip -= p->len;
+
+    for (; p && (iovc < 64); p = p->next, iovc++) {
+        iov[iovc].iov_base = (char *)p->payload + skip;
+        iov[iovc].iov_len = p->len - skip;
+        skip = 0;
+    }
+
+    return iovc;
+}
+
+/*
+ * Reopens the receive window for bytes written upstream, but only as far
+ * as the relay credit allows: what is queued plus what the peer may still
+ * send stays within the buffer limit. The rest is held back and handed
+ * out as the queue drains, so the peer never sends more than we accept.
+ * Called with self->mutex held.
+ */
+static void
+tcp_recv_credit (HevSocks5SessionTCP *self, size_t s)
+{
+    size_t limit = hev_tcp_buffer_get_limit (&self->buffer);
+    size_t queued = self->queue ? self->queue->tot_len : 0;
+    size_t used, credit;
+    int closed;
+
+    self->recv_held += s;
+    if (!self->pcb)
+        return;
+
+    used = queued + self->pcb->rcv_wnd;
+    credit = (limit > used) ? (limit - used) : 0;
+    if (credit > self->recv_held)
+        credit = self->recv_held;
+    self->recv_held -= credit;
+    if (!credit)
+        return;
+
+    closed = self->pcb->rcv_ann_wnd == 0;
+    while (credit) {
+        u16_t len = (credit > 0xffff) ? 0xffff : credit;
+
+        tcp_recved (self->pcb, len);
+        credit -= len;
+    }
+
+    /* A small credit stays under the update threshold, don't wait for it. */
+    if (closed) {
+        tcp_ack_now (self->pcb);
+        tcp_output (self->pcb);
+    }
+}
+
+static void
+tcp_splice_f_release (HevSocks5SessionTCP *self, size_t s)
+{
+    hev_task_mutex_lock (self->mutex);
+    self->queue = pbuf_free_header (self->queue, s);
+    tcp_recv_credit (self, s);
+    hev_task_mutex_unlock (self->mutex);
+}
+
+static void
+tcp_splice_f_done (HevSocks5SessionTCP *self, size_t s)
+{
+    self->data.tx_bytes += s;
+    tcp_splice_f_release (self, s);
+}
+
+/*
+ * Bytes sent with MSG_ZEROCOPY stay queued, and the lwIP window closed,
+ * until the kernel reports it is done with their pages. Copied writes
+ * behind them wait their turn, so the queue is released in order.
+ */
+static int
+tcp_zerocopy_want (HevSocks5SessionTCP *self, struct iovec *iov, int iovc)
+{
+    size_t len = 0;
+    int i;
+
+    if (!self->zc_threshold)
+        return 0;
+
+    for (i = 0; (i < iovc) && (len < self->zc_threshold); i++)
+        len += iov[i].iov_len;
+
+    return len >= self->zc_threshold;
+}
+
+static void
+tcp_zerocopy_push (HevSocks5SessionTCP *self, size_t len, int zerocopy)
+{
+    HevSocks5SessionTCPSend *send = NULL;
+
+    if (self->zc_head != self->zc_tail) {
+        send = &self->zc_sends[(self->zc_tail - 1) %
+                               HEV_SOCKS5_SESSION_TCP_SENDS];
+        if (zerocopy || send->zerocopy)
+            send = NULL;
+    }
+
+    if (send) {
+        send->len += len;
+    } else {
+        send = &self->zc_sends[self->zc_tail++ % HEV_SOCKS5_SESSION_TCP_SENDS];
+        send->len = len;
+        send->zerocopy = zerocopy;
+        send->id = zerocopy ? self->zc_id++ : 0;
+    }
+
+    self->zc_size += len;
+    self->data.tx_bytes += len;
+}
+
+static int
+tcp_zerocopy_reap (HevSocks5SessionTCP *self)
+{
+    unsigned int lo, hi;
+    size_t size = 0;
+    int copied;
+
+    while (get_sock_zerocopy (HEV_SOCKS5 (self)->fd, &lo, &hi, &copied) > 0) {
+        unsigned long n = hi - lo + 1;
+
+        /* The kernel copied anyway, likely a device without SG. */
+        if (copied) {
+            __atomic_add_fetch (&zc_copied, n, __ATOMIC_RELAXED);
+            self->zc_threshold = 0;
+        } else {
+            __atomic_add_fetch (&zc_zerocopy, n, __ATOMIC_RELAXED);
+        }
+
+        if ((int)(hi + 1 - self->zc_done) > 0)
+            self->zc_done = hi + 1;
+    }
+
+    while (self->zc_head != self->zc_tail) {
+        HevSocks5SessionTCPSend *send;
+
+        send = &self->zc_sends[self->zc_head % HEV_SOCKS5_SESSION_TCP_SENDS];
+        if (send->zerocopy && ((int)(send->id - self->zc_done) >= 0))
+            break;
+
+        size += send->len;
+        self->zc_head++;
+    }
+
+    if (!size)
+        return 0;
+
+    self->zc_size -= size;
+    tcp_splice_f_release (self, size);
+
+    return 1;
+}
+
+/*
+ * The kernel may still read the queue for sends not reported done, even
+ * after the session gave up on the socket. Wait a bounded time for them,
+ * then reset the connection so the unsent rest is dropped, not read.
+ */
+static void
+tcp_zerocopy_wait (HevSocks5SessionTCP *self)
+{
+    int fd = HEV_SOCKS5 (self)->fd;
+    long deadline;
+
+    if ((fd < 0) || (self->zc_head == self->zc_tail))
+        return;
+
+    deadline = monotonic_usec () + ZEROCOPY_WAIT;
+    for (;;) {
+        long left;
+
+        tcp_zerocopy_reap (self);
+        if (self->zc_head == self->zc_tail)
+            return;
+
+        left = deadline - monotonic_usec ();
+        if (left <= 0)
+            break;
+
+        /* Completions raise POLLERR, which wakes the sleep early. */
+        hev_task_sleep ((left + 999) / 1000);
+    }
+
+    LOG_W ("%p socks5 session tcp zerocopy wait timeout", self);
+    set_sock_linger_reset (fd);
+    hev_task_del_fd (hev_task_self (), fd);
+    close (fd);
+    HEV_SOCKS5 (self)->fd = -1;
 }
 
 static int
 tcp_splice_f (HevSocks5SessionTCP *self)
 {
     struct iovec iov[64];
-    struct pbuf *p;
+    int fd = HEV_SOCKS5 (self)->fd;
     int iovc = 0;
     int res = 1;
 
+    if (self->zc_head != self->zc_tail)
+        res = tcp_zerocopy_reap (self);
+
     if (self->queue) {
-        for (p = self->queue; p && (iovc < 64); p = p->next, iovc++) {
-            iov[iovc].iov_base = p->payload;
-            iov[iovc].iov_len = p->len;
-        }
+        if ((self->zc_tail - self->zc_head) < HEV_SOCKS5_SESSION_TCP_SENDS)
+            iovc = tcp_splice_f_prepare (self, iov, self->zc_size);
     } else if (self->pcb_eof) {
         res = -1;
     } else {
@@ -61,65 +283,280 @@ tcp_splice_f (HevSocks5SessionTCP *self)
     }
 
     if (iovc) {
-        ssize_t s = writev (HEV_SOCKS5 (self)->fd, iov, iovc);
+        int zerocopy = tcp_zerocopy_want (self, iov, iovc);
+        ssize_t s;
+
+        if (zerocopy) {
+            s = send_zerocopy (fd, iov, iovc);
+            if ((0 > s) && (ENOBUFS == errno)) {
+                __atomic_add_fetch (&zc_nobufs, 1, __ATOMIC_RELAXED);
+                zerocopy = 0;
+            } else if (0 < s) {
+                __atomic_add_fetch (&zc_sends, 1, __ATOMIC_RELAXED);
+            }
+        }
+        if (!zerocopy)
+            s = writev (fd, iov, iovc);
+
         if (0 >= s) {
             if ((0 > s) && (EAGAIN == errno))
                 res = 0;
             else
                 res = -1;
         } else {
-            hev_task_mutex_lock (self->mutex);
-            self->queue = pbuf_free_header (self->queue, s);
-            if (self->pcb)
-                tcp_recved (self->pcb, s);
-            hev_task_mutex_unlock (self->mutex);
+            if (zerocopy || (self->zc_head != self->zc_tail))
+                tcp_zerocopy_push (self, s, zerocopy);
+            else
+                tcp_splice_f_done (self, s);
             res = 1;
         }
     } else if (res < 0) {
-        shutdown (HEV_SOCKS5 (self)->fd, SHUT_WR);
+        shutdown (fd, SHUT_WR);
     }
 
     return res;
 }
 
+/*
+ * Segments queued with tcp_write go out in one tcp_output per burst, once
+ * a few full segments are pending or before the task waits, so many small
+ * upstream reads share packets instead of each costing a TUN write.
+ * Called with self->mutex held.
+ */
+static err_t
+tcp_output_defer (HevSocks5SessionTCP *self, size_t len)
+{
+    self->pcb_dirty += len;
+    if (self->pcb_dirty < (OUTPUT_SEGS * tcp_mss (self->pcb)))
+        return ERR_OK;
+
+    self->pcb_dirty = 0;
+    return tcp_output (self->pcb);
+}
+
 static int
-tcp_splice_b (HevSocks5SessionTCP *self)
+tcp_output_flush (HevSocks5SessionTCP *self)
+{
+    err_t err = ERR_OK;
+
+    if (!self->pcb_dirty)
+        return 0;
+
+    hev_task_mutex_lock (self->mutex);
+    if (self->pcb)
+        err = tcp_output (self->pcb);
+    self->pcb_dirty = 0;
+    hev_task_mutex_unlock (self->mutex);
+
+    return (err == ERR_OK) ? 0 : -1;
+}
+
+/*
+ * Commits @s bytes read into the relay buffer and hands everything unsent
+ * to lwIP, or shuts the pcb for writing once the upstream read side ended.
+ */
+static int
+tcp_splice_b_flush (HevSocks5SessionTCP *self, size_t s, int res)
 {
     struct iovec iov[2];
     err_t err = ERR_OK;
+    int iovc;
+
+    hev_task_mutex_lock (self->mutex);
+    hev_tcp_buffer_write_finish (&self->buffer, s);
+    if (self->pcb) {
+        iovc = hev_tcp_buffer_reading (&self->buffer, iov);
+        if (iovc) {
+            int i;
+            for (i = 0, s = 0; i < iovc; i++) {
+                void *ptr = iov[i].iov_base;
+                size_t len = iov[i].iov_len;
+                /* PSH on the last segment of the batch. */
+                u8_t flag = (i < (iovc - 1)) ? TCP_WRITE_FLAG_MORE : 0;
+                err |= tcp_write (self->pcb, ptr, len, flag);
+                s += len;
+            }
+            hev_tcp_buffer_read_finish (&self->buffer, s);
+            err |= tcp_output_defer (self, s);
+            res = 1;
+        } else if (res < 0) {
+            tcp_shutdown (self->pcb, 0, 1);
+        }
+    }
+    hev_task_mutex_unlock (self->mutex);
+    if (!self->pcb || (err != ERR_OK))
+        res = -1;
+
+    return res;
+}
+
+static int
+tcp_splice_b (HevSocks5SessionTCP *self)
+{
+    struct iovec iov[2];
     int res = 1, iovc;
+    ssize_t s = 0;
+
+    hev_task_mutex_lock (self->mutex);
+    iovc = hev_tcp_buffer_writing (&self->buffer, iov);
+    hev_task_mutex_unlock (self->mutex);
+    if (iovc) {
+        s = readv (HEV_SOCKS5 (self)->fd, iov, iovc);
+        if (0 >= s) {
+            if ((0 > s) && (EAGAIN == errno))
+                res = 0;
+            else
+                res = -1;
+            s = 0;
+        } else {
+            self->data.rx_bytes += s;
+        }
+    }
+
+    return tcp_splice_b_flush (self, s, res);
+}
+
+/*
+ * Size the relay buffer and the upstream socket buffers to twice the
+ * bandwidth-delay product of the busier direction. Growth jumps to the
+ * target, shrinking halves once per interval so short lulls don't drop
+ * the window of a bulk flow.
+ */
+static void
+tcp_buffer_adapt (HevSocks5SessionTCP *self)
+{
+    int min = hev_config_get_misc_tcp_buffer_min_size ();
+    int max = hev_config_get_misc_tcp_buffer_max_size ();
+    unsigned long long tx, rx, bdp;
+    long now, interval;
+    int size, rtt;
+
+    now = monotonic_usec ();
+    interval = now - self->adapt_time;
+    if (interval < ADAPT_INTERVAL)
+        return;
+
+    tx = self->data.tx_bytes - self->adapt_tx;
+    rx = self->data.rx_bytes - self->adapt_rx;
+    self->adapt_tx = self->data.tx_bytes;
+    self->adapt_rx = self->data.rx_bytes;
+    self->adapt_time = now;
+
+    rtt = get_sock_rtt (HEV_SOCKS5 (self)->fd);
+    if (rtt <= 0)
+        return;
+
+    bdp = (tx > rx) ? tx : rx;
+    bdp = bdp * rtt / interval;
+
+    for (size = min; (size < max) && (size < (bdp * 2)); size <<= 1)
+        ;
+    if (size > max)
+        size = max;
+    if (size < (self->adapt_size / 2))
+        size = self->adapt_size / 2;
+    if (size == self->adapt_size)
+        return;
+
+    LOG_D ("%p socks5 session tcp buffer %d -> %d rtt %d", self,
+           self->adapt_size, size, rtt);
+
+    self->adapt_size = size;
+    set_sock_buffer_size (HEV_SOCKS5 (self)->fd, size);
+
+    hev_task_mutex_lock (self->mutex);
+    hev_tcp_buffer_set_limit (&self->buffer, size);
+    hev_task_mutex_unlock (self->mutex);
+}
+
+/*
+ * Reads into pbufs of one segment each and hands their payloads to
+ * tcp_write without a copy. They stay linked on the unacked list, not
+ * concatenated, and each one is freed as soon as its bytes are acked.
+ */
+static int
+tcp_splice_b_pbuf (HevSocks5SessionTCP *self)
+{
+    struct pbuf *bufs[PBUF_IOVS];
+    struct iovec iov[PBUF_IOVS];
+    err_t err = ERR_OK;
+    int res = 1, iovc = 0;
+    size_t written = 0;
+    ssize_t s = 0;
+    int i;
+
+    hev_task_mutex_lock (self->mutex);
+    if (self->pcb) {
+        size_t limit = hev_tcp_buffer_get_limit (&self->buffer);
+        size_t mss = tcp_mss (self->pcb);
+        size_t room = 0;
+
+        if (limit > self->unacked_len)
+            room = limit - self->unacked_len;
+        if (room > tcp_sndbuf (self->pcb))
+            room = tcp_sndbuf (self->pcb);
+
+        for (; (iovc < PBUF_IOVS) && room; iovc++) {
+            size_t len = (room < mss) ? room : mss;
+
+            bufs[iovc] = pbuf_alloc (PBUF_RAW, len, PBUF_RAM);
+            if (!bufs[iovc])
+                break;
+
+            iov[iovc].iov_base = bufs[iovc]->payload;
+            iov[iovc].iov_len = len;
+            room -= len;
+        }
+    }
+    hev_task_mutex_unlock (self->mutex);
 
-    iovc = hev_ring_buffer_writing (self->buffer, iov);
     if (iovc) {
-        ssize_t s = readv (HEV_SOCKS5 (self)->fd, iov, iovc);
+        s = readv (HEV_SOCKS5 (self)->fd, iov, iovc);
         if (0 >= s) {
             if ((0 > s) && (EAGAIN == errno))
                 res = 0;
             else
                 res = -1;
+            s = 0;
         } else {
-            hev_ring_buffer_write_finish (self->buffer, s);
+            self->data.rx_bytes += s;
         }
     }
 
     hev_task_mutex_lock (self->mutex);
+    for (i = 0; i < iovc; i++) {
+        struct pbuf *p = bufs[i];
+
+        /* Nothing after a failed write may go out, it would leave a hole. */
+        if (!s || !self->pcb || (err != ERR_OK)) {
+            pbuf_free (p);
+            continue;
+        }
+
+        if (s < p->len)
+            pbuf_realloc (p, s);
+        s -= p->len;
+
+        /* PSH on the last segment of what was read. */
+        err = tcp_write (self->pcb, p->payload, p->len,
+                         s ? TCP_WRITE_FLAG_MORE : 0);
+        if (err != ERR_OK) {
+            pbuf_free (p);
+            continue;
+        }
+        written += p->len;
+        if (self->unacked_tail)
+            self->unacked_tail->next = p;
+        else
+            self->unacked = p;
+        self->unacked_tail = p;
+        self->unacked_len += p->len;
+    }
     if (self->pcb) {
-        iovc = hev_ring_buffer_reading (self->buffer, iov);
-        if (iovc) {
-            ssize_t s = 0;
-            int i;
-            for (i = 0; i < iovc; i++) {
-                void *ptr = iov[i].iov_base;
-                size_t len = iov[i].iov_len;
-                err |= tcp_write (self->pcb, ptr, len, 0);
-                s += len;
-            }
-            hev_ring_buffer_read_finish (self->buffer, s);
-            err |= tcp_output (self->pcb);
-            res = 1;
-        } else if (res < 0) {
+        if (written)
+            err |= tcp_output_defer (self, written);
+        if (res < 0)
             tcp_shutdown (self->pcb, 0, 1);
-        }
     }
     hev_task_mutex_unlock (self->mutex);
     if (!self->pcb || (err != ERR_OK))
@@ -128,19 +565,138 @@ tcp_splice_b (HevSocks5SessionTCP *self)
     return res;
 }
 
+static int
+tcp_splice_uring_reap (HevSocks5SessionTCP *self, HevUring *uring, int *busy,
+                       int *res_f, int *res_b)
+{
+    unsigned long long data;
+    int progress = 0;
+    int res;
+
+    while (hev_uring_reap (uring, &data, &res)) {
+        if (data == URING_F) {
+            *busy &= ~URING_F;
+            if (res > 0) {
+                tcp_splice_f_done (self, res);
+                progress = 1;
+            } else if (res != -EAGAIN) {
+                *res_f = -1;
+            }
+        } else if (data == URING_B) {
+            *busy &= ~URING_B;
+            if (res > 0) {
+                self->data.rx_bytes += res;
+                *res_b = tcp_splice_b_flush (self, res, 1);
+                progress = 1;
+            } else if (res != -EAGAIN) {
+                *res_b = tcp_splice_b_flush (self, 0, -1);
+            }
+        }
+    }
+
+    return progress;
+}
+
+/*
+ * The readv/writev relay with the upstream socket I/O on the thread's
+ * io_uring. Each pass queues at most one write and one read, submits
+ * them with a single io_uring_enter and sleeps on the ring fd until a
+ * completion or lwIP wakes the task. Returns -1 if the ring can't take
+ * this session, before any I/O, so the caller falls back.
+ */
+static int
+tcp_splice_uring (HevSocks5SessionTCP *self, HevUring *uring, int adapt)
+{
+    HevSocks5Session *base = HEV_SOCKS5_SESSION (self);
+    int ufd = hev_uring_get_fd (uring);
+    int fd = HEV_SOCKS5 (self)->fd;
+    int res_f = 1;
+    int res_b = 1;
+    int busy = 0;
+
+    if (hev_uring_set_file (uring, fd) < 0)
+        return -1;
+
+    if (hev_task_add_fd (hev_task_self (), ufd, POLLIN) < 0) {
+        hev_uring_set_file (uring, -1);
+        return -1;
+    }
+
+    for (;;) {
+        struct iovec iov_f[64];
+        struct iovec iov_b[2];
+        HevTaskYieldType type;
+        int iovc, progress;
+
+        if ((res_f >= 0) && !(busy & URING_F)) {
+            if (self->queue) {
+                iovc = tcp_splice_f_prepare (self, iov_f, 0);
+                if (hev_uring_writev (uring, iov_f, iovc, URING_F) == 0)
+                    busy |= URING_F;
+            } else if (self->pcb_eof) {
+                shutdown (fd, SHUT_WR);
+                res_f = -1;
+            }
+        }
+
+        if ((res_b >= 0) && !(busy & URING_B)) {
+            hev_task_mutex_lock (self->mutex);
+            iovc = hev_tcp_buffer_writing (&self->buffer, iov_b);
+            hev_task_mutex_unlock (self->mutex);
+            if (iovc && (hev_uring_readv (uring, iov_b, iovc, URING_B) == 0))
+                busy |= URING_B;
+        }
+
+        if (hev_uring_submit (uring, 0) < 0)
+            break;
+
+        progress = tcp_splice_uring_reap (self, uring, &busy, &res_f, &res_b);
+        if (adapt)
+            tcp_buffer_adapt (self);
+
+        if (progress)
+            type = HEV_TASK_YIELD;
+        else if (busy || ((res_f & res_b) == 0))
+            type = HEV_TASK_WAITIO;
+        else
+            break;
+
+        if ((type == HEV_TASK_WAITIO) && (tcp_output_flush (self) < 0))
+            break;
+
+        if (task_io_yielder (type, base) < 0)
+            break;
+    }
+
+    /* The kernel may still touch queued pbufs and buffer chunks. */
+    if (busy & URING_F)
+        hev_uring_cancel (uring, URING_F);
+    if (busy & URING_B)
+        hev_uring_cancel (uring, URING_B);
+    while (busy) {
+        if (hev_uring_submit (uring, 1) < 0)
+            break;
+        tcp_splice_uring_reap (self, uring, &busy, &res_f, &res_b);
+    }
+    tcp_output_flush (self);
+
+    hev_task_del_fd (hev_task_self (), ufd);
+    hev_uring_set_file (uring, -1);
+
+    return 0;
+}
+
 static err_t
 tcp_recv_handler (void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
 {
     HevSocks5SessionTCP *self = arg;
 
+    /* The window bounds the queue, nothing is ever refused. */
     if (p) {
-        if (!self->queue) {
+        if (!self->queue)
             self->queue = p;
-        } else {
-            if (self->queue->tot_len > TCP_WND_MAX (pcb))
-                return ERR_WOULDBLOCK;
+        else
             pbuf_cat (self->queue, p);
-        }
     } else {
         self->pcb_eof = 1;
     }
@@ -154,7 +710,14 @@ tcp_sent_handler (void *arg, struct tcp_pcb *pcb, u16_t len)
 {
     HevSocks5SessionTCP *self = arg;
 
-    hev_ring_buffer_read_release (self->buffer, len);
+    if (self->recv_pbuf) {
+        self->unacked = pbuf_free_header (self->unacked, len);
+        self->unacked_len -= len;
+        if (!self->unacked)
+            self->unacked_tail = NULL;
+    } else {
+        hev_tcp_buffer_read_release (&self->buffer, len);
+    }
     hev_task_wakeup (self->data.task);
 
     return ERR_OK;
@@ -169,6 +732,19 @@ tcp_err_handler (void *arg, err_t err)
     hev_socks5_session_terminate (HEV_SOCKS5_SESSION (self));
 }
 
+void
+hev_socks5_session_tcp_fini (void)
+{
+    if (hev_config_get_misc_tcp_zerocopy_threshold () > 0)
+        LOG_I ("tcp zerocopy: %lu sends %lu zerocopy %lu copied %lu nobufs",
+               zc_sends, zc_zerocopy, zc_copied, zc_nobufs);
+
+    zc_sends = 0;
+    zc_zerocopy = 0;
+    zc_copied = 0;
+    zc_nobufs = 0;
+}
+
 HevSocks5SessionTCP *
 hev_socks5_session_tcp_new (struct tcp_pcb *pcb, HevTaskMutex *mutex)
 {
@@ -199,7 +775,7 @@ hev_socks5_session_tcp_bind (HevSocks5 *self, int fd,
 
     LOG_D ("%p socks5 session tcp bind", self);
 
-    srv = hev_config_get_socks5_server ();
+    srv = HEV_SOCKS5_SESSION_TCP (self)->data.upstream->srv;
     mark = srv->mark;
 
     if (mark) {
@@ -210,14 +786,177 @@ hev_socks5_session_tcp_bind (HevSocks5 *self, int fd,
             return -1;
     }
 
+    /* Falls back to a regular connect when unsupported. */
+    if (srv->fast_open)
+        set_sock_fast_open (fd);
+
     return 0;
 }
 
+/*
+ * Send the CONNECT request, preceded by the greeting and auth when @greet
+ * is set. With early data, the payload already queued from the client is
+ * written in the same writev. It is released only once the server has
+ * accepted the request, so a failed attempt can be retried elsewhere.
+ *
+ * Returns: 0 on success, -1 when nothing was answered, -2 on refusal
+ */
+static int
+hev_socks5_session_tcp_request (HevSocks5SessionTCP *self, int greet)
+{
+    HevConfigServer *srv = self->data.upstream->srv;
+    uint8_t buf[HEV_SOCKS5_PROXY_BUF_SIZE];
+    struct iovec iov[64];
+    struct pbuf *p;
+    int iovc = 1;
+    int len = 0;
+    int early;
+    ssize_t s;
+
+    if (greet) {
+        len = hev_socks5_proxy_encode_greeting (srv, buf);
+        len += hev_socks5_proxy_encode_auth (srv, buf + len);
+    }
+    len += hev_socks5_proxy_encode_request (HEV_SOCKS5_PROXY_CMD_CONNECT,
+                                            &self->addr, buf + len);
+
+    iov[0].iov_base = buf;
+    iov[0].iov_len = len;
+
+    if (srv->early_data) {
+        hev_task_mutex_lock (self->mutex);
+        for (p = self->queue; p && (iovc < 64); p = p->next, iovc++) {
+            iov[iovc].iov_base = p->payload;
+            iov[iovc].iov_len = p->len;
+        }
+        hev_task_mutex_unlock (self->mutex);
+    }
+
+    s = hev_task_io_writev (HEV_SOCKS5 (self)->fd, iov, iovc, task_io_yielder,
+                            self);
+    /* Fast open without a cookie: the SYN went out bare, send after it. */
+    if ((s < 0) && (errno == EINPROGRESS))
+        s = 0;
+    if (s < 0)
+        return -1;
+    if ((s < len) && (hev_socks5_session_send (self, buf + s, len - s) < 0))
+        return -1;
+
+    early = (s > len) ? (s - len) : 0;
+
+    if (greet) {
+        if (hev_socks5_session_recv (self, buf, 2) < 0)
+            return -1;
+        if (hev_socks5_proxy_decode_greeting (srv, buf, 2) < 0)
+            return -2;
+
+        if (srv->user && srv->pass) {
+            if (hev_socks5_session_recv (self, buf, 2) < 0)
+                return -2;
+            if (hev_socks5_proxy_decode_auth (srv, buf, 2) < 0)
+                return -2;
+        }
+    }
+
+    if (hev_socks5_session_recv (self, buf, 5) < 0)
+        return greet ? -2 : -1;
+
+    len = hev_socks5_proxy_reply_len (buf, 5);
+    if ((len > 5) && (hev_socks5_session_recv (self, buf + 5, len - 5) < 0))
+        return -2;
+    if ((len < 0) || (hev_socks5_proxy_decode_reply (buf, len, NULL) <= 0))
+        return -2;
+
+    if (early) {
+        LOG_D ("%p socks5 session tcp early data %d", self, early);
+        tcp_splice_f_done (self, early);
+    }
+
+    return 0;
+}
+
+static int
+hev_socks5_session_tcp_handshake (HevSocks5Session *base)
+{
+    HevSocks5SessionTCP *self = HEV_SOCKS5_SESSION_TCP (base);
+    HevConfigServer *srv = self->data.upstream->srv;
+    uint8_t buf[HEV_SOCKS5_PROXY_BUF_SIZE];
+    int len, res;
+
+    LOG_D ("%p socks5 session tcp handshake", self);
+
+    if (!srv->early_data && !srv->fast_open) {
+        if (srv->user && srv->pass)
+            hev_socks5_client_set_auth (HEV_SOCKS5_CLIENT (self), srv->user,
+                                        srv->pass);
+
+        return hev_socks5_client_handshake (HEV_SOCKS5_CLIENT (self),
+                                            srv->pipeline);
+    }
+
+    if (srv->pipeline) {
+        res = hev_socks5_session_tcp_request (self, 1);
+        goto exit;
+    }
+
+    len = hev_socks5_proxy_encode_greeting (srv, buf);
+    if (hev_socks5_session_send (self, buf, len) < 0)
+        return -1;
+    if (hev_socks5_session_recv (self, buf, 2) < 0)
+        return -1;
+    if (hev_socks5_proxy_decode_greeting (srv, buf, 2) < 0)
+        return -1;
+
+    len = hev_socks5_proxy_encode_auth (srv, buf);
+    if (len) {
+        if (hev_socks5_session_send (self, buf, len) < 0)
+            return -1;
+        if (hev_socks5_session_recv (self, buf, 2) < 0)
+            return -1;
+        if (hev_socks5_proxy_decode_auth (srv, buf, 2) < 0)
+            return -1;
+    }
+
+    res = hev_socks5_session_tcp_request (self, 0);
+
+exit:
+    if ((res == 0) && srv->fast_open)
+        hev_socks5_proxy_fast_open_done (HEV_SOCKS5 (self)->fd);
+
+    return res;
+}
+
+static int
+hev_socks5_session_tcp_attach (HevSocks5Session *base, int fd)
+{
+    HevSocks5SessionTCP *self = HEV_SOCKS5_SESSION_TCP (base);
+    int res;
+
+    LOG_D ("%p socks5 session tcp attach", self);
+
+    if (hev_socks5_client_connect_fd (HEV_SOCKS5_CLIENT (self), fd) < 0) {
+        close (fd);
+        return -1;
+    }
+
+    res = hev_socks5_session_tcp_request (self, 0);
+
+    /* A stale warm connection is dropped and the caller connects afresh. */
+    if (res == -1) {
+        hev_task_del_fd (hev_task_self (), fd);
+        close (fd);
+        HEV_SOCKS5 (self)->fd = -1;
+    }
+
+    return res;
+}
+
 static void
 hev_socks5_session_tcp_splice (HevSocks5Session *base)
 {
     HevSocks5SessionTCP *self = HEV_SOCKS5_SESSION_TCP (base);
-    int tcp_buffer_size;
+    HevUring *uring;
+    int adapt;
     int res_f = 1;
     int res_b = 1;
 
@@ -226,18 +965,37 @@ hev_socks5_session_tcp_splice (HevSocks5Session *base)
     if (!self->pcb)
         return;
 
-    tcp_buffer_size = hev_config_get_misc_tcp_buffer_size ();
-    self->buffer = hev_ring_buffer_alloca (tcp_buffer_size);
-    if (!self->buffer)
-        return;
+    /* Here rather than in the binder, to cover warm and raced sockets. */
+    set_sock_profile (HEV_SOCKS5 (self)->fd, &self->addr);
+
+    adapt = hev_config_get_misc_tcp_buffer_max_size () > 0;
+    if (adapt) {
+        self->adapt_time = monotonic_usec ();
+        self->adapt_size = hev_config_get_misc_tcp_buffer_size ();
+    }
+
+    /* Upstream data into pbufs stays on readv. */
+    uring = self->recv_pbuf ? NULL : hev_uring_get ();
+    if (uring && (tcp_splice_uring (self, uring, adapt) == 0))
+        goto drain;
+
+    if (hev_config_get_misc_tcp_zerocopy_threshold () > 0) {
+        if (set_sock_zerocopy (HEV_SOCKS5 (self)->fd) == 0)
+            self->zc_threshold =
+                hev_config_get_misc_tcp_zerocopy_threshold ();
+    }
 
     for (;;) {
         HevTaskYieldType type;
 
         if (res_f >= 0)
             res_f = tcp_splice_f (self);
-        if (res_b >= 0)
+        if ((res_b >= 0) && self->recv_pbuf)
+            res_b = tcp_splice_b_pbuf (self);
+        else if (res_b >= 0)
             res_b = tcp_splice_b (self);
+        if (adapt)
+            tcp_buffer_adapt (self);
 
         if (res_f > 0 || res_b > 0)
             type = HEV_TASK_YIELD;
@@ -246,17 +1004,25 @@ hev_socks5_session_tcp_splice (HevSocks5Session *base)
         else
             break;
 
+        if ((type == HEV_TASK_WAITIO) && (tcp_output_flush (self) < 0))
+            break;
+
         if (task_io_yielder (type, base) < 0)
             break;
     }
+    tcp_output_flush (self);
 
+drain:
     while (self->pcb) {
-        if (hev_ring_buffer_get_use_size (self->buffer) == 0)
+        if (!self->unacked &&
+            (hev_tcp_buffer_get_use_size (&self->buffer) == 0))
             break;
 
         if (task_io_yielder (HEV_TASK_WAITIO, base) < 0)
             break;
     }
+
+    tcp_zerocopy_wait (self);
 }
 
 static HevTask *
@@ -287,17 +1053,21 @@ int
 hev_socks5_session_tcp_construct (HevSocks5SessionTCP *self,
                                   struct tcp_pcb *pcb, HevTaskMutex *mutex)
 {
-    HevSocks5Addr addr;
     int res;
 
-    res = hev_socks5_addr_from_lwip (&addr, &pcb->local_ip, pcb->local_port);
+    res = hev_socks5_addr_from_lwip (&self->addr, &pcb->local_ip,
+                                     pcb->local_port);
     if (res < 0)
         return -1;
 
-    res = hev_socks5_client_tcp_construct (&self->base, &addr);
+    res = hev_socks5_client_tcp_construct (&self->base, &self->addr);
     if (res < 0)
         return -1;
 
+    /* Balance by destination host, whatever the port. */
+    self->data.hash = hev_socks5_upstream_hash (
+        &self->addr, hev_socks5_addr_len (&self->addr) - 2);
+
     LOG_D ("%p socks5 session tcp construct", self);
 
     HEV_OBJECT (self)->klass = HEV_SOCKS5_SESSION_TCP_TYPE;
@@ -310,6 +1080,7 @@ hev_socks5_session_tcp_construct (HevSocks5SessionTCP *self,
     self->pcb = pcb;
     self->mutex = mutex;
     self->data.self = self;
+    self->recv_pbuf = hev_config_get_misc_tcp_recv_into_pbuf ();
 
     return 0;
 }
@@ -323,6 +1094,12 @@ hev_socks5_session_tcp_destruct (HevObject *base)
 
     hev_task_mutex_lock (self->mutex);
     if (self->pcb) {
+        HevTCPTimeWait *tw = hev_tcp_time_wait_get ();
+
+        /* Aborting frees a TIME_WAIT pcb silently, keep only its tuple. */
+        if (tw && (self->pcb->state == TIME_WAIT))
+            hev_tcp_time_wait_store (tw, self->pcb);
+
         tcp_recv (self->pcb, NULL);
         tcp_sent (self->pcb, NULL);
         tcp_err (self->pcb, NULL);
@@ -331,6 +1108,9 @@ hev_socks5_session_tcp_destruct (HevObject *base)
 
     if (self->queue)
         pbuf_free (self->queue);
+    hev_tcp_buffer_clear (&self->buffer);
+    if (self->unacked)
+        pbuf_free (self->unacked);
     hev_task_mutex_unlock (self->mutex);
 
     HEV_SOCKS5_CLIENT_TCP_TYPE->destruct (base);
@@ -374,6 +1154,8 @@ hev_socks5_session_tcp_class (void)
         siptr->get_task = hev_socks5_session_tcp_get_task;
         siptr->set_task = hev_socks5_session_tcp_set_task;
         siptr->get_node = hev_socks5_session_tcp_get_node;
+        siptr->attach = hev_socks5_session_tcp_attach;
+        siptr->handshake = hev_socks5_session_tcp_handshake;
     }
 
     return okptr;
@@ -10,29 +10,58 @@
 #ifndef __HEV_SOCKS5_SESSION_TCP_H__
 #define __HEV_SOCKS5_SESSION_TCP_H__
 
-#include <hev-ring-buffer.h>
 #include <hev-socks5-client-tcp.h>
 
+#include "hev-tcp-buffer.h"
 #include "hev-socks5-session.h"
 
 #define HEV_SOCKS5_SESSION_TCP(p) ((HevSocks5SessionTCP *)p)
 #define HEV_SOCKS5_SESSION_TCP_CLASS(p) ((HevSocks5SessionTCPClass *)p)
 #define HEV_SOCKS5_SESSION_TCP_TYPE (hev_socks5_session_tcp_class ())
+#define HEV_SOCKS5_SESSION_TCP_SENDS (16)
 
 typedef struct _HevSocks5SessionTCP HevSocks5SessionTCP;
 typedef struct _HevSocks5SessionTCPClass HevSocks5SessionTCPClass;
+typedef struct _HevSocks5SessionTCPSend HevSocks5SessionTCPSend;
+
+struct _HevSocks5SessionTCPSend
+{
+    unsigned int len;
+    unsigned int id;
+    int zerocopy;
+};
 
 struct _HevSocks5SessionTCP
 {
     HevSocks5ClientTCP base;
 
     HevSocks5SessionData data;
+    HevSocks5Addr addr;
 
     struct pbuf *queue;
     struct tcp_pcb *pcb;
     HevTaskMutex *mutex;
-    HevRingBuffer *buffer;
+    HevTCPBuffer buffer;
+    struct pbuf *unacked;
+    struct pbuf *unacked_tail;
+    size_t unacked_len;
+    size_t recv_held;
+    int recv_pbuf;
     int pcb_eof;
+    size_t pcb_dirty;
+
+    long adapt_time;
+    int adapt_size;
+    unsigned long long adapt_tx;
+    unsigned long long adapt_rx;
+
+    int zc_threshold;
+    unsigned int zc_id;
+    unsigned int zc_done;
+    unsigned int zc_head;
+    unsigned int zc_tail;
+    size_t zc_size;
+    HevSocks5SessionTCPSend zc_sends[HEV_SOCKS5_SESSION_TCP_SENDS];
 };
 
 struct _HevSocks5SessionTCPClass
@@ -44,6 +73,8 @@ struct _HevSocks5SessionTCPClass
 
 HevObjectClass *hev_socks5_session_tcp_class (void);
 
+void hev_socks5_session_tcp_fini (void);
+
 int hev_socks5_session_tcp_construct (HevSocks5SessionTCP *self,
                                       struct tcp_pcb *pcb, HevTaskMutex *mutex);
 
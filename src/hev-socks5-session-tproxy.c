@@ -0,0 +1,353 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-session-tproxy.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Socks5 Session Transparent TCP
+ ============================================================================
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include <hev-task.h>
+#include <hev-task-io.h>
+#include <hev-memory-allocator.h>
+#include <hev-socks5-misc.h>
+
+#include "hev-utils.h"
+#include "hev-config.h"
+#include "hev-logger.h"
+#include "hev-tproxy.h"
+#include "hev-mapped-dns.h"
+#include "hev-socks5-tunnel.h"
+
+#include "hev-socks5-session-tproxy.h"
+
+#define PIPE_SIZE (65536)
+
+static int
+task_io_yielder (HevTaskYieldType type, void *data)
+{
+    return hev_socks5_session_yielder (type, data);
+}
+
+static int
+tproxy_addr_from_sockaddr (HevSocks5Addr *addr, struct sockaddr_storage *saddr)
+{
+    struct sockaddr_in6 *sa6 = (struct sockaddr_in6 *)saddr;
+    struct sockaddr_in *sa4 = (struct sockaddr_in *)saddr;
+    HevMappedDNS *dns = hev_mapped_dns_get ();
+    const char *name = NULL;
+    const void *ip4;
+    uint32_t ip;
+    uint16_t port;
+
+    switch (saddr->ss_family) {
+    case AF_INET:
+        ip4 = &sa4->sin_addr;
+        port = sa4->sin_port;
+        break;
+    case AF_INET6:
+        if (!IN6_IS_ADDR_V4MAPPED (&sa6->sin6_addr)) {
+            hev_socks5_addr_from_ipv6 (addr, &sa6->sin6_addr, sa6->sin6_port);
+            return 0;
+        }
+        ip4 = &sa6->sin6_addr.s6_addr[12];
+        port = sa6->sin6_port;
+        break;
+    default:
+        return -1;
+    }
+
+    memcpy (&ip, ip4, sizeof (ip));
+    if (dns)
+        name = hev_mapped_dns_lookup (dns, ntohl (ip));
+    if (name)
+        hev_socks5_addr_from_name (addr, name, port);
+    else
+        hev_socks5_addr_from_ipv4 (addr, ip4, port);
+
+    return 0;
+}
+
+static int
+tproxy_pipe_open (HevSocks5SessionTProxyPipe *pipe)
+{
+    int size = hev_config_get_misc_tcp_buffer_size ();
+
+    if (pipe2 (pipe->fds, O_NONBLOCK | O_CLOEXEC) < 0)
+        return -1;
+
+    /* Ask for the tcp buffer size, the kernel rounds to pages. */
+    fcntl (pipe->fds[1], F_SETPIPE_SZ, size);
+    size = fcntl (pipe->fds[1], F_GETPIPE_SZ);
+    pipe->size = (size > 0) ? size : PIPE_SIZE;
+    pipe->pending = 0;
+    pipe->eof = 0;
+
+    return 0;
+}
+
+static void
+tproxy_pipe_close (HevSocks5SessionTProxyPipe *pipe)
+{
+    if (pipe->fds[0] >= 0)
+        close (pipe->fds[0]);
+    if (pipe->fds[1] >= 0)
+        close (pipe->fds[1]);
+    pipe->fds[0] = -1;
+    pipe->fds[1] = -1;
+}
+
+/*
+ * Move bytes from one socket to the other through a pipe, so they never
+ * leave the kernel. Data waiting in the pipe is written out before more
+ * is taken in, and the write side is shut once the read side is done.
+ */
+static int
+tproxy_relay (HevSocks5SessionTProxyPipe *pipe, int from, int to,
+              unsigned long long *bytes)
+{
+    int flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+    ssize_t s;
+    int res = 0;
+
+    if (!pipe->eof && (pipe->pending < pipe->size)) {
+        s = splice (from, NULL, pipe->fds[1], NULL, pipe->size - pipe->pending,
+                    flags);
+        if (s > 0) {
+            pipe->pending += s;
+            res = 1;
+        } else if (s == 0) {
+            pipe->eof = 1;
+        } else if (errno != EAGAIN) {
+            return -1;
+        }
+    }
+
+    if (pipe->pending) {
+        s = splice (pipe->fds[0], NULL, to, NULL, pipe->pending, flags);
+        if (s > 0) {
+            pipe->pending -= s;
+            *bytes += s;
+            res = 1;
+        } else if ((s < 0) && (errno != EAGAIN)) {
+            return -1;
+        }
+    }
+
+    if (pipe->eof && !pipe->pending) {
+        shutdown (to, SHUT_WR);
+        return -1;
+    }
+
+    return res;
+}
+
+HevSocks5SessionTProxy *
+hev_socks5_session_tproxy_new (int fd)
+{
+    HevSocks5SessionTProxy *self;
+    int res;
+
+    self = hev_malloc0 (sizeof (HevSocks5SessionTProxy));
+    if (!self)
+        return NULL;
+
+    res = hev_socks5_session_tproxy_construct (self, fd);
+    if (res < 0) {
+        hev_free (self);
+        return NULL;
+    }
+
+    LOG_D ("%p socks5 session tproxy new", self);
+
+    return self;
+}
+
+static int
+hev_socks5_session_tproxy_bind (HevSocks5 *self, int fd,
+                                const struct sockaddr *dest)
+{
+    HevConfigServer *srv;
+
+    LOG_D ("%p socks5 session tproxy bind", self);
+
+    srv = HEV_SOCKS5_SESSION_TPROXY (self)->data.upstream->srv;
+    if (srv->mark && (set_sock_mark (fd, srv->mark) < 0))
+        return -1;
+
+    return 0;
+}
+
+static void
+hev_socks5_session_tproxy_splice (HevSocks5Session *base)
+{
+    HevSocks5SessionTProxy *self = HEV_SOCKS5_SESSION_TPROXY (base);
+    int fd = HEV_SOCKS5 (self)->fd;
+    int res_f = 1;
+    int res_b = 1;
+
+    LOG_D ("%p socks5 session tproxy splice", self);
+
+    set_sock_profile (fd, &self->addr);
+
+    if ((tproxy_pipe_open (&self->pipe_f) < 0) ||
+        (tproxy_pipe_open (&self->pipe_b) < 0))
+        goto exit;
+
+    if (hev_task_add_fd (hev_task_self (), self->fd, POLLIN | POLLOUT) < 0)
+        goto exit;
+
+    for (;;) {
+        HevTaskYieldType type;
+
+        if (res_f >= 0)
+            res_f = tproxy_relay (&self->pipe_f, self->fd, fd,
+                                  &self->data.tx_bytes);
+        if (res_b >= 0)
+            res_b = tproxy_relay (&self->pipe_b, fd, self->fd,
+                                  &self->data.rx_bytes);
+
+        if (res_f > 0 || res_b > 0)
+            type = HEV_TASK_YIELD;
+        else if ((res_f & res_b) == 0)
+            type = HEV_TASK_WAITIO;
+        else
+            break;
+
+        if (task_io_yielder (type, base) < 0)
+            break;
+    }
+
+    hev_task_del_fd (hev_task_self (), self->fd);
+
+exit:
+    tproxy_pipe_close (&self->pipe_f);
+    tproxy_pipe_close (&self->pipe_b);
+}
+
+static HevTask *
+hev_socks5_session_tproxy_get_task (HevSocks5Session *base)
+{
+    HevSocks5SessionTProxy *self = HEV_SOCKS5_SESSION_TPROXY (base);
+
+    return self->data.task;
+}
+
+static void
+hev_socks5_session_tproxy_set_task (HevSocks5Session *base, HevTask *task)
+{
+    HevSocks5SessionTProxy *self = HEV_SOCKS5_SESSION_TPROXY (base);
+
+    self->data.task = task;
+}
+
+static HevListNode *
+hev_socks5_session_tproxy_get_node (HevSocks5Session *base)
+{
+    HevSocks5SessionTProxy *self = HEV_SOCKS5_SESSION_TPROXY (base);
+
+    return &self->data.node;
+}
+
+int
+hev_socks5_session_tproxy_construct (HevSocks5SessionTProxy *self, int fd)
+{
+    struct sockaddr_storage saddr;
+    socklen_t saddr_len = sizeof (saddr);
+    int res;
+
+    res = hev_tproxy_get_original_dst (fd, &saddr, &saddr_len);
+    if (res < 0)
+        return -1;
+
+    res = tproxy_addr_from_sockaddr (&self->addr, &saddr);
+    if (res < 0)
+        return -1;
+
+    res = hev_socks5_client_tcp_construct (&self->base, &self->addr);
+    if (res < 0)
+        return -1;
+
+    /* Balance by destination host, whatever the port. */
+    self->data.hash = hev_socks5_upstream_hash (
+        &self->addr, hev_socks5_addr_len (&self->addr) - 2);
+
+    LOG_D ("%p socks5 session tproxy construct", self);
+
+    HEV_OBJECT (self)->klass = HEV_SOCKS5_SESSION_TPROXY_TYPE;
+
+    self->fd = fd;
+    self->pipe_f.fds[0] = -1;
+    self->pipe_f.fds[1] = -1;
+    self->pipe_b.fds[0] = -1;
+    self->pipe_b.fds[1] = -1;
+    self->data.self = self;
+
+    return 0;
+}
+
+void
+hev_socks5_session_tproxy_destruct (HevObject *base)
+{
+    HevSocks5SessionTProxy *self = HEV_SOCKS5_SESSION_TPROXY (base);
+
+    LOG_D ("%p socks5 session tproxy destruct", self);
+
+    close (self->fd);
+
+    HEV_SOCKS5_CLIENT_TCP_TYPE->destruct (base);
+}
+
+static void *
+hev_socks5_session_tproxy_iface (HevObject *base, void *type)
+{
+    if (type == HEV_SOCKS5_SESSION_TYPE) {
+        HevSocks5SessionTProxyClass *klass = HEV_OBJECT_GET_CLASS (base);
+        return &klass->session;
+    }
+
+    return HEV_SOCKS5_CLIENT_TCP_TYPE->iface (base, type);
+}
+
+HevObjectClass *
+hev_socks5_session_tproxy_class (void)
+{
+    static HevSocks5SessionTProxyClass klass;
+    HevSocks5SessionTProxyClass *kptr = &klass;
+    HevObjectClass *okptr = HEV_OBJECT_CLASS (kptr);
+
+    if (!okptr->name) {
+        HevSocks5Class *skptr;
+        HevSocks5SessionIface *siptr;
+        void *ptr;
+
+        ptr = HEV_SOCKS5_CLIENT_TCP_TYPE;
+        memcpy (kptr, ptr, sizeof (HevSocks5ClientTCPClass));
+
+        okptr->name = "HevSocks5SessionTProxy";
+        okptr->destruct = hev_socks5_session_tproxy_destruct;
+        okptr->iface = hev_socks5_session_tproxy_iface;
+
+        skptr = HEV_SOCKS5_CLASS (kptr);
+        skptr->binder = hev_socks5_session_tproxy_bind;
+
+        siptr = &kptr->session;
+        siptr->splicer = hev_socks5_session_tproxy_splice;
+        siptr->get_task = hev_socks5_session_tproxy_get_task;
+        siptr->set_task = hev_socks5_session_tproxy_set_task;
+        siptr->get_node = hev_socks5_session_tproxy_get_node;
+    }
+
+    return okptr;
+}
@@ -0,0 +1,70 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-session-tproxy.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Socks5 Session Transparent TCP
+ ============================================================================
+ */
+
+#ifndef __HEV_SOCKS5_SESSION_TPROXY_H__
+#define __HEV_SOCKS5_SESSION_TPROXY_H__
+
+#include <stddef.h>
+
+#include <hev-socks5-client-tcp.h>
+
+#include "hev-socks5-session.h"
+
+#define HEV_SOCKS5_SESSION_TPROXY(p) ((HevSocks5SessionTProxy *)p)
+#define HEV_SOCKS5_SESSION_TPROXY_CLASS(p) ((HevSocks5SessionTProxyClass *)p)
+#define HEV_SOCKS5_SESSION_TPROXY_TYPE (hev_socks5_session_tproxy_class ())
+
+typedef struct _HevSocks5SessionTProxy HevSocks5SessionTProxy;
+typedef struct _HevSocks5SessionTProxyClass HevSocks5SessionTProxyClass;
+typedef struct _HevSocks5SessionTProxyPipe HevSocks5SessionTProxyPipe;
+
+struct _HevSocks5SessionTProxyPipe
+{
+    int fds[2];
+    size_t size;
+    size_t pending;
+    int eof;
+};
+
+struct _HevSocks5SessionTProxy
+{
+    HevSocks5ClientTCP base;
+
+    HevSocks5SessionData data;
+    HevSocks5Addr addr;
+
+    int fd;
+    HevSocks5SessionTProxyPipe pipe_f;
+    HevSocks5SessionTProxyPipe pipe_b;
+};
+
+struct _HevSocks5SessionTProxyClass
+{
+    HevSocks5ClientTCPClass base;
+
+    HevSocks5SessionIface session;
+};
+
+HevObjectClass *hev_socks5_session_tproxy_class (void);
+
+int hev_socks5_session_tproxy_construct (HevSocks5SessionTProxy *self, int fd);
+
+/**
+ * hev_socks5_session_tproxy_new:
+ * @fd: connection accepted from the kernel, non-blocking
+ *
+ * Create a session that connects the original destination of @fd through
+ * the socks5 server and relays with splice(). The session owns @fd once
+ * created, the caller closes it on failure.
+ *
+ * Returns: new session instance
+ */
+HevSocks5SessionTProxy *hev_socks5_session_tproxy_new (int fd);
+
+#endif /* __HEV_SOCKS5_SESSION_TPROXY_H__ */
@@ -8,6 +8,7 @@
  */
 
 #include <errno.h>
+#include <netdb.h>
 #include <string.h>
 
 #include <lwip/udp.h>
@@ -24,12 +25,21 @@
 #include "hev-config.h"
 #include "hev-logger.h"
 #include "hev-compiler.h"
+#include "hev-dns-cache.h"
+#include "hev-slab.h"
+#include "hev-udp-slab.h"
 #include "hev-config-const.h"
+#include "hev-socks5-proxy.h"
 #include "hev-socks5-tunnel.h"
+#include "hev-socks5-udp-mux.h"
 
 #include "hev-socks5-session-udp.h"
 
+#define SOURCE_BUCKETS (1024)
+#define SHRINK_READS (64)
+
 typedef struct _HevSocks5UDPFrame HevSocks5UDPFrame;
+typedef struct _HevSocks5UDPFlow HevSocks5UDPFlow;
 
 struct _HevSocks5UDPFrame
 {
@@ -38,12 +48,70 @@ struct _HevSocks5UDPFrame
     struct pbuf *data;
 };
 
+struct _HevSocks5UDPFlow
+{
+    HevListNode node;
+    HevSocks5SessionUDP *session;
+    struct udp_pcb *pcb;
+};
+
+/* Shared associations by client source endpoint, under the lwIP mutex. */
+static HevSocks5SessionUDP *sources[SOURCE_BUCKETS];
+
+static HevSlab *frame_slab;
+static HevSlab *flow_slab;
+
+static unsigned int
+source_hash (struct udp_pcb *pcb)
+{
+    unsigned int hash;
+
+    if (IP_IS_V4 (&pcb->remote_ip))
+        hash = hev_socks5_upstream_hash (ip_2_ip4 (&pcb->remote_ip), 4);
+    else
+        hash = hev_socks5_upstream_hash (ip_2_ip6 (&pcb->remote_ip), 16);
+
+    return (hash ^ pcb->remote_port) % SOURCE_BUCKETS;
+}
+
+static void
+source_remove (HevSocks5SessionUDP *self)
+{
+    HevSocks5SessionUDP **prev;
+
+    if (!self->shared)
+        return;
+
+    for (prev = &sources[self->source]; *prev; prev = &(*prev)->source_next) {
+        if (*prev == self) {
+            *prev = self->source_next;
+            break;
+        }
+    }
+
+    self->shared = 0;
+}
+
+HevSocks5SessionUDP *
+hev_socks5_session_udp_find (struct udp_pcb *pcb)
+{
+    HevSocks5SessionUDP *self;
+
+    for (self = sources[source_hash (pcb)]; self; self = self->source_next) {
+        struct udp_pcb *spcb = self->pcb;
+
+        if ((spcb->remote_port == pcb->remote_port) &&
+            ip_addr_cmp (&spcb->remote_ip, &pcb->remote_ip))
+            return self;
+    }
+
+    return NULL;
+}
+
 static int
 task_io_yielder (HevTaskYieldType type, void *data)
 {
     HevSocks5 *self = data;
-    HevListNode *node;
-    int res;
 
     if (self->type == HEV_SOCKS5_TYPE_UDP_IN_UDP) {
         ssize_t res;
@@ -56,11 +124,7 @@ task_io_yielder (HevTaskYieldType type, void *data)
         }
     }
 
-    res = hev_socks5_task_io_yielder (type, data);
-    node = hev_socks5_session_get_node (HEV_SOCKS5_SESSION (self));
-    hev_socks5_tunnel_update_session (node);
-
-    return res;
+    return hev_socks5_session_yielder (type, data);
 }
 
 static int
@@ -100,7 +164,8 @@ hev_socks5_session_udp_fwd_f (HevSocks5SessionUDP *self, unsigned int num)
         buf = frame->data;
 
         hev_list_del (&self->frame_list, node);
-        hev_free (frame);
+        self->data.tx_bytes += buf->len;
+        hev_slab_free (frame_slab, frame);
         pbuf_free (buf);
         self->frames--;
     }
@@ -109,18 +174,124 @@ hev_socks5_session_udp_fwd_f (HevSocks5SessionUDP *self, unsigned int num)
 }
 
 static int
-hev_socks5_session_udp_fwd_b (HevSocks5SessionUDP *self, unsigned int num)
+hev_socks5_session_udp_dns_store (HevSocks5SessionUDP *self, void *buf,
+                                  size_t len)
 {
-    char buf[UDP_BUF_SIZE * num];
-    HevSocks5UDPMsg msgv[num];
+    HevDNSCache *cache = hev_dns_cache_get ();
+
+    if (!cache)
+        return 0;
+
+    hev_dns_cache_store (cache, buf, len);
+    if (self->dns_refresh && (len >= 2) &&
+        (memcmp (&self->dns_refresh_id, buf, 2) == 0)) {
+        self->dns_refresh = 0;
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Hand a datagram from @addr to the client, called with the lwIP mutex
+ * held. Returns -1 on error.
+ */
+static int
+hev_socks5_session_udp_reply (HevSocks5SessionUDP *self,
+                              const HevSocks5Addr *addr, void *buf, int len)
+{
+    ip_addr_t saddr;
+    struct pbuf *b;
+    uint16_t port;
+    err_t err;
+
+    if (self->addr && self->port) {
+        ip_2_ip4 (&saddr)->addr = self->addr;
+        port = self->port;
+    } else if (hev_socks5_addr_into_lwip (addr, &saddr, &port) < 0) {
+        LOG_D ("%p socks5 session udp reply addr", self);
+        return -1;
+    }
+
+    /* Prefetch answers only refresh the cache, the client has one. */
+    if ((port == 53) && hev_socks5_session_udp_dns_store (self, buf, len))
+        return 0;
+
+    b = pbuf_alloc_reference (buf, len, PBUF_REF);
+    if (!b) {
+        LOG_D ("%p socks5 session udp reply buf", self);
+        return -1;
+    }
+
+    err = udp_sendfrom (self->pcb, b, &saddr, port);
+    pbuf_free (b);
+    if (err != ERR_OK) {
+        LOG_D ("%p socks5 session udp reply send", self);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+hev_socks5_session_udp_bufs_grow (HevSocks5SessionUDP *self, int num)
+{
+    if (num > self->bufs_max)
+        num = self->bufs_max;
+
+    while (self->bufs_num < num) {
+        void *slot = hev_udp_slab_alloc ();
+
+        if (!slot)
+            break;
+        self->bufs[self->bufs_num++] = slot;
+    }
+
+    return self->bufs_num;
+}
+
+static void
+hev_socks5_session_udp_bufs_shrink (HevSocks5SessionUDP *self, int num)
+{
+    while (self->bufs_num > num)
+        hev_udp_slab_free (self->bufs[--self->bufs_num]);
+}
+
+/*
+ * Follow the burst size: double the slots when a read fills them all and
+ * halve them after a run of reads that used less than half.
+ */
+static void
+hev_socks5_session_udp_bufs_adapt (HevSocks5SessionUDP *self, int res)
+{
+    if (res == self->bufs_num) {
+        hev_socks5_session_udp_bufs_grow (self, self->bufs_num * 2);
+        self->bufs_idle = 0;
+        return;
+    }
+
+    if (((res * 2) >= self->bufs_num) || (++self->bufs_idle < SHRINK_READS))
+        return;
+
+    self->bufs_idle = 0;
+    if (self->bufs_num > 1)
+        hev_socks5_session_udp_bufs_shrink (self, self->bufs_num / 2);
+}
+
+static int
+hev_socks5_session_udp_fwd_b (HevSocks5SessionUDP *self)
+{
+    HevSocks5UDPMsg msgv[self->bufs_num];
+    int size = hev_udp_slab_size ();
     int i, res;
 
-    for (i = 0; i < num; i++) {
-        msgv[i].buf = buf + UDP_BUF_SIZE * i;
-        msgv[i].len = UDP_BUF_SIZE;
+    for (i = 0; i < self->bufs_num; i++) {
+        msgv[i].buf = self->bufs[i];
+        msgv[i].len = size;
     }
 
-    res = hev_socks5_udp_recvmmsg (HEV_SOCKS5_UDP (self), msgv, num, 1);
+    res = hev_socks5_udp_recvmmsg (HEV_SOCKS5_UDP (self), msgv,
+                                   self->bufs_num, 1);
     if (res <= 0) {
         if (res == -1 && errno == EAGAIN)
             return 0;
@@ -128,62 +299,143 @@ hev_socks5_session_udp_fwd_b (HevSocks5SessionUDP *self, unsigned int num)
         return -1;
     }
 
+    hev_socks5_session_udp_bufs_adapt (self, res);
+
     for (i = 0; i < res; i++) {
-        ip_addr_t saddr;
-        struct pbuf *b;
-        uint16_t port;
-        err_t err;
         int ret;
 
-        if (self->addr && self->port) {
-            ip_2_ip4 (&saddr)->addr = self->addr;
-            port = self->port;
-        } else {
-            ret = hev_socks5_addr_into_lwip (msgv[i].addr, &saddr, &port);
-            if (ret < 0) {
-                LOG_D ("%p socks5 session udp fwd b addr", self);
-                return -1;
-            }
-        }
-
-        b = pbuf_alloc_reference (msgv[i].buf, msgv[i].len, PBUF_REF);
-        if (!b) {
-            LOG_D ("%p socks5 session udp fwd b buf", self);
-            return -1;
-        }
+        self->data.rx_bytes += msgv[i].len;
 
         hev_task_mutex_lock (self->mutex);
-        err = udp_sendfrom (self->pcb, b, &saddr, port);
+        ret = hev_socks5_session_udp_reply (self, msgv[i].addr, msgv[i].buf,
+                                            msgv[i].len);
         hev_task_mutex_unlock (self->mutex);
-
-        pbuf_free (b);
-        if (err != ERR_OK) {
-            LOG_D ("%p socks5 session udp fwd b send", self);
+        if (ret < 0)
             return -1;
-        }
     }
 
     return 1;
 }
 
+static int
+hev_socks5_session_udp_fwd_f_mux (HevSocks5SessionUDP *self)
+{
+    HevSocks5UDPFrame *frame;
+    HevListNode *node;
+    struct pbuf *buf;
+    int res = 0;
+
+    while ((node = hev_list_first (&self->frame_list))) {
+        frame = container_of (node, HevSocks5UDPFrame, node);
+        buf = frame->data;
+
+        if (hev_socks5_udp_mux_send (&self->mux, &frame->addr, buf->payload,
+                                     buf->len) == 0)
+            self->data.tx_bytes += buf->len;
+
+        hev_list_del (&self->frame_list, node);
+        hev_slab_free (frame_slab, frame);
+        pbuf_free (buf);
+        self->frames--;
+        res = 1;
+    }
+
+    return res;
+}
+
+static void
+hev_socks5_session_udp_mux_handler (HevSocks5UDPMuxEntry *entry, void *buf,
+                                    int len)
+{
+    HevSocks5SessionUDP *self;
+    HevSocks5Addr *addr;
+    uint8_t *p = buf;
+    int alen;
+
+    self = container_of (entry, HevSocks5SessionUDP, mux);
+
+    /* Fragments are not supported, as with the per-session sockets. */
+    if ((len < 5) || p[2])
+        return;
+
+    addr = (HevSocks5Addr *)&p[3];
+    switch (addr->atype) {
+    case HEV_SOCKS5_ADDR_TYPE_IPV4:
+        alen = 1 + 4 + 2;
+        break;
+    case HEV_SOCKS5_ADDR_TYPE_IPV6:
+        alen = 1 + 16 + 2;
+        break;
+    case HEV_SOCKS5_ADDR_TYPE_NAME:
+        alen = 1 + 1 + p[4] + 2;
+        break;
+    default:
+        return;
+    }
+    if ((3 + alen) > len)
+        return;
+
+    self->data.rx_bytes += len - 3 - alen;
+    hev_socks5_session_udp_reply (self, addr, &p[3 + alen], len - 3 - alen);
+    hev_task_wakeup (self->data.task);
+}
+
+static void
+hev_socks5_session_udp_drop (HevSocks5SessionUDP *self,
+                             HevSocks5UDPFlow *flow)
+{
+    HevListNode *node;
+
+    /* Replies leave through the primary flow, hand that role on. */
+    if (flow->pcb == self->pcb) {
+        node = hev_list_first (&self->flow_list);
+        if (node == &flow->node)
+            node = hev_list_node_next (node);
+        if (!node) {
+            hev_socks5_session_terminate (HEV_SOCKS5_SESSION (self));
+            return;
+        }
+        self->pcb = container_of (node, HevSocks5UDPFlow, node)->pcb;
+    }
+
+    hev_list_del (&self->flow_list, &flow->node);
+    udp_recv (flow->pcb, NULL, NULL);
+    udp_remove (flow->pcb);
+    hev_slab_free (flow_slab, flow);
+    self->flows--;
+}
+
 static void
 udp_recv_handler (void *arg, struct udp_pcb *pcb, struct pbuf *p,
                   const ip_addr_t *addr, u16_t port)
 {
-    HevSocks5SessionUDP *self = arg;
+    HevSocks5UDPFlow *flow = arg;
+    HevSocks5SessionUDP *self = flow->session;
     HevSocks5UDPFrame *frame;
+    HevDNSCache *cache;
+    int refresh;
 
     if (!p) {
-        hev_socks5_session_terminate (HEV_SOCKS5_SESSION (self));
+        hev_socks5_session_udp_drop (self, flow);
         return;
     }
 
+    cache = hev_dns_cache_get ();
+    if (cache && (hev_dns_cache_reply (cache, pcb, p, &refresh) > 0)) {
+        if (!refresh) {
+            pbuf_free (p);
+            return;
+        }
+        self->dns_refresh = 1;
+        memcpy (&self->dns_refresh_id, p->payload, 2);
+    }
+
     if (self->frames > UDP_POOL_SIZE) {
         pbuf_free (p);
         return;
     }
 
-    frame = hev_malloc (sizeof (HevSocks5UDPFrame));
+    frame = hev_slab_alloc (frame_slab);
     if (!frame) {
         pbuf_free (p);
         return;
@@ -203,6 +455,37 @@ udp_recv_handler (void *arg, struct udp_pcb *pcb, struct pbuf *p,
     hev_task_wakeup (self->data.task);
 }
 
+int
+hev_socks5_session_udp_init (void)
+{
+    frame_slab = hev_slab_new ("udp frame", sizeof (HevSocks5UDPFrame));
+    if (!frame_slab)
+        return -1;
+
+    flow_slab = hev_slab_new ("udp flow", sizeof (HevSocks5UDPFlow));
+    if (!flow_slab) {
+        hev_slab_destroy (frame_slab);
+        frame_slab = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+hev_socks5_session_udp_fini (void)
+{
+    if (flow_slab) {
+        hev_slab_destroy (flow_slab);
+        flow_slab = NULL;
+    }
+
+    if (frame_slab) {
+        hev_slab_destroy (frame_slab);
+        frame_slab = NULL;
+    }
+}
+
 HevSocks5SessionUDP *
 hev_socks5_session_udp_new (struct udp_pcb *pcb, HevTaskMutex *mutex)
 {
@@ -233,7 +516,7 @@ hev_socks5_session_udp_bind (HevSocks5 *self, int fd,
 
     LOG_D ("%p socks5 session udp bind", self);
 
-    srv = hev_config_get_socks5_server ();
+    srv = HEV_SOCKS5_SESSION_UDP (self)->data.upstream->srv;
     mark = srv->mark;
 
     if (mark) {
@@ -247,39 +530,178 @@ hev_socks5_session_udp_bind (HevSocks5 *self, int fd,
     return 0;
 }
 
-static uint16_t
-hev_socks5_addr_get_port (const HevSocks5Addr *addr)
+static int
+hev_socks5_session_udp_set_upstream_addr (HevSocks5Client *base,
+                                          HevSocks5Addr *addr)
+{
+    HevSocks5SessionUDP *self = HEV_SOCKS5_SESSION_UDP (base);
+    HevConfigServer *srv = self->data.upstream->srv;
+    HevSocks5ClientClass *ckptr;
+
+    if (srv->udp_in_udp && srv->udp_addr[0]) {
+        uint16_t port = htons (hev_socks5_addr_get_port (addr));
+        hev_socks5_addr_from_name (addr, srv->udp_addr, port);
+    }
+
+    ckptr = HEV_SOCKS5_CLIENT_CLASS (HEV_SOCKS5_CLIENT_UDP_TYPE);
+    return ckptr->set_upstream_addr (base, addr);
+}
+
+/*
+ * Find where datagrams for the association go: the bound address from the
+ * reply, the server itself when that is unspecified, or udp-address.
+ */
+static int
+hev_socks5_session_udp_relay (HevSocks5SessionUDP *self,
+                              const HevSocks5Addr *bind)
 {
+    HevConfigServer *srv = self->data.upstream->srv;
+    struct sockaddr_storage *relay = &self->mux.relay;
+    char name[256] = { 0 };
     uint16_t port = 0;
 
-    switch (addr->atype) {
-    case HEV_SOCKS5_ADDR_TYPE_IPV4:
-        port = addr->ipv4.port;
+    switch (bind->atype) {
+    case HEV_SOCKS5_ADDR_TYPE_IPV4: {
+        struct sockaddr_in *sa = (struct sockaddr_in *)relay;
+        static const uint8_t any[4];
+
+        port = bind->ipv4.port;
+        if (memcmp (bind->ipv4.addr, any, 4) == 0)
+            break;
+        sa->sin_family = AF_INET;
+        sa->sin_port = port;
+        memcpy (&sa->sin_addr, bind->ipv4.addr, 4);
+        self->mux.relay_len = sizeof (struct sockaddr_in);
         break;
-    case HEV_SOCKS5_ADDR_TYPE_IPV6:
-        port = addr->ipv6.port;
+    }
+    case HEV_SOCKS5_ADDR_TYPE_IPV6: {
+        struct sockaddr_in6 *sa = (struct sockaddr_in6 *)relay;
+        static const uint8_t any[16];
+
+        port = bind->ipv6.port;
+        if (memcmp (bind->ipv6.addr, any, 16) == 0)
+            break;
+        sa->sin6_family = AF_INET6;
+        sa->sin6_port = port;
+        memcpy (&sa->sin6_addr, bind->ipv6.addr, 16);
+        self->mux.relay_len = sizeof (struct sockaddr_in6);
         break;
+    }
     case HEV_SOCKS5_ADDR_TYPE_NAME:
-        memcpy (&port, addr->domain.addr + addr->domain.len, 2);
+        memcpy (&port, &bind->domain.addr[bind->domain.len], 2);
+        memcpy (name, bind->domain.addr, bind->domain.len);
+        break;
+    default:
+        return -1;
     }
 
-    return port;
+    if (srv->udp_addr[0])
+        memcpy (name, srv->udp_addr, sizeof (name));
+
+    if (name[0]) {
+        struct addrinfo hints = { 0 };
+        struct addrinfo *result;
+
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_DGRAM;
+        if (getaddrinfo (name, NULL, &hints, &result) != 0)
+            return -1;
+        memcpy (relay, result->ai_addr, result->ai_addrlen);
+        self->mux.relay_len = result->ai_addrlen;
+        freeaddrinfo (result);
+    } else if (!self->mux.relay_len) {
+        self->mux.relay_len = sizeof (struct sockaddr_storage);
+        if (getpeername (HEV_SOCKS5 (self)->fd, (struct sockaddr *)relay,
+                         &self->mux.relay_len) < 0)
+            return -1;
+    }
+
+    if (relay->ss_family == AF_INET6)
+        ((struct sockaddr_in6 *)relay)->sin6_port = port;
+    else
+        ((struct sockaddr_in *)relay)->sin_port = port;
+
+    return 0;
 }
 
+/*
+ * UDP ASSOCIATE without a socket of our own: the datagrams go through the
+ * shared sockets, which tell associations apart by their relay address.
+ * A relay already taken falls back to a socket of our own.
+ */
 static int
-hev_socks5_session_udp_set_upstream_addr (HevSocks5Client *base,
-                                          HevSocks5Addr *addr)
+hev_socks5_session_udp_handshake (HevSocks5Session *base)
 {
-    HevConfigServer *srv = hev_config_get_socks5_server ();
+    HevSocks5SessionUDP *self = HEV_SOCKS5_SESSION_UDP (base);
+    HevConfigServer *srv = self->data.upstream->srv;
+    uint8_t buf[HEV_SOCKS5_PROXY_BUF_SIZE];
     HevSocks5ClientClass *ckptr;
+    HevSocks5Addr addr = { 0 };
+    HevSocks5Addr bind;
+    int len;
 
-    if (srv->udp_in_udp && srv->udp_addr[0]) {
-        uint16_t port = hev_socks5_addr_get_port (addr);
-        hev_socks5_addr_from_name (addr, srv->udp_addr, port);
+    LOG_D ("%p socks5 session udp handshake", self);
+
+    addr.atype = HEV_SOCKS5_ADDR_TYPE_IPV4;
+
+    len = hev_socks5_proxy_encode_greeting (srv, buf);
+    len += hev_socks5_proxy_encode_auth (srv, buf + len);
+    len += hev_socks5_proxy_encode_request (
+        HEV_SOCKS5_PROXY_CMD_UDP_ASSOCIATE, &addr, buf + len);
+    if (hev_socks5_session_send (self, buf, len) < 0)
+        return -1;
+
+    if (hev_socks5_session_recv (self, buf, 2) < 0)
+        return -1;
+    if (hev_socks5_proxy_decode_greeting (srv, buf, 2) < 0)
+        return -1;
+
+    if (srv->user && srv->pass) {
+        if (hev_socks5_session_recv (self, buf, 2) < 0)
+            return -1;
+        if (hev_socks5_proxy_decode_auth (srv, buf, 2) < 0)
+            return -1;
     }
 
-    ckptr = HEV_SOCKS5_CLIENT_CLASS (HEV_SOCKS5_CLIENT_UDP_TYPE);
-    return ckptr->set_upstream_addr (base, addr);
+    if (hev_socks5_session_recv (self, buf, 5) < 0)
+        return -1;
+    len = hev_socks5_proxy_reply_len (buf, 5);
+    if ((len > 5) && (hev_socks5_session_recv (self, buf + 5, len - 5) < 0))
+        return -1;
+    if ((len < 0) || (hev_socks5_proxy_decode_reply (buf, len, &bind) <= 0))
+        return -1;
+
+    if (hev_socks5_session_udp_relay (self, &bind) < 0) {
+        LOG_D ("%p socks5 session udp relay", self);
+        return -1;
+    }
+
+    self->mux.handler = hev_socks5_session_udp_mux_handler;
+    self->mux.srv = srv;
+    if (hev_socks5_udp_mux_add (&self->mux) == 0)
+        return 0;
+
+    /* Not muxed: the relay is taken or the server has no shared sockets. */
+    LOG_D ("%p socks5 session udp private socket", self);
+    ckptr = HEV_OBJECT_GET_CLASS (self);
+    return ckptr->set_upstream_addr (HEV_SOCKS5_CLIENT (self), &bind);
+}
+
+static void
+hev_socks5_session_udp_splice_mux (HevSocks5SessionUDP *self)
+{
+    for (;;) {
+        HevTaskYieldType type;
+        int res;
+
+        res = hev_socks5_session_udp_fwd_f_mux (self);
+        type = (res > 0) ? HEV_TASK_YIELD : HEV_TASK_WAITIO;
+
+        if (task_io_yielder (type, self))
+            break;
+    }
+
+    hev_socks5_udp_mux_del (&self->mux);
 }
 
 static void
@@ -293,7 +715,19 @@ hev_socks5_session_udp_splice (HevSocks5Session *base)
 
     LOG_D ("%p socks5 session udp splice", self);
 
+    if (self->mux.added) {
+        hev_socks5_session_udp_splice_mux (self);
+        return;
+    }
+
     num = hev_config_get_misc_udp_copy_buffer_nums ();
+    self->bufs = hev_malloc (sizeof (void *) * num);
+    if (!self->bufs)
+        return;
+    self->bufs_max = num;
+    if (hev_socks5_session_udp_bufs_grow (self, 1) < 1)
+        goto exit;
+
     fd = hev_socks5_udp_get_fd (HEV_SOCKS5_UDP (self));
     if (hev_task_mod_fd (task, fd, POLLIN | POLLOUT) < 0)
         hev_task_add_fd (task, fd, POLLIN | POLLOUT);
@@ -304,7 +738,7 @@ hev_socks5_session_udp_splice (HevSocks5Session *base)
         if (res_f >= 0)
             res_f = hev_socks5_session_udp_fwd_f (self, num);
         if (res_b >= 0)
-            res_b = hev_socks5_session_udp_fwd_b (self, num);
+            res_b = hev_socks5_session_udp_fwd_b (self);
 
         if (res_f > 0 || res_b > 0)
             type = HEV_TASK_YIELD;
@@ -316,6 +750,11 @@ hev_socks5_session_udp_splice (HevSocks5Session *base)
         if (task_io_yielder (type, self))
             break;
     }
+
+exit:
+    hev_socks5_session_udp_bufs_shrink (self, 0);
+    hev_free (self->bufs);
+    self->bufs = NULL;
 }
 
 static HevTask *
@@ -342,33 +781,95 @@ hev_socks5_session_udp_get_node (HevSocks5Session *base)
     return &self->data.node;
 }
 
+static void
+hev_socks5_session_udp_add_flow (HevSocks5SessionUDP *self,
+                                 HevSocks5UDPFlow *flow, struct udp_pcb *pcb)
+{
+    flow->session = self;
+    flow->pcb = pcb;
+    hev_list_add_tail (&self->flow_list, &flow->node);
+    self->flows++;
+    udp_recv (pcb, udp_recv_handler, flow);
+}
+
+int
+hev_socks5_session_udp_add (HevSocks5SessionUDP *self, struct udp_pcb *pcb)
+{
+    HevSocks5UDPFlow *flow;
+    HevSocks5Addr addr;
+
+    /* Replies to mapped names are rewritten to the one name they asked. */
+    if (hev_socks5_addr_from_lwip (&addr, &pcb->local_ip, 0) < 0)
+        return -1;
+    if ((addr.atype == HEV_SOCKS5_ADDR_TYPE_NAME) || self->addr)
+        return -1;
+
+    if (self->flows >= UDP_POOL_SIZE)
+        return -1;
+
+    flow = hev_slab_alloc (flow_slab);
+    if (!flow)
+        return -1;
+    memset (flow, 0, sizeof (HevSocks5UDPFlow));
+
+    hev_socks5_session_udp_add_flow (self, flow, pcb);
+    LOG_D ("%p socks5 session udp add %d", self, self->flows);
+
+    return 0;
+}
+
 int
 hev_socks5_session_udp_construct (HevSocks5SessionUDP *self,
                                   struct udp_pcb *pcb, HevTaskMutex *mutex)
 {
     HevConfigServer *srv = hev_config_get_socks5_server ();
+    HevSocks5UDPFlow *flow;
+    HevSocks5Addr addr;
     int type;
     int res;
 
+    flow = hev_slab_alloc (flow_slab);
+    if (!flow)
+        return -1;
+    memset (flow, 0, sizeof (HevSocks5UDPFlow));
+
     if (srv->udp_in_udp)
         type = HEV_SOCKS5_TYPE_UDP_IN_UDP;
     else
         type = HEV_SOCKS5_TYPE_UDP_IN_TCP;
 
     res = hev_socks5_client_udp_construct (&self->base, type);
-    if (res < 0)
+    if (res < 0) {
+        hev_slab_free (flow_slab, flow);
         return -1;
+    }
 
     LOG_D ("%p socks5 session udp construct", self);
 
     HEV_OBJECT (self)->klass = HEV_SOCKS5_SESSION_UDP_TYPE;
 
-    udp_recv (pcb, udp_recv_handler, self);
+    hev_socks5_session_udp_add_flow (self, flow, pcb);
+
+    /* Balance by the first destination host. */
+    res = hev_socks5_addr_from_lwip (&addr, &pcb->local_ip, 0);
+    if (res == 0)
+        self->data.hash =
+            hev_socks5_upstream_hash (&addr, hev_socks5_addr_len (&addr) - 2);
 
     self->pcb = pcb;
     self->mutex = mutex;
     self->data.self = self;
 
+    /* Later flows from the same source port join this association. */
+    if ((res == 0) && (addr.atype != HEV_SOCKS5_ADDR_TYPE_NAME) &&
+        hev_config_get_misc_udp_share_association () &&
+        !hev_socks5_session_udp_find (pcb)) {
+        self->source = source_hash (pcb);
+        self->source_next = sources[self->source];
+        sources[self->source] = self;
+        self->shared = 1;
+    }
+
     return 0;
 }
 
@@ -380,6 +881,8 @@ hev_socks5_session_udp_destruct (HevObject *base)
 
     LOG_D ("%p socks5 session udp destruct", self);
 
+    hev_socks5_udp_mux_del (&self->mux);
+
     node = hev_list_first (&self->frame_list);
     while (node) {
         HevSocks5UDPFrame *frame;
@@ -387,13 +890,20 @@ hev_socks5_session_udp_destruct (HevObject *base)
         frame = container_of (node, HevSocks5UDPFrame, node);
         node = hev_list_node_next (node);
         pbuf_free (frame->data);
-        hev_free (frame);
+        hev_slab_free (frame_slab, frame);
     }
 
     hev_task_mutex_lock (self->mutex);
-    if (self->pcb) {
-        udp_recv (self->pcb, NULL, NULL);
-        udp_remove (self->pcb);
+    source_remove (self);
+    node = hev_list_first (&self->flow_list);
+    while (node) {
+        HevSocks5UDPFlow *flow;
+
+        flow = container_of (node, HevSocks5UDPFlow, node);
+        node = hev_list_node_next (node);
+        udp_recv (flow->pcb, NULL, NULL);
+        udp_remove (flow->pcb);
+        hev_slab_free (flow_slab, flow);
     }
     hev_task_mutex_unlock (self->mutex);
 
@@ -442,6 +952,8 @@ hev_socks5_session_udp_class (void)
         siptr->get_task = hev_socks5_session_udp_get_task;
         siptr->set_task = hev_socks5_session_udp_set_task;
         siptr->get_node = hev_socks5_session_udp_get_node;
+        if (hev_socks5_udp_mux_enabled ())
+            siptr->handshake = hev_socks5_session_udp_handshake;
     }
 
     return okptr;
@@ -13,6 +13,7 @@
 #include <hev-socks5-client-udp.h>
 
 #include "hev-socks5-session.h"
+#include "hev-socks5-udp-mux.h"
 
 #define HEV_SOCKS5_SESSION_UDP(p) ((HevSocks5SessionUDP *)p)
 #define HEV_SOCKS5_SESSION_UDP_CLASS(p) ((HevSocks5SessionUDPClass *)p)
@@ -26,13 +27,25 @@ struct _HevSocks5SessionUDP
     HevSocks5ClientUDP base;
 
     HevSocks5SessionData data;
+    HevSocks5UDPMuxEntry mux;
 
     HevList frame_list;
+    HevList flow_list;
     struct udp_pcb *pcb;
     HevTaskMutex *mutex;
+    HevSocks5SessionUDP *source_next;
+    unsigned int source;
+    int shared;
+    int flows;
     int frames;
+    int bufs_num;
+    int bufs_max;
+    int bufs_idle;
+    void **bufs;
     int addr;
     int port;
+    int dns_refresh;
+    unsigned short dns_refresh_id;
 };
 
 struct _HevSocks5SessionUDPClass
@@ -44,10 +57,26 @@ struct _HevSocks5SessionUDPClass
 
 HevObjectClass *hev_socks5_session_udp_class (void);
 
+/*
+ * Frames and flows come from per-thread slab caches set up here, so the
+ * per-datagram path does not go through the general allocator.
+ */
+int hev_socks5_session_udp_init (void);
+void hev_socks5_session_udp_fini (void);
+
 int hev_socks5_session_udp_construct (HevSocks5SessionUDP *self,
                                       struct udp_pcb *pcb, HevTaskMutex *mutex);
 
 HevSocks5SessionUDP *hev_socks5_session_udp_new (struct udp_pcb *pcb,
                                                  HevTaskMutex *mutex);
 
+/*
+ * Sessions are shared by all flows from one client source address and
+ * port, so a client talking to many peers uses a single association.
+ * Both calls need the lwIP mutex held.
+ */
+HevSocks5SessionUDP *hev_socks5_session_udp_find (struct udp_pcb *pcb);
+int hev_socks5_session_udp_add (HevSocks5SessionUDP *self,
+                                struct udp_pcb *pcb);
+
 #endif /* __HEV_SOCKS5_SESSION_UDP_H__ */
@@ -7,46 +7,300 @@
  ============================================================================
  */
 
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
 
+#include <hev-task-io-socket.h>
+#include <hev-socks5-misc.h>
+
+#include "hev-utils.h"
 #include "hev-logger.h"
 #include "hev-config.h"
+#include "hev-compiler.h"
+#include "hev-socks5-proxy.h"
 #include "hev-socks5-client.h"
+#include "hev-socks5-tunnel.h"
 
 #include "hev-socks5-session.h"
 
+static long
+monotonic_usec (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int
+hev_socks5_session_attach (HevSocks5Session *self,
+                           HevSocks5SessionIface *iface,
+                           HevSocks5Upstream *upstream)
+{
+    int fd;
+
+    if (!upstream->pool || !iface->attach)
+        return -1;
+
+    fd = hev_connection_pool_take (upstream->pool);
+    if (fd < 0)
+        return -1;
+
+    LOG_D ("%p socks5 session attach %d", self, fd);
+
+    return iface->attach (self, fd);
+}
+
+static int
+hev_socks5_session_race_start (HevSocks5Upstream *up)
+{
+    struct sockaddr_storage saddr;
+    socklen_t saddr_len;
+    int fd, res;
+
+    if (hev_socks5_upstream_get_addr (up, &saddr, &saddr_len) < 0)
+        return -1;
+
+    fd = socket (saddr.ss_family, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+
+    if (up->srv->mark && (set_sock_mark (fd, up->srv->mark) < 0))
+        goto error;
+
+    res = connect (fd, (struct sockaddr *)&saddr, saddr_len);
+    if ((res < 0) && (errno != EINPROGRESS))
+        goto error;
+
+    if (hev_task_add_fd (hev_task_self (), fd, POLLOUT) < 0)
+        goto error;
+
+    return fd;
+
+error:
+    close (fd);
+    return -1;
+}
+
+static void
+hev_socks5_session_race_close (int fd)
+{
+    hev_task_del_fd (hev_task_self (), fd);
+    close (fd);
+}
+
+static int
+hev_socks5_session_race_check (int fd)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+    socklen_t len;
+    int err = 0;
+
+    if (poll (&pfd, 1, 0) <= 0)
+        return 0;
+
+    len = sizeof (err);
+    getsockopt (fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err)
+        return -1;
+
+    return 1;
+}
+
+/*
+ * Connect to the selected server and, if it has not answered within the
+ * race delay or has failed, to another healthy one too. The first to
+ * complete wins and the session moves to it. The task sleeps until one
+ * of the sockets is writable or the next deadline passes.
+ */
+static int
+hev_socks5_session_race (HevSocks5Session *self, HevSocks5SessionData *data)
+{
+    HevSocks5Upstream *ups[2] = { data->upstream, NULL };
+    HevConfigServer *srv = data->upstream->srv;
+    struct sockaddr_storage saddr;
+    socklen_t saddr_len;
+    int fds[2] = { -1, -1 };
+    int delay = hev_config_get_socks5_race_delay ();
+    int timeout = hev_config_get_misc_connect_timeout ();
+    int alternate = 0;
+    int win = -1;
+    long start;
+    int i;
+
+    /* Not resolved yet: connect plainly rather than look it up here. */
+    if (hev_socks5_upstream_get_addr (ups[0], &saddr, &saddr_len) < 0)
+        return hev_socks5_client_connect (HEV_SOCKS5_CLIENT (self), srv->addr,
+                                          srv->port);
+
+    fds[0] = hev_socks5_session_race_start (ups[0]);
+
+    if (delay > timeout)
+        delay = timeout;
+    start = monotonic_usec ();
+
+    for (;;) {
+        long elapsed;
+
+        for (i = 0; (win < 0) && (i < 2); i++) {
+            int res;
+
+            if (fds[i] < 0)
+                continue;
+
+            res = hev_socks5_session_race_check (fds[i]);
+            if (res > 0) {
+                win = i;
+            } else if (res < 0) {
+                hev_socks5_session_race_close (fds[i]);
+                fds[i] = -1;
+            }
+        }
+        if (win >= 0)
+            break;
+
+        elapsed = (monotonic_usec () - start) / 1000;
+
+        if (!alternate && ((elapsed >= delay) || (fds[0] < 0))) {
+            alternate = 1;
+            ups[1] = hev_socks5_upstream_alternate (ups[0], data->hash);
+            if (ups[1]) {
+                LOG_D ("%p socks5 session race %s:%u", self, ups[1]->srv->addr,
+                       ups[1]->srv->port);
+                fds[1] = hev_socks5_session_race_start (ups[1]);
+            }
+            continue;
+        }
+
+        if (((fds[0] < 0) && (fds[1] < 0)) || (elapsed >= timeout))
+            break;
+
+        hev_task_sleep ((alternate ? timeout : delay) - elapsed);
+    }
+
+    for (i = 0; i < 2; i++) {
+        if ((i == win) || !ups[i])
+            continue;
+        if (fds[i] >= 0)
+            hev_socks5_session_race_close (fds[i]);
+        else if (i == 1)
+            hev_socks5_upstream_report (ups[i], -1);
+    }
+
+    if (win < 0)
+        return -1;
+
+    if (win == 1) {
+        if (fds[0] < 0)
+            hev_socks5_upstream_report (ups[0], -1);
+        hev_socks5_upstream_switch (ups[0], ups[1]);
+        data->upstream = ups[1];
+    }
+
+    /* The client registers the socket with the task itself. */
+    hev_task_del_fd (hev_task_self (), fds[win]);
+    if (hev_socks5_client_connect_fd (HEV_SOCKS5_CLIENT (self), fds[win]) < 0) {
+        close (fds[win]);
+        return -1;
+    }
+
+    return 0;
+}
+
 void
 hev_socks5_session_run (HevSocks5Session *self)
 {
     HevSocks5SessionIface *iface;
+    HevSocks5SessionData *data;
     HevConfigServer *srv;
+    long start;
     int res;
 
     LOG_D ("%p socks5 session run", self);
 
-    srv = hev_config_get_socks5_server ();
+    iface = HEV_OBJECT_GET_IFACE (self, HEV_SOCKS5_SESSION_TYPE);
+    data = container_of (iface->get_node (self), HevSocks5SessionData, node);
+    data->upstream = hev_socks5_upstream_select (data->hash);
+    srv = data->upstream->srv;
+    start = monotonic_usec ();
+
+    res = hev_socks5_session_attach (self, iface, data->upstream);
+    if (res == 0)
+        goto splice;
+    if (res < -1) {
+        LOG_E ("%p socks5 session attach", self);
+        goto exit;
+    }
 
-    res = hev_socks5_client_connect (HEV_SOCKS5_CLIENT (self), srv->addr,
-                                     srv->port);
+    /* Fast open sockets connect in the first send, leaving nothing to race. */
+    if (hev_config_get_socks5_race_delay () && !srv->fast_open)
+        res = hev_socks5_session_race (self, data);
+    else
+        res = hev_socks5_client_connect (HEV_SOCKS5_CLIENT (self), srv->addr,
+                                         srv->port);
     if (res < 0) {
         LOG_E ("%p socks5 session connect", self);
-        return;
+        goto exit;
     }
 
-    if (srv->user && srv->pass) {
-        hev_socks5_client_set_auth (HEV_SOCKS5_CLIENT (self), srv->user,
-                                    srv->pass);
-        LOG_D ("%p socks5 client auth %s:%s", self, srv->user, srv->pass);
-    }
+    srv = data->upstream->srv;
+
+    if (iface->handshake) {
+        res = iface->handshake (self);
+    } else {
+        if (srv->user && srv->pass) {
+            hev_socks5_client_set_auth (HEV_SOCKS5_CLIENT (self), srv->user,
+                                        srv->pass);
+            LOG_D ("%p socks5 client auth %s:%s", self, srv->user, srv->pass);
+        }
 
-    res = hev_socks5_client_handshake (HEV_SOCKS5_CLIENT (self), srv->pipeline);
+        res = hev_socks5_client_handshake (HEV_SOCKS5_CLIENT (self),
+                                           srv->pipeline);
+    }
     if (res < 0) {
         LOG_E ("%p socks5 session handshake", self);
-        return;
+        goto exit;
     }
 
-    iface = HEV_OBJECT_GET_IFACE (self, HEV_SOCKS5_SESSION_TYPE);
+splice:
+    hev_socks5_upstream_report (data->upstream, monotonic_usec () - start);
     iface->splicer (self);
+
+exit:
+    if (res < 0)
+        hev_socks5_upstream_report (data->upstream, -1);
+    hev_socks5_upstream_release (data->upstream, data->tx_bytes,
+                                 data->rx_bytes);
+}
+
+int
+hev_socks5_session_send (HevSocks5Session *self, const void *buf, int len)
+{
+    ssize_t s;
+
+    s = hev_task_io_socket_send (HEV_SOCKS5 (self)->fd, buf, len, MSG_WAITALL,
+                                 hev_socks5_session_yielder, self);
+
+    return (s == len) ? 0 : -1;
+}
+
+int
+hev_socks5_session_recv (HevSocks5Session *self, void *buf, int len)
+{
+    ssize_t s;
+
+    s = hev_task_io_socket_recv (HEV_SOCKS5 (self)->fd, buf, len, MSG_WAITALL,
+                                 hev_socks5_session_yielder, self);
+
+    return (s == len) ? 0 : -1;
 }
 
 void
@@ -61,6 +315,46 @@ hev_socks5_session_terminate (HevSocks5Session *self)
     hev_task_wakeup (iface->get_task (self));
 }
 
+void
+hev_socks5_session_evict (HevSocks5Session *self)
+{
+    HevSocks5SessionIface *iface;
+    HevSocks5SessionData *data;
+    HevTask *task;
+
+    LOG_D ("%p socks5 session evict", self);
+
+    iface = HEV_OBJECT_GET_IFACE (self, HEV_SOCKS5_SESSION_TYPE);
+    data = container_of (iface->get_node (self), HevSocks5SessionData, node);
+    __atomic_store_n (&data->evicted, 1, __ATOMIC_RELAXED);
+
+    task = iface->get_task (self);
+    if (task)
+        hev_task_wakeup (task);
+}
+
+int
+hev_socks5_session_yielder (HevTaskYieldType type, void *data)
+{
+    HevSocks5Session *self = data;
+    HevSocks5SessionIface *iface;
+    HevSocks5SessionData *sd;
+    int res;
+
+    iface = HEV_OBJECT_GET_IFACE (self, HEV_SOCKS5_SESSION_TYPE);
+    sd = container_of (iface->get_node (self), HevSocks5SessionData, node);
+
+    res = hev_socks5_task_io_yielder (type, data);
+    hev_socks5_tunnel_update_session (&sd->node);
+
+    if (__atomic_load_n (&sd->evicted, __ATOMIC_RELAXED)) {
+        hev_socks5_set_timeout (HEV_SOCKS5 (self), 0);
+        return -1;
+    }
+
+    return res;
+}
+
 void
 hev_socks5_session_set_task (HevSocks5Session *self, HevTask *task)
 {
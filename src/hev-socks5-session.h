@@ -13,6 +13,8 @@
 #include <hev-task.h>
 
 #include "hev-list.h"
+#include "hev-timing-wheel.h"
+#include "hev-socks5-upstream.h"
 
 #define HEV_SOCKS5_SESSION(p) ((HevSocks5Session *)p)
 #define HEV_SOCKS5_SESSION_IFACE(p) ((HevSocks5SessionIface *)p)
@@ -25,8 +27,16 @@ typedef struct _HevSocks5SessionIface HevSocks5SessionIface;
 struct _HevSocks5SessionData
 {
     HevListNode node;
+    HevTimingWheelNode wheel;
     HevTask *task;
     HevSocks5Session *self;
+    HevSocks5Upstream *upstream;
+    unsigned long long tx_bytes;
+    unsigned long long rx_bytes;
+    unsigned int hash;
+    unsigned int listed;
+    int started;
+    int evicted;
 };
 
 struct _HevSocks5SessionIface
@@ -35,6 +45,8 @@ struct _HevSocks5SessionIface
     HevTask *(*get_task) (HevSocks5Session *self);
     void (*set_task) (HevSocks5Session *self, HevTask *task);
     HevListNode *(*get_node) (HevSocks5Session *self);
+    int (*attach) (HevSocks5Session *self, int fd);
+    int (*handshake) (HevSocks5Session *self);
 };
 
 void *hev_socks5_session_iface (void);
@@ -42,6 +54,50 @@ void *hev_socks5_session_iface (void);
 void hev_socks5_session_run (HevSocks5Session *self);
 void hev_socks5_session_terminate (HevSocks5Session *self);
 
+/**
+ * hev_socks5_session_evict:
+ * @self: a #HevSocks5Session
+ *
+ * Ask @self to stop from another thread. Only the flag is set here, the
+ * session sees it in its own yielder and winds down there.
+ */
+void hev_socks5_session_evict (HevSocks5Session *self);
+
+/**
+ * hev_socks5_session_yielder:
+ * @type: yield type
+ * @data: a #HevSocks5Session
+ *
+ * Task IO yielder of sessions: marks the session active and fails once it
+ * was evicted.
+ *
+ * Returns: 0 to go on, -1 to stop
+ */
+int hev_socks5_session_yielder (HevTaskYieldType type, void *data);
+
+/**
+ * hev_socks5_session_send:
+ * @self: a #HevSocks5Session
+ * @buf: data to write
+ * @len: length of @buf
+ *
+ * Write all of @buf to the upstream socket during the hand-rolled
+ * handshakes, yielding to other tasks while it blocks.
+ *
+ * Returns: 0 on success, -1 on error or short write
+ */
+int hev_socks5_session_send (HevSocks5Session *self, const void *buf, int len);
+
+/**
+ * hev_socks5_session_recv:
+ * @self: a #HevSocks5Session
+ * @buf: buffer to fill
+ * @len: bytes to read
+ *
+ * Returns: 0 once @len bytes were read, -1 otherwise
+ */
+int hev_socks5_session_recv (HevSocks5Session *self, void *buf, int len);
+
 void hev_socks5_session_set_task (HevSocks5Session *self, HevTask *task);
 HevListNode *hev_socks5_session_get_node (HevSocks5Session *self);
 
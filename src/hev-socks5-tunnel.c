@@ -24,16 +24,30 @@
 #include <lwip/priv/tcp_priv.h>
 
 #include "hev-exec.h"
+#include "hev-admission.h"
 #include "hev-config.h"
 #include "hev-logger.h"
 #include "hev-tunnel.h"
+#include "hev-utils.h"
 #include "hev-compiler.h"
+#include "hev-dns-tcp.h"
+#include "hev-dns-cache.h"
 #include "hev-mapped-dns.h"
 #include "hev-config-const.h"
 #include "hev-thread-pool.h"
 #include "hev-tunnel-io.h"
 #include "hev-socks5-session-tcp.h"
 #include "hev-socks5-session-udp.h"
+#include "hev-socks5-session-tproxy.h"
+#include "hev-socks5-upstream.h"
+#include "hev-socks5-udp-mux.h"
+#include "hev-slab.h"
+#include "hev-udp-slab.h"
+#include "hev-tcp-buffer.h"
+#include "hev-tcp-time-wait.h"
+#include "hev-timing-wheel.h"
+#include "hev-tproxy.h"
+#include "hev-uring.h"
 
 #include "hev-socks5-tunnel.h"
 
@@ -46,6 +60,8 @@ static volatile int session_count = 0;
 /* Threading infrastructure */
 static HevThreadPool *thread_pool = NULL;
 static HevTunnelIO *tunnel_io = NULL;
+static HevDNSTCP *dns_tcp = NULL;
+static HevTProxy *tproxy = NULL;
 static pthread_t timer_thread;
 static pthread_mutex_t lwip_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t session_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -55,17 +71,19 @@ static struct netif netif;
 static struct tcp_pcb *tcp;
 static struct udp_pcb *udp;
 
-/* Session tracking */
-typedef struct _SessionNode SessionNode;
-struct _SessionNode
-{
-    void *session;
-    SessionNode *next;
-    SessionNode *prev;
-};
+/* Idle timeouts advance with every fourth lwIP timer tick */
+#define WHEEL_TICK (TCP_TMR_INTERVAL * 4)
+
+/* Sessions given a second chance at most per eviction */
+#define EVICT_SCAN (8)
+
+/* Session tracking, in the order last seen active at eviction */
+static HevList session_set;
+static HevTimingWheel *session_wheel;
+static unsigned long session_evicted;
+static unsigned long session_expired;
 
-static SessionNode *session_list_head = NULL;
-static SessionNode *session_list_tail = NULL;
+static HevSlab *task_slab;
 
 /* Forward declarations */
 static void packet_read_callback (struct pbuf *p, void *user_data);
@@ -75,71 +93,133 @@ static void *timer_thread_func (void *arg);
  * Session Management
  * ======================================================================== */
 
+/*
+ * Yielders only stamp the wheel node, the set is put in order here: a
+ * session at the head that was active since it was listed, or has not
+ * started yet, goes to the tail once more. After EVICT_SCAN of those the
+ * head goes anyway, a queued one is refused by start_session. It leaves
+ * the set at once, so later inserts pick the next victim, and its node
+ * points at itself until it exits.
+ */
 static void
-insert_session (void *session)
+evict_session (void)
 {
-    SessionNode *node;
-    int max_sessions;
+    HevSocks5SessionData *victim;
+    HevListNode *node;
+    int i;
+
+    for (i = 0; i < EVICT_SCAN; i++) {
+        HevSocks5SessionData *sd;
+        unsigned int active;
+
+        node = hev_list_first (&session_set);
+        sd = container_of (node, HevSocks5SessionData, node);
+        active = __atomic_load_n (&sd->wheel.active, __ATOMIC_RELAXED);
+        if (sd->started && (active == sd->listed))
+            break;
 
-    node = (SessionNode *)malloc (sizeof (SessionNode));
-    if (!node)
-        return;
+        sd->listed = active;
+        hev_list_del (&session_set, node);
+        hev_list_add_tail (&session_set, node);
+    }
 
-    node->session = session;
-    node->next = NULL;
+    node = hev_list_first (&session_set);
+    victim = container_of (node, HevSocks5SessionData, node);
+    hev_list_del (&session_set, node);
+    node->next = node;
+    node->prev = node;
+    session_count--;
+    session_evicted++;
 
-    pthread_mutex_lock (&session_mutex);
+    LOG_D ("%p session limit reached, evicting", victim->self);
+    hev_socks5_session_evict (victim->self);
+}
+
+static void
+insert_session (void *session, int timeout)
+{
+    HevSocks5SessionData *sd;
+    HevListNode *node;
+    int max_sessions;
 
-    /* Add to tail */
-    node->prev = session_list_tail;
-    if (session_list_tail)
-        session_list_tail->next = node;
-    else
-        session_list_head = node;
-    session_list_tail = node;
+    node = hev_socks5_session_get_node (session);
+    sd = container_of (node, HevSocks5SessionData, node);
 
+    pthread_mutex_lock (&session_mutex);
+    hev_list_add_tail (&session_set, node);
+    hev_timing_wheel_add (session_wheel, &sd->wheel,
+                          (timeout + WHEEL_TICK - 1) / WHEEL_TICK);
+    sd->listed = sd->wheel.active;
     session_count++;
 
-    /* Enforce session limit */
     max_sessions = hev_config_get_misc_max_session_count ();
-    if (max_sessions > 0 && session_count > max_sessions) {
-        /* Terminate oldest session */
-        if (session_list_head && session_list_head->session) {
-            LOG_W ("session limit reached, terminating oldest session");
-            /* TODO: Add session termination callback */
-        }
-    }
-
+    if (max_sessions > 0 && session_count > max_sessions)
+        evict_session ();
     pthread_mutex_unlock (&session_mutex);
 }
 
 static void
 remove_session (void *session)
 {
-    SessionNode *node;
+    HevSocks5SessionData *sd;
+    HevListNode *node;
 
-    pthread_mutex_lock (&session_mutex);
+    node = hev_socks5_session_get_node (session);
+    sd = container_of (node, HevSocks5SessionData, node);
 
-    /* Find and remove node */
-    for (node = session_list_head; node; node = node->next) {
-        if (node->session == session) {
-            if (node->prev)
-                node->prev->next = node->next;
-            else
-                session_list_head = node->next;
-
-            if (node->next)
-                node->next->prev = node->prev;
-            else
-                session_list_tail = node->prev;
-
-            free (node);
-            session_count--;
-            break;
-        }
+    pthread_mutex_lock (&session_mutex);
+    hev_timing_wheel_del (session_wheel, &sd->wheel);
+    if (node->next != node) {
+        hev_list_del (&session_set, node);
+        session_count--;
     }
+    pthread_mutex_unlock (&session_mutex);
+}
 
+static int
+start_session (void *session)
+{
+    HevSocks5SessionData *sd;
+    HevListNode *node;
+    int res;
+
+    node = hev_socks5_session_get_node (session);
+    sd = container_of (node, HevSocks5SessionData, node);
+
+    pthread_mutex_lock (&session_mutex);
+    sd->started = 1;
+    res = __atomic_load_n (&sd->evicted, __ATOMIC_RELAXED) ? -1 : 0;
     pthread_mutex_unlock (&session_mutex);
+
+    return res;
+}
+
+void
+hev_socks5_tunnel_update_session (HevListNode *node)
+{
+    HevSocks5SessionData *sd;
+
+    sd = container_of (node, HevSocks5SessionData, node);
+    hev_timing_wheel_touch (session_wheel, &sd->wheel);
+}
+
+/*
+ * The session stops in its own task, which may be queued or blocked for a
+ * while yet, so it stays on the wheel until remove_session takes it off.
+ */
+static void
+expire_session (HevTimingWheelNode *wheel, void *data)
+{
+    HevSocks5SessionData *sd;
+
+    sd = container_of (wheel, HevSocks5SessionData, wheel);
+    hev_timing_wheel_add (session_wheel, wheel, wheel->timeout);
+    if (__atomic_load_n (&sd->evicted, __ATOMIC_RELAXED))
+        return;
+
+    session_expired++;
+    LOG_D ("%p session idle timeout", sd->self);
+    hev_socks5_session_evict (sd->self);
 }
 
 /* ========================================================================
@@ -159,12 +239,14 @@ session_task_wrapper (void *data)
 
     LOG_D ("session task started");
 
-    /* Run the session */
-    task_data->run_func (task_data->session);
+    /* Run the session, unless it was stopped while queued */
+    if (start_session (task_data->session) == 0)
+        task_data->run_func (task_data->session);
 
     /* Clean up */
     remove_session (task_data->session);
-    free (task_data);
+    hev_object_unref (HEV_OBJECT (task_data->session));
+    hev_slab_free (task_slab, task_data);
 
     LOG_D ("session task completed");
 }
@@ -173,6 +255,8 @@ session_task_wrapper (void *data)
  * LwIP Callbacks
  * ======================================================================== */
 
+/* All of these run with lwip_mutex held, input from packet_read_callback. */
+
 static err_t
 netif_output_handler (struct netif *netif, struct pbuf *p)
 {
@@ -226,15 +310,13 @@ tcp_accept_handler (void *arg, struct tcp_pcb *pcb, err_t err)
     LOG_D ("accepting new TCP connection");
 
     /* Create TCP session */
-    pthread_mutex_lock (&lwip_mutex);
     tcp_session = hev_socks5_session_tcp_new (pcb, &lwip_mutex);
-    pthread_mutex_unlock (&lwip_mutex);
 
     if (!tcp_session)
         return ERR_MEM;
 
     /* Create task data */
-    task_data = (SessionTaskData *)malloc (sizeof (SessionTaskData));
+    task_data = hev_slab_alloc (task_slab);
     if (!task_data) {
         /* TODO: Free session */
         return ERR_MEM;
@@ -244,27 +326,74 @@ tcp_accept_handler (void *arg, struct tcp_pcb *pcb, err_t err)
     task_data->run_func = (void (*) (void *))hev_socks5_session_run;
 
     /* Track session */
-    insert_session (tcp_session);
+    insert_session (tcp_session, hev_config_get_misc_tcp_read_write_timeout ());
 
     /* Submit to thread pool */
     if (hev_thread_pool_submit (thread_pool, session_task_wrapper,
                                 task_data) < 0) {
         LOG_E ("failed to submit TCP session to thread pool");
         remove_session (tcp_session);
-        free (task_data);
+        hev_slab_free (task_slab, task_data);
         return ERR_MEM;
     }
 
     return ERR_OK;
 }
 
+static void
+tproxy_accept_handler (int fd)
+{
+    SessionTaskData *task_data;
+    void *tproxy_session;
+
+    if (!run) {
+        close (fd);
+        return;
+    }
+
+    LOG_D ("accepting new transparent TCP connection");
+
+    /* Create transparent TCP session */
+    tproxy_session = hev_socks5_session_tproxy_new (fd);
+    if (!tproxy_session) {
+        close (fd);
+        return;
+    }
+
+    /* Create task data */
+    task_data = hev_slab_alloc (task_slab);
+    if (!task_data) {
+        hev_object_unref (HEV_OBJECT (tproxy_session));
+        return;
+    }
+
+    task_data->session = tproxy_session;
+    task_data->run_func = (void (*) (void *))hev_socks5_session_run;
+
+    /* Track session */
+    insert_session (tproxy_session,
+                    hev_config_get_misc_tcp_read_write_timeout ());
+
+    /* Submit to thread pool */
+    if (hev_thread_pool_submit (thread_pool, session_task_wrapper,
+                                task_data) < 0) {
+        LOG_E ("failed to submit transparent TCP session to thread pool");
+        remove_session (tproxy_session);
+        hev_slab_free (task_slab, task_data);
+        hev_object_unref (HEV_OBJECT (tproxy_session));
+    }
+}
+
 static void
 udp_recv_handler (void *arg, struct udp_pcb *pcb, struct pbuf *p,
                   const ip_addr_t *addr, u16_t port)
 {
+    HevSocks5SessionUDP *udp_session;
     SessionTaskData *task_data;
-    void *udp_session;
+    unsigned short dns_id = 0;
     HevMappedDNS *dns;
+    HevDNSCache *cache;
+    int refresh = 0;
 
     if (!run) {
         pbuf_free (p);
@@ -284,7 +413,6 @@ udp_recv_handler (void *arg, struct udp_pcb *pcb, struct pbuf *p,
 
             b = pbuf_alloc (PBUF_TRANSPORT, 512, PBUF_RAM);
             if (b) {
-                pthread_mutex_lock (&lwip_mutex);
                 res = hev_mapped_dns_handle (dns, p->payload, p->len,
                                             b->payload, b->len);
                 if (res > 0) {
@@ -292,7 +420,6 @@ udp_recv_handler (void *arg, struct udp_pcb *pcb, struct pbuf *p,
                     b->tot_len = res;
                     udp_sendfrom (pcb, b, &pcb->local_ip, pcb->local_port);
                 }
-                pthread_mutex_unlock (&lwip_mutex);
                 pbuf_free (b);
             }
             pbuf_free (p);
@@ -302,22 +429,56 @@ udp_recv_handler (void *arg, struct udp_pcb *pcb, struct pbuf *p,
         }
     }
 
+    /* Answer repeated queries from the DNS cache */
+    cache = hev_dns_cache_get ();
+    if (cache && (hev_dns_cache_reply (cache, pcb, p, &refresh) > 0)) {
+        if (!refresh) {
+            pbuf_free (p);
+            udp_recv (pcb, NULL, NULL);
+            udp_remove (pcb);
+            return;
+        }
+        memcpy (&dns_id, p->payload, 2);
+    }
+
+    /* Forward plain DNS over a shared TCP session */
+    if (dns_tcp && (pcb->local_port == 53)) {
+        if (hev_dns_tcp_submit (dns_tcp, pcb, p, refresh) == 0) {
+            pbuf_free (p);
+            return;
+        }
+    }
+
     pbuf_free (p);
 
+    /* Join the association of an earlier flow from this source port */
+    udp_session = hev_socks5_session_udp_find (pcb);
+    if (udp_session && (hev_socks5_session_udp_add (udp_session, pcb) == 0))
+        return;
+
+    /* Shed new flows while overloaded */
+    if (hev_admission_shed ()) {
+        udp_remove (pcb);
+        return;
+    }
+
     LOG_D ("accepting new UDP connection");
 
     /* Create UDP session */
-    pthread_mutex_lock (&lwip_mutex);
     udp_session = hev_socks5_session_udp_new (pcb, &lwip_mutex);
-    pthread_mutex_unlock (&lwip_mutex);
 
     if (!udp_session) {
         udp_remove (pcb);
         return;
     }
 
+    if (refresh) {
+        udp_session->dns_refresh = 1;
+        udp_session->dns_refresh_id = dns_id;
+    }
+
     /* Create task data */
-    task_data = (SessionTaskData *)malloc (sizeof (SessionTaskData));
+    task_data = hev_slab_alloc (task_slab);
     if (!task_data) {
         udp_remove (pcb);
         return;
@@ -327,14 +488,14 @@ udp_recv_handler (void *arg, struct udp_pcb *pcb, struct pbuf *p,
     task_data->run_func = (void (*) (void *))hev_socks5_session_run;
 
     /* Track session */
-    insert_session (udp_session);
+    insert_session (udp_session, hev_config_get_misc_udp_read_write_timeout ());
 
     /* Submit to thread pool */
     if (hev_thread_pool_submit (thread_pool, session_task_wrapper,
                                 task_data) < 0) {
         LOG_E ("failed to submit UDP session to thread pool");
         remove_session (udp_session);
-        free (task_data);
+        hev_slab_free (task_slab, task_data);
         udp_remove (pcb);
         return;
     }
@@ -347,12 +508,19 @@ udp_recv_handler (void *arg, struct udp_pcb *pcb, struct pbuf *p,
 static void
 packet_read_callback (struct pbuf *p, void *user_data)
 {
+    HevTCPTimeWait *tw;
+
     if (!p)
         return;
 
     /* Process packet through LwIP */
     pthread_mutex_lock (&lwip_mutex);
-    if (netif.input (p, &netif) != ERR_OK) {
+    tw = hev_tcp_time_wait_get ();
+    if (tw && hev_tcp_time_wait_filter (tw, p)) {
+        pbuf_free (p);
+    } else if (hev_admission_filter (p)) {
+        pbuf_free (p);
+    } else if (netif.input (p, &netif) != ERR_OK) {
         pbuf_free (p);
     }
     pthread_mutex_unlock (&lwip_mutex);
@@ -377,6 +545,10 @@ timer_thread_func (void *arg)
         tcp_tmr ();
 
         if ((counter & 3) == 0) {
+            HevTCPTimeWait *tw = hev_tcp_time_wait_get ();
+
+            if (tw)
+                hev_tcp_time_wait_expire (tw);
 #if IP_REASSEMBLY
             ip_reass_tmr ();
 #endif
@@ -390,6 +562,16 @@ timer_thread_func (void *arg)
 
         pthread_mutex_unlock (&lwip_mutex);
 
+        if ((counter & 3) == 0) {
+            pthread_mutex_lock (&session_mutex);
+            hev_timing_wheel_tick (session_wheel, expire_session, NULL);
+            pthread_mutex_unlock (&session_mutex);
+
+            hev_admission_update (
+                hev_thread_pool_get_queue_size (thread_pool),
+                hev_tunnel_io_get_write_queue_size (tunnel_io));
+        }
+
         counter++;
     }
 
@@ -570,6 +752,93 @@ mapped_dns_fini (void)
     }
 }
 
+static int
+dns_cache_init (void)
+{
+    HevDNSCache *cache;
+    int size, min_ttl, max_ttl, prefetch;
+
+    size = hev_config_get_dnscache_cache_size ();
+    min_ttl = hev_config_get_dnscache_min_ttl ();
+    max_ttl = hev_config_get_dnscache_max_ttl ();
+    prefetch = hev_config_get_dnscache_prefetch ();
+
+    if (!size)
+        return 0;
+
+    cache = hev_dns_cache_new (size, min_ttl, max_ttl, prefetch);
+    if (!cache)
+        return -1;
+
+    hev_dns_cache_put (cache);
+    LOG_I ("dns cache initialized");
+    return 0;
+}
+
+static void
+dns_cache_fini (void)
+{
+    HevDNSCache *cache = hev_dns_cache_get ();
+    if (cache) {
+        LOG_I ("dns cache: %lu hits %lu misses %lu prefetches", cache->hits,
+               cache->misses, cache->prefetches);
+        hev_object_unref (HEV_OBJECT (cache));
+        hev_dns_cache_put (NULL);
+    }
+}
+
+static int
+tcp_time_wait_init (void)
+{
+    HevTCPTimeWait *tw;
+    int timeout;
+
+    timeout = hev_config_get_misc_tcp_time_wait ();
+    if (timeout <= 0)
+        return 0;
+
+    tw = hev_tcp_time_wait_new (timeout);
+    if (!tw)
+        return -1;
+
+    hev_tcp_time_wait_put (tw);
+    LOG_I ("tcp time wait initialized");
+    return 0;
+}
+
+static void
+tcp_time_wait_fini (void)
+{
+    HevTCPTimeWait *tw = hev_tcp_time_wait_get ();
+    if (tw) {
+        hev_tcp_time_wait_destroy (tw);
+        hev_tcp_time_wait_put (NULL);
+    }
+}
+
+static int
+dns_tcp_init (void)
+{
+    if (!hev_config_get_dnstcp_address ())
+        return 0;
+
+    dns_tcp = hev_dns_tcp_new (&lwip_mutex);
+    if (!dns_tcp)
+        return -1;
+
+    LOG_I ("dns over tcp initialized");
+    return 0;
+}
+
+static void
+dns_tcp_fini (void)
+{
+    if (dns_tcp) {
+        hev_dns_tcp_destroy (dns_tcp);
+        dns_tcp = NULL;
+    }
+}
+
 /* ========================================================================
  * Public API
  * ======================================================================== */
@@ -602,6 +871,63 @@ hev_socks5_tunnel_init (int extern_tun_fd)
     if (res < 0)
         goto error;
 
+    /* Initialize DNS cache */
+    res = dns_cache_init ();
+    if (res < 0)
+        goto error;
+
+    /* Initialize compact TIME_WAIT table */
+    res = tcp_time_wait_init ();
+    if (res < 0)
+        goto error;
+
+    /* Initialize DNS over TCP */
+    res = dns_tcp_init ();
+    if (res < 0)
+        goto error;
+
+    /* Initialize upstream servers */
+    res = hev_socks5_upstream_init ();
+    if (res < 0)
+        goto error;
+
+    /* Initialize UDP buffer slab */
+    res = hev_udp_slab_init ();
+    if (res < 0)
+        goto error;
+
+    /* Initialize TCP relay buffer pool */
+    res = hev_tcp_buffer_init ();
+    if (res < 0)
+        goto error;
+
+    /* Initialize per-thread io_uring */
+    res = hev_uring_init ();
+    if (res < 0)
+        goto error;
+
+    /* Initialize admission control */
+    res = hev_admission_init ();
+    if (res < 0)
+        goto error;
+
+    /* Initialize session bookkeeping */
+    task_slab = hev_slab_new ("session task", sizeof (SessionTaskData));
+    session_wheel = hev_timing_wheel_new ();
+    if (!task_slab || !session_wheel) {
+        LOG_E ("failed to create session bookkeeping");
+        goto error;
+    }
+
+    res = hev_socks5_session_udp_init ();
+    if (res < 0)
+        goto error;
+
+    /* Initialize shared UDP sockets */
+    res = hev_socks5_udp_mux_init (&lwip_mutex);
+    if (res < 0)
+        goto error;
+
     /* Create thread pool (auto-detect optimal size) */
     thread_pool = hev_thread_pool_new (0);
     if (!thread_pool) {
@@ -609,6 +935,13 @@ hev_socks5_tunnel_init (int extern_tun_fd)
         goto error;
     }
 
+    /* Start transparent TCP listener */
+    if (hev_config_get_tproxy_port ()) {
+        tproxy = hev_tproxy_new (tproxy_accept_handler);
+        if (!tproxy)
+            goto error;
+    }
+
     /* Create tunnel I/O manager */
     mtu = hev_config_get_tunnel_mtu ();
     tunnel_io = hev_tunnel_io_new (tun_fd, mtu);
@@ -637,25 +970,50 @@ hev_socks5_tunnel_fini (void)
         tunnel_io = NULL;
     }
 
+    if (tproxy) {
+        hev_tproxy_destroy (tproxy);
+        tproxy = NULL;
+    }
+
     if (thread_pool) {
         hev_thread_pool_destroy (thread_pool);
         thread_pool = NULL;
     }
 
+    hev_socks5_udp_mux_fini ();
+    hev_socks5_session_tcp_fini ();
+    hev_socks5_session_udp_fini ();
+    hev_udp_slab_fini ();
+    hev_admission_fini ();
+    hev_uring_fini ();
+    hev_tcp_buffer_fini ();
+    hev_socks5_upstream_fini ();
+    dns_tcp_fini ();
+    tcp_time_wait_fini ();
+    dns_cache_fini ();
     mapped_dns_fini ();
     gateway_fini ();
     tunnel_fini ();
 
-    /* Clear session list */
+    /* Clear session set */
     pthread_mutex_lock (&session_mutex);
-    while (session_list_head) {
-        SessionNode *node = session_list_head;
-        session_list_head = node->next;
-        free (node);
-    }
-    session_list_tail = NULL;
+    LOG_I ("sessions: %lu expired %lu evicted", session_expired,
+           session_evicted);
+    session_set.head = NULL;
+    session_set.tail = NULL;
     session_count = 0;
+    session_evicted = 0;
+    session_expired = 0;
+    if (session_wheel) {
+        hev_timing_wheel_destroy (session_wheel);
+        session_wheel = NULL;
+    }
     pthread_mutex_unlock (&session_mutex);
+
+    if (task_slab) {
+        hev_slab_destroy (task_slab);
+        task_slab = NULL;
+    }
 }
 
 int
@@ -716,3 +1074,29 @@ hev_socks5_tunnel_stats (size_t *tx_packets, size_t *tx_bytes,
             *rx_bytes = 0;
     }
 }
+
+void
+hev_socks5_tunnel_tcp_stats (size_t *states, size_t *time_wait)
+{
+    HevTCPTimeWait *tw;
+    struct tcp_pcb *pcb;
+    int i;
+
+    for (i = 0; i <= TIME_WAIT; i++)
+        states[i] = 0;
+
+    pthread_mutex_lock (&lwip_mutex);
+    for (pcb = tcp_bound_pcbs; pcb; pcb = pcb->next)
+        states[pcb->state]++;
+    for (pcb = tcp_listen_pcbs.pcbs; pcb; pcb = pcb->next)
+        states[LISTEN]++;
+    for (pcb = tcp_active_pcbs; pcb; pcb = pcb->next)
+        states[pcb->state]++;
+    for (pcb = tcp_tw_pcbs; pcb; pcb = pcb->next)
+        states[pcb->state]++;
+
+    tw = hev_tcp_time_wait_get ();
+    if (time_wait)
+        *time_wait = tw ? hev_tcp_time_wait_get_use (tw) : 0;
+    pthread_mutex_unlock (&lwip_mutex);
+}
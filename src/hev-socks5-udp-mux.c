@@ -0,0 +1,733 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-udp-mux.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Socks5 Shared UDP Sockets
+ ============================================================================
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/uio.h>
+
+#include <hev-socks5-misc.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-utils.h"
+#include "hev-config.h"
+#include "hev-logger.h"
+#include "hev-udp-slab.h"
+#include "hev-socks5-upstream.h"
+
+#include "hev-socks5-udp-mux.h"
+
+#if defined(__linux__)
+
+#define MUX_BATCH (32)
+#define MUX_BUCKETS (4096)
+#define MUX_HEADER (3 + 1 + 1 + 255 + 2)
+#define MUX_GSO_SEGS (64)
+#define MUX_GSO_SIZE (65000)
+#define MUX_GRO_SIZE (65536)
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT (103)
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO (104)
+#endif
+#ifndef SOL_UDP
+#define SOL_UDP (17)
+#endif
+
+typedef struct _HevSocks5UDPMuxBatch HevSocks5UDPMuxBatch;
+typedef struct _HevSocks5UDPMuxSock HevSocks5UDPMuxSock;
+
+struct _HevSocks5UDPMuxBatch
+{
+    struct mmsghdr msgs[MUX_BATCH];
+    struct iovec iovs[MUX_BATCH];
+    struct sockaddr_storage addrs[MUX_BATCH];
+    uint8_t *bufs;
+};
+
+struct _HevSocks5UDPMuxSock
+{
+    HevConfigServer *srv;
+    int fd;
+    int gso;
+    int gro;
+    int event[2];
+    pthread_t thread;
+
+    pthread_mutex_t tx_mutex;
+    int flushing;
+    int queued;
+    int active;
+    HevSocks5UDPMuxBatch tx[2];
+    HevSocks5UDPMuxBatch rx;
+
+    char rx_ctrl[MUX_BATCH][CMSG_SPACE (sizeof (int))];
+
+    unsigned long rx_packets;
+    unsigned long rx_calls;
+    unsigned long rx_gro;
+    unsigned long tx_packets;
+    unsigned long tx_calls;
+    unsigned long tx_gso;
+    unsigned long unknown;
+};
+
+static int family;
+static int buf_size;
+static int rx_size;
+static int socks_num;
+static int socks_total;
+static int servers_num;
+static HevConfigServer *servers;
+static HevSocks5UDPMuxSock *socks;
+static pthread_mutex_t *lwip_mutex;
+static pthread_rwlock_t table_lock = PTHREAD_RWLOCK_INITIALIZER;
+static HevSocks5UDPMuxEntry *table[MUX_BUCKETS];
+
+static unsigned int
+relay_hash (const struct sockaddr_storage *addr)
+{
+    if (addr->ss_family == AF_INET6) {
+        const struct sockaddr_in6 *sa = (const struct sockaddr_in6 *)addr;
+
+        return hev_socks5_upstream_hash (&sa->sin6_addr, 16) ^ sa->sin6_port;
+    } else {
+        const struct sockaddr_in *sa = (const struct sockaddr_in *)addr;
+
+        return hev_socks5_upstream_hash (&sa->sin_addr, 4) ^ sa->sin_port;
+    }
+}
+
+static int
+relay_equal (const struct sockaddr_storage *a,
+             const struct sockaddr_storage *b)
+{
+    if (a->ss_family != b->ss_family)
+        return 0;
+
+    if (a->ss_family == AF_INET6) {
+        const struct sockaddr_in6 *sa = (const struct sockaddr_in6 *)a;
+        const struct sockaddr_in6 *sb = (const struct sockaddr_in6 *)b;
+
+        return (sa->sin6_port == sb->sin6_port) &&
+               (memcmp (&sa->sin6_addr, &sb->sin6_addr, 16) == 0);
+    } else {
+        const struct sockaddr_in *sa = (const struct sockaddr_in *)a;
+        const struct sockaddr_in *sb = (const struct sockaddr_in *)b;
+
+        return (sa->sin_port == sb->sin_port) &&
+               (sa->sin_addr.s_addr == sb->sin_addr.s_addr);
+    }
+}
+
+/* Shared sockets are dual stack when possible, IPv4 relays get mapped. */
+static int
+relay_convert (HevSocks5UDPMuxEntry *entry)
+{
+    struct sockaddr_in6 sa6 = { 0 };
+    struct sockaddr_in *sa;
+
+    if (entry->relay.ss_family == family)
+        return 0;
+    if (entry->relay.ss_family != AF_INET)
+        return -1;
+
+    sa = (struct sockaddr_in *)&entry->relay;
+    sa6.sin6_family = AF_INET6;
+    sa6.sin6_port = sa->sin_port;
+    sa6.sin6_addr.s6_addr[10] = 0xff;
+    sa6.sin6_addr.s6_addr[11] = 0xff;
+    memcpy (&sa6.sin6_addr.s6_addr[12], &sa->sin_addr, 4);
+
+    memcpy (&entry->relay, &sa6, sizeof (sa6));
+    entry->relay_len = sizeof (sa6);
+
+    return 0;
+}
+
+/* Each server has its own sockets, the same relay may be behind two. */
+static HevSocks5UDPMuxEntry *
+hev_socks5_udp_mux_lookup (const struct sockaddr_storage *addr, int group)
+{
+    HevSocks5UDPMuxEntry *entry;
+
+    entry = table[relay_hash (addr) % MUX_BUCKETS];
+    for (; entry; entry = entry->next)
+        if (((entry->sock / socks_num) == group) &&
+            relay_equal (&entry->relay, addr))
+            return entry;
+
+    return NULL;
+}
+
+int
+hev_socks5_udp_mux_add (HevSocks5UDPMuxEntry *entry)
+{
+    unsigned int hash;
+    int group;
+    int res = -1;
+
+    group = entry->srv - servers;
+    if ((group < 0) || (group >= servers_num))
+        return -1;
+    if (!socks[group * socks_num].srv)
+        return -1;
+    if (relay_convert (entry) < 0)
+        return -1;
+
+    hash = relay_hash (&entry->relay);
+    entry->sock = group * socks_num + hash % socks_num;
+
+    /* Datagrams from a relay already in use could not be told apart. */
+    pthread_rwlock_wrlock (&table_lock);
+    if (!hev_socks5_udp_mux_lookup (&entry->relay, group)) {
+        entry->next = table[hash % MUX_BUCKETS];
+        table[hash % MUX_BUCKETS] = entry;
+        entry->added = 1;
+        res = 0;
+    }
+    pthread_rwlock_unlock (&table_lock);
+
+    return res;
+}
+
+void
+hev_socks5_udp_mux_del (HevSocks5UDPMuxEntry *entry)
+{
+    HevSocks5UDPMuxEntry **prev;
+
+    if (!entry->added)
+        return;
+
+    pthread_rwlock_wrlock (&table_lock);
+    prev = &table[relay_hash (&entry->relay) % MUX_BUCKETS];
+    for (; *prev; prev = &(*prev)->next) {
+        if (*prev == entry) {
+            *prev = entry->next;
+            break;
+        }
+    }
+    entry->added = 0;
+    pthread_rwlock_unlock (&table_lock);
+}
+
+static int
+hev_socks5_udp_mux_encode (uint8_t *buf, const HevSocks5Addr *addr)
+{
+    int len = hev_socks5_addr_len (addr);
+
+    buf[0] = 0;
+    buf[1] = 0;
+    buf[2] = 0;
+    memcpy (&buf[3], addr, len);
+
+    return 3 + len;
+}
+
+/*
+ * Runs of datagrams to one relay with the same size, the last one may be
+ * shorter, leave in a single UDP_SEGMENT message and a single skb.
+ */
+static int
+hev_socks5_udp_mux_gso_run (HevSocks5UDPMuxBatch *batch, int i, int num)
+{
+    size_t size = batch->iovs[i].iov_len;
+    size_t total = size;
+    int j;
+
+    for (j = i + 1; (j < num) && ((j - i) < MUX_GSO_SEGS); j++) {
+        size_t len = batch->iovs[j].iov_len;
+
+        if ((len > size) || ((total + len) > MUX_GSO_SIZE))
+            break;
+        if (!relay_equal (&batch->addrs[i], &batch->addrs[j]))
+            break;
+
+        total += len;
+        if (len < size) {
+            j++;
+            break;
+        }
+    }
+
+    return j - i;
+}
+
+static void
+hev_socks5_udp_mux_flush (HevSocks5UDPMuxSock *sock,
+                          HevSocks5UDPMuxBatch *batch, int num)
+{
+    char ctrl[MUX_BATCH][CMSG_SPACE (sizeof (uint16_t))];
+    struct mmsghdr msgs[MUX_BATCH];
+    int segs[MUX_BATCH];
+    int i, n = 0;
+
+    for (i = 0; i < num; n++) {
+        struct msghdr *mh = &msgs[n].msg_hdr;
+
+        segs[n] = sock->gso ? hev_socks5_udp_mux_gso_run (batch, i, num) : 1;
+        *mh = batch->msgs[i].msg_hdr;
+        mh->msg_iov = &batch->iovs[i];
+        mh->msg_iovlen = segs[n];
+        mh->msg_control = NULL;
+        mh->msg_controllen = 0;
+
+        if (segs[n] > 1) {
+            struct cmsghdr *cm;
+            uint16_t size = batch->iovs[i].iov_len;
+
+            mh->msg_control = ctrl[n];
+            mh->msg_controllen = sizeof (ctrl[n]);
+            cm = CMSG_FIRSTHDR (mh);
+            cm->cmsg_level = SOL_UDP;
+            cm->cmsg_type = UDP_SEGMENT;
+            cm->cmsg_len = CMSG_LEN (sizeof (size));
+            memcpy (CMSG_DATA (cm), &size, sizeof (size));
+        }
+
+        i += segs[n];
+    }
+
+    for (i = 0; i < n;) {
+        int res, k;
+
+        res = sendmmsg (sock->fd, &msgs[i], n - i, MSG_DONTWAIT);
+        __atomic_add_fetch (&sock->tx_calls, 1, __ATOMIC_RELAXED);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            /* A full send buffer drops the rest, like any UDP socket. */
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+                break;
+            /* No segmentation offload on this path, stop trying it. */
+            if ((errno == EIO) && (segs[i] > 1))
+                sock->gso = 0;
+            i++;
+            continue;
+        }
+
+        for (k = i; k < (i + res); k++) {
+            __atomic_add_fetch (&sock->tx_packets, segs[k], __ATOMIC_RELAXED);
+            if (segs[k] > 1)
+                __atomic_add_fetch (&sock->tx_gso, 1, __ATOMIC_RELAXED);
+        }
+        i += res;
+    }
+}
+
+int
+hev_socks5_udp_mux_send (HevSocks5UDPMuxEntry *entry,
+                         const HevSocks5Addr *addr, const void *buf, int len)
+{
+    HevSocks5UDPMuxSock *sock = &socks[entry->sock];
+    HevSocks5UDPMuxBatch *batch;
+    uint8_t *slot;
+    int hlen;
+    int i;
+
+    pthread_mutex_lock (&sock->tx_mutex);
+    if ((sock->queued == MUX_BATCH) || ((MUX_HEADER + len) > buf_size)) {
+        uint8_t hdr[MUX_HEADER];
+        struct iovec iov[2];
+        struct msghdr mh = { 0 };
+        ssize_t s;
+
+        pthread_mutex_unlock (&sock->tx_mutex);
+
+        iov[0].iov_base = hdr;
+        iov[0].iov_len = hev_socks5_udp_mux_encode (hdr, addr);
+        iov[1].iov_base = (void *)buf;
+        iov[1].iov_len = len;
+        mh.msg_name = &entry->relay;
+        mh.msg_namelen = entry->relay_len;
+        mh.msg_iov = iov;
+        mh.msg_iovlen = 2;
+
+        s = sendmsg (sock->fd, &mh, MSG_DONTWAIT);
+        __atomic_add_fetch (&sock->tx_calls, 1, __ATOMIC_RELAXED);
+        if (s < 0)
+            return -1;
+        __atomic_add_fetch (&sock->tx_packets, 1, __ATOMIC_RELAXED);
+
+        return 0;
+    }
+
+    batch = &sock->tx[sock->active];
+    i = sock->queued++;
+    slot = batch->bufs + buf_size * i;
+    hlen = hev_socks5_udp_mux_encode (slot, addr);
+    memcpy (slot + hlen, buf, len);
+
+    memcpy (&batch->addrs[i], &entry->relay, entry->relay_len);
+    batch->iovs[i].iov_base = slot;
+    batch->iovs[i].iov_len = hlen + len;
+    batch->msgs[i].msg_hdr.msg_name = &batch->addrs[i];
+    batch->msgs[i].msg_hdr.msg_namelen = entry->relay_len;
+    batch->msgs[i].msg_hdr.msg_iov = &batch->iovs[i];
+    batch->msgs[i].msg_hdr.msg_iovlen = 1;
+
+    /* Whoever finds the socket idle sends for everyone queued behind. */
+    if (sock->flushing) {
+        pthread_mutex_unlock (&sock->tx_mutex);
+        return 0;
+    }
+
+    sock->flushing = 1;
+    while (sock->queued) {
+        int num = sock->queued;
+
+        batch = &sock->tx[sock->active];
+        sock->active ^= 1;
+        sock->queued = 0;
+        pthread_mutex_unlock (&sock->tx_mutex);
+
+        hev_socks5_udp_mux_flush (sock, batch, num);
+
+        pthread_mutex_lock (&sock->tx_mutex);
+    }
+    sock->flushing = 0;
+    pthread_mutex_unlock (&sock->tx_mutex);
+
+    return 0;
+}
+
+static int
+hev_socks5_udp_mux_gro_size (struct msghdr *mh)
+{
+    struct cmsghdr *cm;
+
+    for (cm = CMSG_FIRSTHDR (mh); cm; cm = CMSG_NXTHDR (mh, cm)) {
+        if ((cm->cmsg_level == SOL_UDP) && (cm->cmsg_type == UDP_GRO)) {
+            int size;
+
+            memcpy (&size, CMSG_DATA (cm), sizeof (size));
+            return size;
+        }
+    }
+
+    return 0;
+}
+
+static void
+hev_socks5_udp_mux_dispatch (HevSocks5UDPMuxSock *sock, int num)
+{
+    HevSocks5UDPMuxBatch *batch = &sock->rx;
+    int group = (sock - socks) / socks_num;
+    int i;
+
+    pthread_rwlock_rdlock (&table_lock);
+    pthread_mutex_lock (lwip_mutex);
+    for (i = 0; i < num; i++) {
+        HevSocks5UDPMuxEntry *entry;
+        uint8_t *buf = batch->iovs[i].iov_base;
+        int len = batch->msgs[i].msg_len;
+        int seg = 0;
+        int off;
+
+        if (sock->gro)
+            seg = hev_socks5_udp_mux_gro_size (&batch->msgs[i].msg_hdr);
+        if (seg <= 0)
+            seg = len;
+        else
+            sock->rx_gro++;
+
+        entry = hev_socks5_udp_mux_lookup (&batch->addrs[i], group);
+        if (!entry) {
+            sock->unknown++;
+            continue;
+        }
+
+        /* Coalesced datagrams are split back before they reach lwIP. */
+        for (off = 0; off < len; off += seg) {
+            int size = ((len - off) < seg) ? (len - off) : seg;
+
+            entry->handler (entry, buf + off, size);
+            sock->rx_packets++;
+        }
+    }
+    pthread_mutex_unlock (lwip_mutex);
+    pthread_rwlock_unlock (&table_lock);
+}
+
+static void *
+hev_socks5_udp_mux_thread (void *data)
+{
+    HevSocks5UDPMuxSock *sock = data;
+    HevSocks5UDPMuxBatch *batch = &sock->rx;
+
+    for (;;) {
+        struct pollfd pfds[2];
+        int i, res;
+
+        pfds[0].fd = sock->fd;
+        pfds[0].events = POLLIN;
+        pfds[1].fd = sock->event[0];
+        pfds[1].events = POLLIN;
+
+        res = poll (pfds, 2, -1);
+        if ((res < 0) && (errno != EINTR))
+            break;
+        if (pfds[1].revents)
+            break;
+        if (!(pfds[0].revents & POLLIN))
+            continue;
+
+        for (i = 0; i < MUX_BATCH; i++) {
+            struct msghdr *mh = &batch->msgs[i].msg_hdr;
+
+            batch->iovs[i].iov_base = batch->bufs + rx_size * i;
+            batch->iovs[i].iov_len = rx_size;
+            mh->msg_name = &batch->addrs[i];
+            mh->msg_namelen = sizeof (batch->addrs[i]);
+            mh->msg_iov = &batch->iovs[i];
+            mh->msg_iovlen = 1;
+            mh->msg_control = sock->gro ? sock->rx_ctrl[i] : NULL;
+            mh->msg_controllen = sock->gro ? sizeof (sock->rx_ctrl[i]) : 0;
+            mh->msg_flags = 0;
+        }
+
+        res = recvmmsg (sock->fd, batch->msgs, MUX_BATCH, MSG_DONTWAIT, NULL);
+        sock->rx_calls++;
+        if (res <= 0)
+            continue;
+
+        hev_socks5_udp_mux_dispatch (sock, res);
+    }
+
+    return NULL;
+}
+
+static int
+hev_socks5_udp_mux_socket (HevSocks5UDPMuxSock *sock)
+{
+    HevConfigServer *srv = sock->srv;
+    int size = hev_config_get_misc_udp_recv_buffer_size ();
+    socklen_t len;
+    int zero = 0;
+    int one = 1;
+    int fd;
+
+    fd = socket (AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0) {
+        setsockopt (fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof (zero));
+        family = AF_INET6;
+    } else {
+        fd = socket (AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            return -1;
+        family = AF_INET;
+    }
+
+    fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+    setsockopt (fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof (size));
+
+    if (srv->mark && (set_sock_mark (fd, srv->mark) < 0)) {
+        close (fd);
+        return -1;
+    }
+
+    /* Offloads are used only where the kernel knows them. */
+    len = sizeof (size);
+    sock->gso = getsockopt (fd, SOL_UDP, UDP_SEGMENT, &size, &len) == 0;
+    sock->gro = setsockopt (fd, SOL_UDP, UDP_GRO, &one, sizeof (one)) == 0;
+
+    return fd;
+}
+
+static int
+hev_socks5_udp_mux_sock_init (HevSocks5UDPMuxSock *sock,
+                              HevConfigServer *srv)
+{
+    sock->srv = srv;
+    sock->fd = -1;
+    sock->event[0] = -1;
+    sock->event[1] = -1;
+    pthread_mutex_init (&sock->tx_mutex, NULL);
+
+    sock->rx.bufs = hev_malloc (rx_size * MUX_BATCH);
+    sock->tx[0].bufs = hev_malloc (buf_size * MUX_BATCH);
+    sock->tx[1].bufs = hev_malloc (buf_size * MUX_BATCH);
+    if (!sock->rx.bufs || !sock->tx[0].bufs || !sock->tx[1].bufs)
+        return -1;
+
+    sock->fd = hev_socks5_udp_mux_socket (sock);
+    if (sock->fd < 0)
+        return -1;
+
+    if (pipe2 (sock->event, O_NONBLOCK | O_CLOEXEC) < 0)
+        return -1;
+
+    if (pthread_create (&sock->thread, NULL, hev_socks5_udp_mux_thread,
+                        sock) != 0) {
+        close (sock->event[0]);
+        close (sock->event[1]);
+        sock->event[0] = -1;
+        sock->event[1] = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+hev_socks5_udp_mux_init (pthread_mutex_t *mutex)
+{
+    int num = 0;
+    int i;
+
+    socks_num = hev_config_get_socks5_udp_shared_sockets ();
+    if (!socks_num)
+        return 0;
+
+    servers = hev_config_get_socks5_servers (&servers_num);
+    for (i = 0; i < servers_num; i++)
+        if (servers[i].udp_in_udp)
+            num++;
+    if (!num) {
+        socks_num = 0;
+        return 0;
+    }
+
+    lwip_mutex = mutex;
+    buf_size = hev_udp_slab_size () + MUX_HEADER;
+    rx_size = MUX_GRO_SIZE;
+
+    /* Sockets carry the mark of their server, servers over TCP get none. */
+    socks_total = socks_num * servers_num;
+    socks = hev_malloc0 (sizeof (HevSocks5UDPMuxSock) * socks_total);
+    if (!socks) {
+        socks_num = 0;
+        socks_total = 0;
+        return -1;
+    }
+
+    for (i = 0; i < socks_total; i++) {
+        HevConfigServer *srv = &servers[i / socks_num];
+
+        if (!srv->udp_in_udp)
+            continue;
+
+        if (hev_socks5_udp_mux_sock_init (&socks[i], srv) < 0) {
+            LOG_E ("socks5 udp mux socket");
+            socks_total = i + 1;
+            hev_socks5_udp_mux_fini ();
+            return -1;
+        }
+    }
+
+    LOG_I ("socks5 udp mux: %d shared sockets for %d servers", socks_num,
+           num);
+
+    return 0;
+}
+
+void
+hev_socks5_udp_mux_fini (void)
+{
+    int i;
+
+    for (i = 0; i < socks_total; i++) {
+        HevSocks5UDPMuxSock *sock = &socks[i];
+
+        if (!sock->srv)
+            continue;
+
+        if (sock->event[1] >= 0) {
+            char b = 0;
+
+            if (write (sock->event[1], &b, 1) == 1)
+                pthread_join (sock->thread, NULL);
+            close (sock->event[0]);
+            close (sock->event[1]);
+        }
+
+        if (sock->fd >= 0) {
+            close (sock->fd);
+            LOG_I ("socks5 udp mux %d: %lu rx segments in %lu calls (%lu "
+                   "gro) %lu tx segments in %lu calls (%lu gso) %lu unknown",
+                   i, sock->rx_packets, sock->rx_calls, sock->rx_gro,
+                   sock->tx_packets, sock->tx_calls, sock->tx_gso,
+                   sock->unknown);
+        }
+
+        pthread_mutex_destroy (&sock->tx_mutex);
+        if (sock->rx.bufs)
+            hev_free (sock->rx.bufs);
+        if (sock->tx[0].bufs)
+            hev_free (sock->tx[0].bufs);
+        if (sock->tx[1].bufs)
+            hev_free (sock->tx[1].bufs);
+    }
+
+    if (socks)
+        hev_free (socks);
+
+    socks = NULL;
+    socks_num = 0;
+    socks_total = 0;
+}
+
+int
+hev_socks5_udp_mux_enabled (void)
+{
+    return socks_num > 0;
+}
+
+#else /* __linux__ */
+
+int
+hev_socks5_udp_mux_init (pthread_mutex_t *mutex)
+{
+    if (hev_config_get_socks5_udp_shared_sockets ())
+        LOG_W ("socks5 udp shared sockets unsupported");
+
+    return 0;
+}
+
+void
+hev_socks5_udp_mux_fini (void)
+{
+}
+
+int
+hev_socks5_udp_mux_enabled (void)
+{
+    return 0;
+}
+
+int
+hev_socks5_udp_mux_add (HevSocks5UDPMuxEntry *entry)
+{
+    return -1;
+}
+
+void
+hev_socks5_udp_mux_del (HevSocks5UDPMuxEntry *entry)
+{
+}
+
+int
+hev_socks5_udp_mux_send (HevSocks5UDPMuxEntry *entry,
+                         const HevSocks5Addr *addr, const void *buf, int len)
+{
+    return -1;
+}
+
+#endif /* !__linux__ */
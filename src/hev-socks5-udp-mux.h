@@ -0,0 +1,94 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-udp-mux.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Socks5 Shared UDP Sockets
+ ============================================================================
+ */
+
+#ifndef __HEV_SOCKS5_UDP_MUX_H__
+#define __HEV_SOCKS5_UDP_MUX_H__
+
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include <hev-socks5-proto.h>
+
+#include "hev-config.h"
+
+typedef struct _HevSocks5UDPMuxEntry HevSocks5UDPMuxEntry;
+
+/*
+ * Called from a receive thread with the lwIP mutex held. @buf holds one
+ * datagram from the relay, socks5 UDP header included.
+ */
+typedef void (*HevSocks5UDPMuxHandler) (HevSocks5UDPMuxEntry *entry,
+                                        void *buf, int len);
+
+struct _HevSocks5UDPMuxEntry
+{
+    HevSocks5UDPMuxEntry *next;
+    HevSocks5UDPMuxHandler handler;
+    HevConfigServer *srv;
+
+    struct sockaddr_storage relay;
+    socklen_t relay_len;
+    int sock;
+    int added;
+};
+
+/**
+ * hev_socks5_udp_mux_init:
+ * @mutex: lwIP mutex, held while handlers run
+ *
+ * Open the shared UDP sockets set by socks5.udp-shared-sockets for each
+ * server using UDP over UDP, each with a receive thread. Nothing is opened
+ * when the option is 0.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int hev_socks5_udp_mux_init (pthread_mutex_t *mutex);
+void hev_socks5_udp_mux_fini (void);
+
+int hev_socks5_udp_mux_enabled (void);
+
+/**
+ * hev_socks5_udp_mux_add:
+ * @entry: entry with srv, relay, relay_len and handler set
+ *
+ * Route datagrams coming from the relay address of a UDP association to
+ * @entry, over the sockets of its server. Datagrams are told apart by the
+ * relay address alone, so an entry whose relay is already in use by
+ * another association of the same server is refused, the caller should
+ * use a socket of its own.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int hev_socks5_udp_mux_add (HevSocks5UDPMuxEntry *entry);
+
+/**
+ * hev_socks5_udp_mux_del:
+ * @entry: entry
+ *
+ * Stop routing to @entry. The handler is not running for it on return.
+ */
+void hev_socks5_udp_mux_del (HevSocks5UDPMuxEntry *entry);
+
+/**
+ * hev_socks5_udp_mux_send:
+ * @entry: entry
+ * @addr: destination
+ * @buf: payload
+ * @len: payload length
+ *
+ * Queue a datagram to the relay of @entry. Datagrams queued by sessions
+ * while one of them is sending go out together in the next sendmmsg.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int hev_socks5_udp_mux_send (HevSocks5UDPMuxEntry *entry,
+                             const HevSocks5Addr *addr, const void *buf,
+                             int len);
+
+#endif /* __HEV_SOCKS5_UDP_MUX_H__ */
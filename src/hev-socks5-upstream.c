@@ -0,0 +1,530 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-upstream.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Socks5 Upstream Servers
+ ============================================================================
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <hev-memory-allocator.h>
+
+#include "hev-logger.h"
+#include "hev-socks5-proxy.h"
+
+#include "hev-socks5-upstream.h"
+
+#define RING_POINTS (64)
+
+typedef struct _HevSocks5UpstreamPoint HevSocks5UpstreamPoint;
+
+struct _HevSocks5UpstreamPoint
+{
+    unsigned int hash;
+    unsigned int index;
+};
+
+static int balance;
+static int upstreams_num;
+static unsigned int next_upstream;
+static HevSocks5Upstream *upstreams;
+static HevSocks5UpstreamPoint *ring;
+
+static int resolve;
+static pthread_mutex_t addr_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int health_run;
+static int health_fall;
+static int health_rise;
+static int health_interval;
+static pthread_t health_thread;
+static pthread_mutex_t health_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t health_cond = PTHREAD_COND_INITIALIZER;
+
+unsigned int
+hev_socks5_upstream_hash (const void *data, int len)
+{
+    const uint8_t *p = data;
+    unsigned int hash = 2166136261u;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static int
+point_compare (const void *a, const void *b)
+{
+    const HevSocks5UpstreamPoint *pa = a;
+    const HevSocks5UpstreamPoint *pb = b;
+
+    if (pa->hash < pb->hash)
+        return -1;
+
+    return pa->hash > pb->hash;
+}
+
+static int
+hev_socks5_upstream_ring_init (void)
+{
+    int i, j;
+
+    ring = hev_malloc (sizeof (HevSocks5UpstreamPoint) * upstreams_num *
+                       RING_POINTS);
+    if (!ring)
+        return -1;
+
+    for (i = 0; i < upstreams_num; i++) {
+        HevConfigServer *srv = upstreams[i].srv;
+
+        for (j = 0; j < RING_POINTS; j++) {
+            HevSocks5UpstreamPoint *pt = &ring[i * RING_POINTS + j];
+            char key[300];
+            int len;
+
+            len = snprintf (key, sizeof (key), "%s:%u#%d", srv->addr,
+                            srv->port, j);
+            pt->hash = hev_socks5_upstream_hash (key, len);
+            pt->index = i;
+        }
+    }
+
+    qsort (ring, upstreams_num * RING_POINTS, sizeof (HevSocks5UpstreamPoint),
+           point_compare);
+
+    return 0;
+}
+
+static int
+usable (HevSocks5Upstream *up, HevSocks5Upstream *skip, int any)
+{
+    if (up == skip)
+        return 0;
+
+    return any || __atomic_load_n (&up->healthy, __ATOMIC_RELAXED);
+}
+
+static int
+select_round_robin (HevSocks5Upstream *skip, int any)
+{
+    unsigned int start;
+    int i;
+
+    start = __atomic_fetch_add (&next_upstream, 1, __ATOMIC_RELAXED);
+    for (i = 0; i < upstreams_num; i++) {
+        int index = (start + i) % upstreams_num;
+
+        if (usable (&upstreams[index], skip, any))
+            return index;
+    }
+
+    return -1;
+}
+
+static int
+select_hash (unsigned int hash, HevSocks5Upstream *skip, int any)
+{
+    int points = upstreams_num * RING_POINTS;
+    int lo = 0;
+    int hi = points;
+    int i;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+
+        if (ring[mid].hash < hash)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    /* Walk clockwise past ejected servers. */
+    for (i = 0; i < points; i++) {
+        int index = ring[(lo + i) % points].index;
+
+        if (usable (&upstreams[index], skip, any))
+            return index;
+    }
+
+    return -1;
+}
+
+static int
+select_least_sessions (HevSocks5Upstream *skip, int any)
+{
+    unsigned int min = -1;
+    int i, res = -1;
+
+    for (i = 0; i < upstreams_num; i++) {
+        unsigned int s;
+
+        if (!usable (&upstreams[i], skip, any))
+            continue;
+
+        s = __atomic_load_n (&upstreams[i].sessions, __ATOMIC_RELAXED);
+        if (s < min) {
+            min = s;
+            res = i;
+        }
+    }
+
+    return res;
+}
+
+static int
+select_latency (HevSocks5Upstream *skip, int any)
+{
+    unsigned long long min = -1;
+    int i, res = -1;
+
+    /* Weigh by load too, or the fastest server would take everything. */
+    for (i = 0; i < upstreams_num; i++) {
+        HevSocks5Upstream *up = &upstreams[i];
+        unsigned long long score;
+
+        if (!usable (up, skip, any))
+            continue;
+
+        score = __atomic_load_n (&up->latency, __ATOMIC_RELAXED) + 1;
+        score *= __atomic_load_n (&up->sessions, __ATOMIC_RELAXED) + 1;
+        if (score < min) {
+            min = score;
+            res = i;
+        }
+    }
+
+    return res;
+}
+
+static int
+select_index (unsigned int hash, HevSocks5Upstream *skip, int any)
+{
+    switch (balance) {
+    case HEV_CONFIG_BALANCE_LEAST_SESSIONS:
+        return select_least_sessions (skip, any);
+    case HEV_CONFIG_BALANCE_LATENCY:
+        return select_latency (skip, any);
+    case HEV_CONFIG_BALANCE_HASH:
+        return select_hash (hash, skip, any);
+    }
+
+    return select_round_robin (skip, any);
+}
+
+HevSocks5Upstream *
+hev_socks5_upstream_select (unsigned int hash)
+{
+    HevSocks5Upstream *self;
+    int index = 0;
+
+    if (upstreams_num > 1) {
+        index = select_index (hash, NULL, 0);
+        /* With every server ejected, keep trying them all. */
+        if (index < 0)
+            index = select_index (hash, NULL, 1);
+    }
+
+    self = &upstreams[index];
+    __atomic_add_fetch (&self->sessions, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&self->total, 1, __ATOMIC_RELAXED);
+
+    return self;
+}
+
+HevSocks5Upstream *
+hev_socks5_upstream_alternate (HevSocks5Upstream *self, unsigned int hash)
+{
+    int index;
+
+    if (upstreams_num < 2)
+        return NULL;
+
+    index = select_index (hash, self, 0);
+    if (index < 0)
+        return NULL;
+
+    return &upstreams[index];
+}
+
+void
+hev_socks5_upstream_switch (HevSocks5Upstream *self, HevSocks5Upstream *other)
+{
+    __atomic_sub_fetch (&self->sessions, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch (&self->total, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&other->sessions, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&other->total, 1, __ATOMIC_RELAXED);
+}
+
+void
+hev_socks5_upstream_report (HevSocks5Upstream *self, int usec)
+{
+    unsigned int latency;
+
+    if (usec < 0) {
+        __atomic_add_fetch (&self->failures, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    latency = __atomic_load_n (&self->latency, __ATOMIC_RELAXED);
+    if (latency)
+        latency = (latency * 7 + usec) / 8;
+    else
+        latency = usec;
+    __atomic_store_n (&self->latency, latency, __ATOMIC_RELAXED);
+}
+
+unsigned int
+hev_socks5_upstream_get_latency (void)
+{
+    unsigned int min = 0;
+    int i;
+
+    for (i = 0; i < upstreams_num; i++) {
+        HevSocks5Upstream *up = &upstreams[i];
+        unsigned int latency;
+
+        if (!usable (up, NULL, 0))
+            continue;
+
+        latency = __atomic_load_n (&up->latency, __ATOMIC_RELAXED);
+        if (latency && (!min || (latency < min)))
+            min = latency;
+    }
+
+    return min;
+}
+
+void
+hev_socks5_upstream_release (HevSocks5Upstream *self, unsigned long long tx,
+                             unsigned long long rx)
+{
+    __atomic_sub_fetch (&self->sessions, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&self->tx_bytes, tx, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&self->rx_bytes, rx, __ATOMIC_RELAXED);
+}
+
+int
+hev_socks5_upstream_get_addr (HevSocks5Upstream *self,
+                              struct sockaddr_storage *saddr,
+                              socklen_t *saddr_len)
+{
+    int res = -1;
+
+    pthread_mutex_lock (&addr_mutex);
+    if (self->saddr_len) {
+        memcpy (saddr, &self->saddr, self->saddr_len);
+        *saddr_len = self->saddr_len;
+        res = 0;
+    }
+    pthread_mutex_unlock (&addr_mutex);
+
+    return res;
+}
+
+static void
+hev_socks5_upstream_resolve (HevSocks5Upstream *self)
+{
+    struct sockaddr_storage saddr;
+    socklen_t saddr_len;
+
+    if (hev_socks5_proxy_resolve (self->srv, &saddr, &saddr_len) < 0) {
+        LOG_W ("socks5 upstream %s:%u resolve failed", self->srv->addr,
+               self->srv->port);
+        return;
+    }
+
+    pthread_mutex_lock (&addr_mutex);
+    memcpy (&self->saddr, &saddr, saddr_len);
+    self->saddr_len = saddr_len;
+    pthread_mutex_unlock (&addr_mutex);
+}
+
+static int
+hev_socks5_upstream_probe (HevSocks5Upstream *self, int timeout)
+{
+    struct timespec t0, t1;
+    int fd, res;
+
+    clock_gettime (CLOCK_MONOTONIC, &t0);
+
+    fd = hev_socks5_proxy_connect (self->srv, timeout);
+    if (fd < 0)
+        return -1;
+
+    res = hev_socks5_proxy_handshake (fd, self->srv, timeout);
+    close (fd);
+    if (res < 0)
+        return -1;
+
+    clock_gettime (CLOCK_MONOTONIC, &t1);
+    hev_socks5_upstream_report (self, (t1.tv_sec - t0.tv_sec) * 1000000 +
+                                          (t1.tv_nsec - t0.tv_nsec) / 1000);
+
+    return 0;
+}
+
+/*
+ * A server is ejected after health_fall failed probes in a row and used
+ * again after health_rise good ones, so a flapping server stays out.
+ */
+static void
+hev_socks5_upstream_mark (HevSocks5Upstream *self, int ok)
+{
+    HevConfigServer *srv = self->srv;
+
+    if (ok) {
+        self->fails = 0;
+        if (!self->healthy && (++self->passes >= health_rise)) {
+            __atomic_store_n (&self->healthy, 1, __ATOMIC_RELAXED);
+            LOG_I ("socks5 upstream %s:%u readmitted", srv->addr, srv->port);
+        }
+    } else {
+        self->passes = 0;
+        if (self->healthy && (++self->fails >= health_fall)) {
+            __atomic_store_n (&self->healthy, 0, __ATOMIC_RELAXED);
+            LOG_W ("socks5 upstream %s:%u ejected", srv->addr, srv->port);
+        }
+    }
+}
+
+static void *
+hev_socks5_upstream_health (void *data)
+{
+    int timeout;
+
+    timeout = hev_config_get_misc_connect_timeout ();
+    if (timeout > (health_interval * 1000))
+        timeout = health_interval * 1000;
+
+    pthread_mutex_lock (&health_mutex);
+    while (health_run) {
+        struct timespec ts;
+        int i;
+
+        clock_gettime (CLOCK_REALTIME, &ts);
+        ts.tv_sec += health_interval;
+        pthread_cond_timedwait (&health_cond, &health_mutex, &ts);
+
+        for (i = 0; health_run && (i < upstreams_num); i++) {
+            HevSocks5Upstream *up = &upstreams[i];
+            int res;
+
+            pthread_mutex_unlock (&health_mutex);
+            if (resolve)
+                hev_socks5_upstream_resolve (up);
+            res = hev_socks5_upstream_probe (up, timeout);
+            pthread_mutex_lock (&health_mutex);
+
+            hev_socks5_upstream_mark (up, res == 0);
+        }
+    }
+    pthread_mutex_unlock (&health_mutex);
+
+    return NULL;
+}
+
+int
+hev_socks5_upstream_init (void)
+{
+    HevConfigServer *srvs;
+    int i;
+
+    srvs = hev_config_get_socks5_servers (&upstreams_num);
+    balance = hev_config_get_socks5_balance ();
+    resolve = !!hev_config_get_socks5_race_delay ();
+
+    upstreams = hev_malloc0 (sizeof (HevSocks5Upstream) * upstreams_num);
+    if (!upstreams)
+        return -1;
+
+    for (i = 0; i < upstreams_num; i++) {
+        HevSocks5Upstream *up = &upstreams[i];
+
+        up->srv = &srvs[i];
+        up->healthy = 1;
+        if (resolve)
+            hev_socks5_upstream_resolve (up);
+        if (!up->srv->pool)
+            continue;
+
+        up->pool = hev_connection_pool_new (up->srv);
+        if (!up->pool)
+            return -1;
+    }
+
+    if ((balance == HEV_CONFIG_BALANCE_HASH) &&
+        (hev_socks5_upstream_ring_init () < 0))
+        return -1;
+
+    health_interval = hev_config_get_socks5_health_interval ();
+    health_fall = hev_config_get_socks5_health_fall ();
+    health_rise = hev_config_get_socks5_health_rise ();
+
+    if (health_interval) {
+        health_run = 1;
+        if (pthread_create (&health_thread, NULL, hev_socks5_upstream_health,
+                            NULL) != 0) {
+            health_run = 0;
+            return -1;
+        }
+    }
+
+    LOG_I ("socks5 upstream: %d servers", upstreams_num);
+
+    return 0;
+}
+
+void
+hev_socks5_upstream_fini (void)
+{
+    HevConfigServer *srv = hev_config_get_socks5_server ();
+    int i;
+
+    if (health_run) {
+        pthread_mutex_lock (&health_mutex);
+        health_run = 0;
+        pthread_cond_signal (&health_cond);
+        pthread_mutex_unlock (&health_mutex);
+        pthread_join (health_thread, NULL);
+    }
+
+    for (i = 0; upstreams && (i < upstreams_num); i++) {
+        HevSocks5Upstream *up = &upstreams[i];
+
+        if (up->pool)
+            hev_connection_pool_destroy (up->pool);
+
+        LOG_I ("socks5 upstream %s:%u: %lu sessions %lu failures %llu tx "
+               "%llu rx %u us latency",
+               up->srv->addr, up->srv->port, up->total, up->failures,
+               up->tx_bytes, up->rx_bytes, up->latency);
+    }
+
+    if (srv->fast_open) {
+        unsigned long hits, misses;
+
+        hev_socks5_proxy_fast_open_stats (&hits, &misses);
+        LOG_I ("fast open: %lu cookie hits %lu misses", hits, misses);
+    }
+
+    if (ring)
+        hev_free (ring);
+    if (upstreams)
+        hev_free (upstreams);
+
+    ring = NULL;
+    upstreams = NULL;
+    upstreams_num = 0;
+}
@@ -0,0 +1,126 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-upstream.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Socks5 Upstream Servers
+ ============================================================================
+ */
+
+#ifndef __HEV_SOCKS5_UPSTREAM_H__
+#define __HEV_SOCKS5_UPSTREAM_H__
+
+#include <sys/socket.h>
+
+#include "hev-config.h"
+#include "hev-connection-pool.h"
+
+typedef struct _HevSocks5Upstream HevSocks5Upstream;
+
+struct _HevSocks5Upstream
+{
+    HevConfigServer *srv;
+    HevConnectionPool *pool;
+
+    struct sockaddr_storage saddr;
+    socklen_t saddr_len;
+
+    unsigned int sessions;
+    unsigned int latency;
+    int healthy;
+    int fails;
+    int passes;
+
+    unsigned long total;
+    unsigned long failures;
+    unsigned long long tx_bytes;
+    unsigned long long rx_bytes;
+};
+
+int hev_socks5_upstream_init (void);
+void hev_socks5_upstream_fini (void);
+
+/**
+ * hev_socks5_upstream_select:
+ * @hash: destination hash, see hev_socks5_upstream_hash
+ *
+ * Pick a server for a new session with the configured balance mode and
+ * count the session as active on it.
+ *
+ * Returns: the upstream, never NULL
+ */
+HevSocks5Upstream *hev_socks5_upstream_select (unsigned int hash);
+
+/**
+ * hev_socks5_upstream_alternate:
+ * @self: upstream that is slow to connect
+ * @hash: destination hash
+ *
+ * Pick another healthy server to race against @self. The session is not
+ * moved until hev_socks5_upstream_switch.
+ *
+ * Returns: the upstream, or NULL when there is none
+ */
+HevSocks5Upstream *hev_socks5_upstream_alternate (HevSocks5Upstream *self,
+                                                  unsigned int hash);
+
+/**
+ * hev_socks5_upstream_switch:
+ * @self: upstream the session was counted on
+ * @other: upstream that won the race
+ *
+ * Move an active session from @self to @other.
+ */
+void hev_socks5_upstream_switch (HevSocks5Upstream *self,
+                                 HevSocks5Upstream *other);
+
+/**
+ * hev_socks5_upstream_report:
+ * @self: upstream
+ * @usec: connect and handshake time, or -1 on failure
+ *
+ * Feed the connect latency average used by the latency balance mode.
+ * Session failures do not eject a server, as they include destinations
+ * the server refused; only health probes do.
+ */
+void hev_socks5_upstream_report (HevSocks5Upstream *self, int usec);
+
+/**
+ * hev_socks5_upstream_release:
+ * @self: upstream
+ * @tx: bytes sent to the server by the session
+ * @rx: bytes received from the server by the session
+ *
+ * End a session started by hev_socks5_upstream_select.
+ */
+void hev_socks5_upstream_release (HevSocks5Upstream *self,
+                                  unsigned long long tx,
+                                  unsigned long long rx);
+
+/**
+ * hev_socks5_upstream_get_latency:
+ *
+ * Returns: connect latency average of the fastest healthy server (us),
+ * 0 if none was measured yet
+ */
+unsigned int hev_socks5_upstream_get_latency (void);
+
+/**
+ * hev_socks5_upstream_get_addr:
+ * @self: upstream
+ * @saddr: (out): server address
+ * @saddr_len: (out): length of @saddr
+ *
+ * Copy the server address resolved at start and refreshed with every
+ * health probe, so sessions racing connects never block in a lookup.
+ * Only kept when race-delay is set.
+ *
+ * Returns: 0 on success, -1 if the server was not resolved yet
+ */
+int hev_socks5_upstream_get_addr (HevSocks5Upstream *self,
+                                  struct sockaddr_storage *saddr,
+                                  socklen_t *saddr_len);
+
+unsigned int hev_socks5_upstream_hash (const void *data, int len);
+
+#endif /* __HEV_SOCKS5_UPSTREAM_H__ */
@@ -0,0 +1,333 @@
+/*
+ ============================================================================
+ Name        : hev-tcp-buffer.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : TCP Relay Buffer
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include <lwip/tcp.h>
+
+#include <hev-memory-allocator.h>
+
+#include "hev-config.h"
+#include "hev-logger.h"
+
+#include "hev-tcp-buffer.h"
+
+#define CHUNK_SIZE_MAX (16384)
+#define IDLE_CHUNKS (64)
+#define SIZE_BUCKETS (12)
+
+struct _HevTCPBufferChunk
+{
+    HevTCPBufferChunk *next;
+
+    unsigned char data[0];
+};
+
+static unsigned int chunk_size;
+static size_t max_size;
+static unsigned long budget;
+
+static HevTCPBufferChunk *idle;
+static int idle_num;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned long used;
+static unsigned long peak;
+static unsigned long denied;
+static unsigned long sizes[SIZE_BUCKETS];
+
+static HevTCPBufferChunk *
+hev_tcp_buffer_chunk_get (int force)
+{
+    HevTCPBufferChunk *chunk;
+
+    pthread_mutex_lock (&mutex);
+    if (!force && budget && (used >= budget)) {
+        denied++;
+        pthread_mutex_unlock (&mutex);
+        return NULL;
+    }
+
+    chunk = idle;
+    if (chunk) {
+        idle = chunk->next;
+        idle_num--;
+    }
+    if (++used > peak)
+        peak = used;
+    pthread_mutex_unlock (&mutex);
+
+    if (!chunk) {
+        chunk = hev_malloc (sizeof (HevTCPBufferChunk) + chunk_size);
+        if (!chunk) {
+            pthread_mutex_lock (&mutex);
+            used--;
+            pthread_mutex_unlock (&mutex);
+            return NULL;
+        }
+    }
+
+    chunk->next = NULL;
+    return chunk;
+}
+
+static void
+hev_tcp_buffer_chunk_put (HevTCPBufferChunk *chunk)
+{
+    pthread_mutex_lock (&mutex);
+    used--;
+    if (idle_num < IDLE_CHUNKS) {
+        chunk->next = idle;
+        idle = chunk;
+        idle_num++;
+        chunk = NULL;
+    }
+    pthread_mutex_unlock (&mutex);
+
+    if (chunk)
+        hev_free (chunk);
+}
+
+void
+hev_tcp_buffer_clear (HevTCPBuffer *self)
+{
+    while (self->head) {
+        HevTCPBufferChunk *chunk = self->head;
+
+        self->head = chunk->next;
+        hev_tcp_buffer_chunk_put (chunk);
+    }
+
+    self->read = NULL;
+    self->tail = NULL;
+    self->head_off = 0;
+    self->read_off = 0;
+    self->tail_off = 0;
+    self->chunks = 0;
+    self->use_size = 0;
+}
+
+size_t
+hev_tcp_buffer_get_use_size (HevTCPBuffer *self)
+{
+    return self->use_size;
+}
+
+void
+hev_tcp_buffer_set_limit (HevTCPBuffer *self, size_t size)
+{
+    int i;
+
+    self->limit = size;
+    if (self->limit > TCP_SND_BUF)
+        self->limit = TCP_SND_BUF;
+
+    /* Buckets of 4 KiB, 8 KiB, ... with the last one open ended. */
+    for (i = 0; (i < (SIZE_BUCKETS - 1)) && (size > (4096UL << i)); i++)
+        ;
+    __atomic_add_fetch (&sizes[i], 1, __ATOMIC_RELAXED);
+}
+
+size_t
+hev_tcp_buffer_get_limit (HevTCPBuffer *self)
+{
+    return self->limit ? self->limit : max_size;
+}
+
+int
+hev_tcp_buffer_writing (HevTCPBuffer *self, struct iovec *iov)
+{
+    size_t limit = hev_tcp_buffer_get_limit (self);
+    size_t len;
+
+    if (self->use_size >= limit)
+        return 0;
+
+    if (!self->tail || (self->tail_off == chunk_size)) {
+        HevTCPBufferChunk *chunk;
+
+        chunk = hev_tcp_buffer_chunk_get (self->chunks == 0);
+        if (!chunk)
+            return 0;
+
+        if (self->tail) {
+            self->tail->next = chunk;
+        } else {
+            self->head = chunk;
+            self->read = chunk;
+        }
+        self->tail = chunk;
+        self->tail_off = 0;
+        self->chunks++;
+    }
+
+    len = chunk_size - self->tail_off;
+    if (len > (limit - self->use_size))
+        len = limit - self->use_size;
+
+    iov[0].iov_base = self->tail->data + self->tail_off;
+    iov[0].iov_len = len;
+
+    return 1;
+}
+
+void
+hev_tcp_buffer_write_finish (HevTCPBuffer *self, size_t size)
+{
+    self->tail_off += size;
+    self->use_size += size;
+
+    if (!self->use_size && self->chunks)
+        hev_tcp_buffer_clear (self);
+}
+
+int
+hev_tcp_buffer_reading (HevTCPBuffer *self, struct iovec *iov)
+{
+    HevTCPBufferChunk *chunk = self->read;
+    unsigned int off = self->read_off;
+    int iovc = 0;
+
+    while (chunk && (iovc < 2)) {
+        unsigned int end;
+
+        end = (chunk == self->tail) ? self->tail_off : chunk_size;
+        if (off < end) {
+            iov[iovc].iov_base = chunk->data + off;
+            iov[iovc].iov_len = end - off;
+            iovc++;
+        }
+
+        if (chunk == self->tail)
+            break;
+
+        chunk = chunk->next;
+        off = 0;
+    }
+
+    return iovc;
+}
+
+void
+hev_tcp_buffer_read_finish (HevTCPBuffer *self, size_t size)
+{
+    while (size) {
+        unsigned int end;
+        size_t len;
+
+        if (self->read_off == chunk_size) {
+            self->read = self->read->next;
+            self->read_off = 0;
+        }
+
+        end = (self->read == self->tail) ? self->tail_off : chunk_size;
+        len = end - self->read_off;
+        if (len > size)
+            len = size;
+
+        self->read_off += len;
+        size -= len;
+    }
+}
+
+void
+hev_tcp_buffer_read_release (HevTCPBuffer *self, size_t size)
+{
+    self->use_size -= size;
+
+    while (size || (self->head_off == chunk_size)) {
+        HevTCPBufferChunk *chunk = self->head;
+        unsigned int end;
+        size_t len;
+
+        end = (chunk == self->tail) ? self->tail_off : chunk_size;
+        len = end - self->head_off;
+        if (len > size)
+            len = size;
+
+        self->head_off += len;
+        size -= len;
+
+        /* The tail stays, writing may be filling it without the lock. */
+        if ((self->head_off < chunk_size) || (chunk == self->tail))
+            break;
+
+        self->head = chunk->next;
+        self->head_off = 0;
+        if (self->read == chunk) {
+            self->read = self->head;
+            self->read_off = 0;
+        }
+        self->chunks--;
+        hev_tcp_buffer_chunk_put (chunk);
+    }
+}
+
+int
+hev_tcp_buffer_init (void)
+{
+    size_t limit;
+
+    max_size = hev_config_get_misc_tcp_buffer_size ();
+    chunk_size = CHUNK_SIZE_MAX;
+    if (chunk_size > max_size)
+        chunk_size = max_size;
+    if (!chunk_size)
+        return -1;
+
+    limit = hev_config_get_misc_tcp_buffer_budget ();
+    budget = limit / chunk_size;
+    if (limit && !budget)
+        budget = 1;
+
+    LOG_I ("tcp buffer: %u bytes per chunk, %lu chunks budget", chunk_size,
+           budget);
+
+    return 0;
+}
+
+int
+hev_tcp_buffer_get_usage (void)
+{
+    if (!budget)
+        return 0;
+
+    return __atomic_load_n (&used, __ATOMIC_RELAXED) * 100 / budget;
+}
+
+void
+hev_tcp_buffer_fini (void)
+{
+    LOG_I ("tcp buffer: %lu peak %lu in use %lu denied", peak, used, denied);
+
+    if (hev_config_get_misc_tcp_buffer_max_size () > 0) {
+        char line[256];
+        int i, len = 0;
+
+        for (i = 0; i < SIZE_BUCKETS; i++) {
+            len += snprintf (line + len, sizeof (line) - len, " %luK%s:%lu",
+                             4UL << i, (i == (SIZE_BUCKETS - 1)) ? "+" : "",
+                             sizes[i]);
+            sizes[i] = 0;
+        }
+        LOG_I ("tcp buffer sizes:%s", line);
+    }
+
+    while (idle) {
+        HevTCPBufferChunk *chunk = idle;
+
+        idle = chunk->next;
+        hev_free (chunk);
+    }
+
+    idle_num = 0;
+    peak = 0;
+    denied = 0;
+}
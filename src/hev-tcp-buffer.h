@@ -0,0 +1,104 @@
+/*
+ ============================================================================
+ Name        : hev-tcp-buffer.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : TCP Relay Buffer
+ ============================================================================
+ */
+
+#ifndef __HEV_TCP_BUFFER_H__
+#define __HEV_TCP_BUFFER_H__
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+typedef struct _HevTCPBuffer HevTCPBuffer;
+typedef struct _HevTCPBufferChunk HevTCPBufferChunk;
+
+/*
+ * A queue of chunks borrowed from a shared pool. Data is written at the
+ * tail, read out to lwIP and released once acknowledged, like the ring
+ * buffer it replaces. Chunks go back to the pool as soon as they are
+ * released, so an idle session holds no buffer memory. A zeroed struct
+ * is an empty buffer.
+ */
+struct _HevTCPBuffer
+{
+    HevTCPBufferChunk *head;
+    HevTCPBufferChunk *read;
+    HevTCPBufferChunk *tail;
+    unsigned int head_off;
+    unsigned int read_off;
+    unsigned int tail_off;
+    unsigned int chunks;
+    size_t use_size;
+    size_t limit;
+};
+
+/**
+ * hev_tcp_buffer_init:
+ *
+ * Set up the chunk pool. Each session may buffer up to misc.tcp-buffer-size
+ * bytes and all sessions together up to misc.tcp-buffer-budget, except that
+ * an empty buffer may always borrow one chunk so no session stalls.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int hev_tcp_buffer_init (void);
+void hev_tcp_buffer_fini (void);
+
+/**
+ * hev_tcp_buffer_get_usage:
+ *
+ * Returns: share of the budget borrowed by all sessions (%), 0 without
+ * a budget
+ */
+int hev_tcp_buffer_get_usage (void);
+
+/**
+ * hev_tcp_buffer_clear:
+ * @self: buffer
+ *
+ * Return all chunks to the pool and empty the buffer.
+ */
+void hev_tcp_buffer_clear (HevTCPBuffer *self);
+
+size_t hev_tcp_buffer_get_use_size (HevTCPBuffer *self);
+
+/**
+ * hev_tcp_buffer_set_limit:
+ * @self: buffer
+ * @size: bytes this buffer may hold, 0 for misc.tcp-buffer-size
+ *
+ * Cap the buffer of one session, at most to the lwIP send buffer. Chosen
+ * sizes are kept in a histogram that is logged on exit.
+ */
+void hev_tcp_buffer_set_limit (HevTCPBuffer *self, size_t size);
+size_t hev_tcp_buffer_get_limit (HevTCPBuffer *self);
+
+/**
+ * hev_tcp_buffer_writing:
+ * @self: buffer
+ * @iov: one iovec
+ *
+ * Borrow a chunk when the tail is full and point @iov at the free space.
+ *
+ * Returns: 1, or 0 when the session cap or the pool budget is reached
+ */
+int hev_tcp_buffer_writing (HevTCPBuffer *self, struct iovec *iov);
+
+/**
+ * hev_tcp_buffer_write_finish:
+ * @self: buffer
+ * @size: bytes written, may be 0
+ *
+ * Commit written bytes. A buffer left empty gives its chunk back.
+ */
+void hev_tcp_buffer_write_finish (HevTCPBuffer *self, size_t size);
+
+int hev_tcp_buffer_reading (HevTCPBuffer *self, struct iovec *iov);
+void hev_tcp_buffer_read_finish (HevTCPBuffer *self, size_t size);
+void hev_tcp_buffer_read_release (HevTCPBuffer *self, size_t size);
+
+#endif /* __HEV_TCP_BUFFER_H__ */
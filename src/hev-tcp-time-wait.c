@@ -0,0 +1,318 @@
+/*
+ ============================================================================
+ Name        : hev-tcp-time-wait.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Compact TCP TIME_WAIT Table
+ ============================================================================
+ */
+
+#include <time.h>
+#include <string.h>
+
+#include <lwip/ip.h>
+
+#include <hev-memory-allocator.h>
+
+#include "hev-logger.h"
+
+#include "hev-tcp-time-wait.h"
+
+#define TW_ENTRIES (4096)
+#define TW_BUCKETS (4096)
+
+#define TCP_SYN (0x02)
+#define TCP_RST (0x04)
+
+typedef struct _HevTCPTimeWaitKey HevTCPTimeWaitKey;
+typedef struct _HevTCPTimeWaitEntry HevTCPTimeWaitEntry;
+
+struct _HevTCPTimeWaitKey
+{
+    uint8_t raddr[16];
+    uint8_t laddr[16];
+    uint16_t rport;
+    uint16_t lport;
+    uint32_t family;
+};
+
+struct _HevTCPTimeWaitEntry
+{
+    HevTCPTimeWaitKey key;
+    uint32_t expire;
+    int next;
+};
+
+struct _HevTCPTimeWait
+{
+    int timeout;
+    unsigned int use;
+    unsigned int head;
+    unsigned int tail;
+
+    unsigned long stores;
+    unsigned long drops;
+    unsigned long reopens;
+    unsigned long evicts;
+
+    int buckets[TW_BUCKETS];
+    HevTCPTimeWaitEntry entries[TW_ENTRIES];
+};
+
+static HevTCPTimeWait *singleton;
+
+static uint32_t
+monotonic_msec (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static unsigned int
+hev_tcp_time_wait_hash (const HevTCPTimeWaitKey *key)
+{
+    const uint8_t *b = (const uint8_t *)key;
+    uint32_t h = 2166136261u;
+    unsigned int i;
+
+    for (i = 0; i < sizeof (HevTCPTimeWaitKey); i++) {
+        h ^= b[i];
+        h *= 16777619u;
+    }
+
+    return (h ^ (h >> 16)) & (TW_BUCKETS - 1);
+}
+
+HevTCPTimeWait *
+hev_tcp_time_wait_new (int timeout)
+{
+    HevTCPTimeWait *self;
+    int i;
+
+    self = hev_malloc0 (sizeof (HevTCPTimeWait));
+    if (!self)
+        return NULL;
+
+    self->timeout = timeout;
+    for (i = 0; i < TW_BUCKETS; i++)
+        self->buckets[i] = -1;
+
+    LOG_D ("%p tcp time wait new", self);
+
+    return self;
+}
+
+void
+hev_tcp_time_wait_destroy (HevTCPTimeWait *self)
+{
+    LOG_D ("%p tcp time wait destroy", self);
+
+    LOG_I ("tcp time wait: %lu stores %lu drops %lu reopens %lu evicts",
+           self->stores, self->drops, self->reopens, self->evicts);
+
+    hev_free (self);
+}
+
+HevTCPTimeWait *
+hev_tcp_time_wait_get (void)
+{
+    return singleton;
+}
+
+void
+hev_tcp_time_wait_put (HevTCPTimeWait *self)
+{
+    singleton = self;
+}
+
+static int
+hev_tcp_time_wait_find (HevTCPTimeWait *self, const HevTCPTimeWaitKey *key,
+                        int **link)
+{
+    int *prev = &self->buckets[hev_tcp_time_wait_hash (key)];
+
+    while (*prev >= 0) {
+        HevTCPTimeWaitEntry *e = &self->entries[*prev];
+
+        if (memcmp (&e->key, key, sizeof (HevTCPTimeWaitKey)) == 0) {
+            *link = prev;
+            return *prev;
+        }
+        prev = &e->next;
+    }
+
+    return -1;
+}
+
+/* Unlinks a live entry, its ring slot is reclaimed once the head passes. */
+static void
+hev_tcp_time_wait_remove (HevTCPTimeWait *self, HevTCPTimeWaitEntry *e)
+{
+    int *link;
+    int i;
+
+    i = hev_tcp_time_wait_find (self, &e->key, &link);
+    if (i >= 0)
+        *link = e->next;
+
+    e->key.family = 0;
+    self->use--;
+}
+
+static void
+hev_tcp_time_wait_pop (HevTCPTimeWait *self)
+{
+    HevTCPTimeWaitEntry *e;
+
+    e = &self->entries[self->head & (TW_ENTRIES - 1)];
+    if (e->key.family)
+        hev_tcp_time_wait_remove (self, e);
+    self->head++;
+}
+
+void
+hev_tcp_time_wait_expire (HevTCPTimeWait *self)
+{
+    uint32_t now = monotonic_msec ();
+
+    while (self->head != self->tail) {
+        HevTCPTimeWaitEntry *e;
+
+        e = &self->entries[self->head & (TW_ENTRIES - 1)];
+        if (e->key.family && ((int32_t)(e->expire - now) > 0))
+            break;
+        hev_tcp_time_wait_pop (self);
+    }
+}
+
+static int
+hev_tcp_time_wait_key_from_ip (HevTCPTimeWaitKey *key, const ip_addr_t *r,
+                               const ip_addr_t *l)
+{
+    if (IP_IS_V4 (r)) {
+        memcpy (key->raddr, &ip_2_ip4 (r)->addr, 4);
+        memcpy (key->laddr, &ip_2_ip4 (l)->addr, 4);
+        key->family = 4;
+    } else if (IP_IS_V6 (r)) {
+        memcpy (key->raddr, ip_2_ip6 (r)->addr, 16);
+        memcpy (key->laddr, ip_2_ip6 (l)->addr, 16);
+        key->family = 6;
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+hev_tcp_time_wait_store (HevTCPTimeWait *self, const struct tcp_pcb *pcb)
+{
+    HevTCPTimeWaitEntry *e;
+    HevTCPTimeWaitKey key;
+    unsigned int h;
+    int *link;
+    int i;
+
+    memset (&key, 0, sizeof (key));
+    if (hev_tcp_time_wait_key_from_ip (&key, &pcb->remote_ip,
+                                       &pcb->local_ip) < 0)
+        return;
+    key.rport = pcb->remote_port;
+    key.lport = pcb->local_port;
+
+    hev_tcp_time_wait_expire (self);
+
+    /* A reused 4-tuple restarts its wait. */
+    i = hev_tcp_time_wait_find (self, &key, &link);
+    if (i >= 0)
+        hev_tcp_time_wait_remove (self, &self->entries[i]);
+
+    if ((self->tail - self->head) == TW_ENTRIES) {
+        hev_tcp_time_wait_pop (self);
+        self->evicts++;
+    }
+
+    i = self->tail & (TW_ENTRIES - 1);
+    e = &self->entries[i];
+    h = hev_tcp_time_wait_hash (&key);
+    e->key = key;
+    e->expire = monotonic_msec () + self->timeout;
+    e->next = self->buckets[h];
+    self->buckets[h] = i;
+    self->tail++;
+    self->use++;
+    self->stores++;
+}
+
+int
+hev_tcp_time_wait_filter (HevTCPTimeWait *self, const struct pbuf *p)
+{
+    const uint8_t *ip = p->payload;
+    const uint8_t *tcp;
+    HevTCPTimeWaitEntry *e;
+    HevTCPTimeWaitKey key;
+    int *link;
+    int i;
+
+    if (!self->use || (p->len < 40))
+        return 0;
+
+    memset (&key, 0, sizeof (key));
+    switch (ip[0] >> 4) {
+    case 4: {
+        int hlen = (ip[0] & 0xf) * 4;
+
+        /* Only the first fragment carries the ports. */
+        if ((ip[9] != IP_PROTO_TCP) || (ip[6] & 0x1f) || ip[7] ||
+            (p->len < (hlen + 14)))
+            return 0;
+        memcpy (key.raddr, &ip[12], 4);
+        memcpy (key.laddr, &ip[16], 4);
+        key.family = 4;
+        tcp = ip + hlen;
+        break;
+    }
+    case 6:
+        if ((ip[6] != IP_PROTO_TCP) || (p->len < (40 + 14)))
+            return 0;
+        memcpy (key.raddr, &ip[8], 16);
+        memcpy (key.laddr, &ip[24], 16);
+        key.family = 6;
+        tcp = ip + 40;
+        break;
+    default:
+        return 0;
+    }
+
+    key.rport = (tcp[0] << 8) | tcp[1];
+    key.lport = (tcp[2] << 8) | tcp[3];
+
+    i = hev_tcp_time_wait_find (self, &key, &link);
+    if (i < 0)
+        return 0;
+
+    e = &self->entries[i];
+    if ((int32_t)(e->expire - monotonic_msec ()) <= 0) {
+        hev_tcp_time_wait_remove (self, e);
+        return 0;
+    }
+
+    if (tcp[13] & (TCP_SYN | TCP_RST)) {
+        hev_tcp_time_wait_remove (self, e);
+        self->reopens++;
+        return 0;
+    }
+
+    /* A late ACK or retransmitted FIN: lwIP has no pcb and would reset. */
+    self->drops++;
+    return 1;
+}
+
+unsigned int
+hev_tcp_time_wait_get_use (HevTCPTimeWait *self)
+{
+    return self->use;
+}
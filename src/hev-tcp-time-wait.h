@@ -0,0 +1,67 @@
+/*
+ ============================================================================
+ Name        : hev-tcp-time-wait.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Compact TCP TIME_WAIT Table
+ ============================================================================
+ */
+
+#ifndef __HEV_TCP_TIME_WAIT_H__
+#define __HEV_TCP_TIME_WAIT_H__
+
+#include <lwip/tcp.h>
+#include <lwip/pbuf.h>
+
+typedef struct _HevTCPTimeWait HevTCPTimeWait;
+
+/**
+ * hev_tcp_time_wait_new:
+ * @timeout: how long closed connections are remembered (ms)
+ *
+ * Create a table that stands in for TUN side pcbs in TIME_WAIT with
+ * their 4-tuples only, so the pcbs can be freed as their sessions end.
+ * All calls must hold the lwIP lock.
+ *
+ * Returns: new table instance
+ */
+HevTCPTimeWait *hev_tcp_time_wait_new (int timeout);
+void hev_tcp_time_wait_destroy (HevTCPTimeWait *self);
+
+HevTCPTimeWait *hev_tcp_time_wait_get (void);
+void hev_tcp_time_wait_put (HevTCPTimeWait *self);
+
+/**
+ * hev_tcp_time_wait_store:
+ * @self: table instance
+ * @pcb: pcb in TIME_WAIT, about to be freed
+ *
+ * Remember the 4-tuple of @pcb. The oldest entry makes room when the
+ * table is full.
+ */
+void hev_tcp_time_wait_store (HevTCPTimeWait *self, const struct tcp_pcb *pcb);
+
+/**
+ * hev_tcp_time_wait_filter:
+ * @self: table instance
+ * @p: packet read from the TUN device
+ *
+ * Check a packet against the remembered connections. A SYN or RST ends
+ * the TIME_WAIT of its 4-tuple and goes on to lwIP, any other segment
+ * of a remembered connection is late and must be dropped.
+ *
+ * Returns: 1 if the caller should drop @p, 0 otherwise
+ */
+int hev_tcp_time_wait_filter (HevTCPTimeWait *self, const struct pbuf *p);
+
+/**
+ * hev_tcp_time_wait_expire:
+ * @self: table instance
+ *
+ * Forget the connections whose TIME_WAIT has passed.
+ */
+void hev_tcp_time_wait_expire (HevTCPTimeWait *self);
+
+unsigned int hev_tcp_time_wait_get_use (HevTCPTimeWait *self);
+
+#endif /* __HEV_TCP_TIME_WAIT_H__ */
@@ -272,6 +272,12 @@ hev_thread_pool_get_thread_count (HevThreadPool *pool)
     return pool ? pool->num_threads : 0;
 }
 
+int
+hev_thread_pool_get_queue_size (HevThreadPool *pool)
+{
+    return pool ? __atomic_load_n (&pool->queue_size, __ATOMIC_RELAXED) : 0;
+}
+
 void
 hev_thread_pool_wait_all (HevThreadPool *pool)
 {
@@ -56,6 +56,16 @@ int hev_thread_pool_submit (HevThreadPool *pool, HevThreadPoolTask task,
  */
 int hev_thread_pool_get_thread_count (HevThreadPool *pool);
 
+/**
+ * hev_thread_pool_get_queue_size:
+ * @pool: thread pool instance
+ *
+ * Get the number of tasks waiting for a worker thread.
+ *
+ * Returns: number of queued tasks
+ */
+int hev_thread_pool_get_queue_size (HevThreadPool *pool);
+
 /**
  * hev_thread_pool_wait_all:
  * @pool: thread pool instance
@@ -0,0 +1,127 @@
+/*
+ ============================================================================
+ Name        : hev-timing-wheel.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Hashed Timing Wheel
+ ============================================================================
+ */
+
+#include <stddef.h>
+
+#include <hev-memory-allocator.h>
+
+#include "hev-compiler.h"
+#include "hev-logger.h"
+
+#include "hev-timing-wheel.h"
+
+#define WHEEL_SLOTS (512)
+
+struct _HevTimingWheel
+{
+    unsigned int now;
+
+    HevList slots[WHEEL_SLOTS];
+};
+
+HevTimingWheel *
+hev_timing_wheel_new (void)
+{
+    HevTimingWheel *self;
+
+    self = hev_malloc0 (sizeof (HevTimingWheel));
+    if (!self)
+        return NULL;
+
+    LOG_D ("%p timing wheel new", self);
+
+    return self;
+}
+
+void
+hev_timing_wheel_destroy (HevTimingWheel *self)
+{
+    LOG_D ("%p timing wheel destroy", self);
+
+    hev_free (self);
+}
+
+/*
+ * Deadlines past one turn land in the last slot of this turn and are
+ * carried on from there, so a slot is never its own successor.
+ */
+static void
+hev_timing_wheel_schedule (HevTimingWheel *self, HevTimingWheelNode *node,
+                           unsigned int delta)
+{
+    if (delta >= WHEEL_SLOTS)
+        delta = WHEEL_SLOTS - 1;
+    else if (delta == 0)
+        delta = 1;
+
+    node->slot = (self->now + delta) & (WHEEL_SLOTS - 1);
+    hev_list_add_tail (&self->slots[node->slot], &node->node);
+}
+
+void
+hev_timing_wheel_add (HevTimingWheel *self, HevTimingWheelNode *node,
+                      unsigned int timeout)
+{
+    node->active = self->now;
+    node->timeout = timeout;
+    hev_timing_wheel_schedule (self, node, timeout);
+}
+
+void
+hev_timing_wheel_del (HevTimingWheel *self, HevTimingWheelNode *node)
+{
+    if (node->slot < 0)
+        return;
+
+    hev_list_del (&self->slots[node->slot], &node->node);
+    node->slot = -1;
+}
+
+void
+hev_timing_wheel_touch (HevTimingWheel *self, HevTimingWheelNode *node)
+{
+    unsigned int now = __atomic_load_n (&self->now, __ATOMIC_RELAXED);
+
+    __atomic_store_n (&node->active, now, __ATOMIC_RELAXED);
+}
+
+void
+hev_timing_wheel_tick (HevTimingWheel *self, HevTimingWheelHandler handler,
+                       void *data)
+{
+    HevListNode *n;
+    HevList *slot;
+    unsigned int now;
+
+    now = self->now + 1;
+    __atomic_store_n (&self->now, now, __ATOMIC_RELAXED);
+
+    /* Take the whole slot, nodes carried on go to later slots. */
+    slot = &self->slots[now & (WHEEL_SLOTS - 1)];
+    n = hev_list_first (slot);
+    slot->head = NULL;
+    slot->tail = NULL;
+
+    while (n) {
+        HevTimingWheelNode *node;
+        unsigned int idle;
+
+        node = container_of (n, HevTimingWheelNode, node);
+        n = hev_list_node_next (n);
+
+        idle = now - __atomic_load_n (&node->active, __ATOMIC_RELAXED);
+        if (idle < node->timeout) {
+            hev_timing_wheel_schedule (self, node, node->timeout - idle);
+            continue;
+        }
+
+        node->slot = -1;
+        handler (node, data);
+    }
+}
@@ -0,0 +1,70 @@
+/*
+ ============================================================================
+ Name        : hev-timing-wheel.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Hashed Timing Wheel
+ ============================================================================
+ */
+
+#ifndef __HEV_TIMING_WHEEL_H__
+#define __HEV_TIMING_WHEEL_H__
+
+#include "hev-list.h"
+
+typedef struct _HevTimingWheel HevTimingWheel;
+typedef struct _HevTimingWheelNode HevTimingWheelNode;
+typedef void (*HevTimingWheelHandler) (HevTimingWheelNode *node, void *data);
+
+struct _HevTimingWheelNode
+{
+    HevListNode node;
+    unsigned int active;
+    unsigned int timeout;
+    int slot;
+};
+
+HevTimingWheel *hev_timing_wheel_new (void);
+void hev_timing_wheel_destroy (HevTimingWheel *self);
+
+/**
+ * hev_timing_wheel_add:
+ * @self: wheel instance
+ * @node: node to track
+ * @timeout: idle ticks before @node expires
+ *
+ * Start tracking @node as active now.
+ */
+void hev_timing_wheel_add (HevTimingWheel *self, HevTimingWheelNode *node,
+                           unsigned int timeout);
+
+/**
+ * hev_timing_wheel_del:
+ * @self: wheel instance
+ * @node: tracked or expired node
+ */
+void hev_timing_wheel_del (HevTimingWheel *self, HevTimingWheelNode *node);
+
+/**
+ * hev_timing_wheel_touch:
+ * @self: wheel instance
+ * @node: tracked node
+ *
+ * Mark @node active now. This only stores the current tick, so it needs
+ * no lock; the node moves to its new slot when its old one comes round.
+ */
+void hev_timing_wheel_touch (HevTimingWheel *self, HevTimingWheelNode *node);
+
+/**
+ * hev_timing_wheel_tick:
+ * @self: wheel instance
+ * @handler: called for each node idle for its timeout
+ * @data: handler data
+ *
+ * Advance the wheel by one tick. Expired nodes leave the wheel before
+ * @handler sees them.
+ */
+void hev_timing_wheel_tick (HevTimingWheel *self, HevTimingWheelHandler handler,
+                            void *data);
+
+#endif /* __HEV_TIMING_WHEEL_H__ */
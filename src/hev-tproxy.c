@@ -0,0 +1,181 @@
+/*
+ ============================================================================
+ Name        : hev-tproxy.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Transparent TCP Listener
+ ============================================================================
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#include <hev-memory-allocator.h>
+#include <hev-socks5-misc.h>
+
+#include "hev-config.h"
+#include "hev-logger.h"
+
+#include "hev-tproxy.h"
+
+#ifndef SO_ORIGINAL_DST
+#define SO_ORIGINAL_DST (80)
+#endif
+
+#ifndef IPV6_TRANSPARENT
+#define IPV6_TRANSPARENT (75)
+#endif
+
+struct _HevTProxy
+{
+    int fd;
+    int run;
+    pthread_t thread;
+    HevTProxyHandler handler;
+
+    unsigned long accepted;
+};
+
+int
+hev_tproxy_get_original_dst (int fd, struct sockaddr_storage *addr,
+                             socklen_t *len)
+{
+#if defined(__linux__)
+    struct sockaddr_in6 *sa6 = (struct sockaddr_in6 *)addr;
+
+    /* TPROXY keeps the original destination as the local address. */
+    if (getsockname (fd, (struct sockaddr *)addr, len) < 0)
+        return -1;
+    if (!hev_config_get_tproxy_redirect ())
+        return 0;
+
+    /* REDIRECT rewrote it, ask conntrack. */
+    if ((addr->ss_family == AF_INET) ||
+        ((addr->ss_family == AF_INET6) &&
+         IN6_IS_ADDR_V4MAPPED (&sa6->sin6_addr))) {
+        *len = sizeof (struct sockaddr_in);
+        return getsockopt (fd, SOL_IP, SO_ORIGINAL_DST, addr, len);
+    }
+
+    *len = sizeof (struct sockaddr_in6);
+    return getsockopt (fd, SOL_IPV6, SO_ORIGINAL_DST, addr, len);
+#endif
+    return -1;
+}
+
+static void *
+hev_tproxy_thread (void *data)
+{
+    HevTProxy *self = data;
+
+    while (self->run) {
+        int fd;
+
+        fd = accept4 (self->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (!self->run || (errno == EINVAL))
+                break;
+            if ((errno == EMFILE) || (errno == ENFILE)) {
+                LOG_W ("%p tproxy accept: %s", self, strerror (errno));
+                usleep (100000);
+            }
+            continue;
+        }
+
+        self->accepted++;
+        self->handler (fd);
+    }
+
+    return NULL;
+}
+
+HevTProxy *
+hev_tproxy_new (HevTProxyHandler handler)
+{
+#if defined(__linux__)
+    struct sockaddr_in6 saddr;
+    HevTProxy *self;
+    int one = 1;
+    int zero = 0;
+    int res;
+
+    self = hev_malloc0 (sizeof (HevTProxy));
+    if (!self)
+        return NULL;
+
+    res = hev_socks5_resolve_to_sockaddr6 (hev_config_get_tproxy_address (),
+                                           hev_config_get_tproxy_port (),
+                                           &saddr);
+    if (res < 0) {
+        LOG_E ("tproxy address %s", hev_config_get_tproxy_address ());
+        goto free;
+    }
+
+    self->fd = socket (AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (self->fd < 0)
+        goto free;
+
+    setsockopt (self->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+    setsockopt (self->fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof (zero));
+
+    if (!hev_config_get_tproxy_redirect ()) {
+        res = setsockopt (self->fd, SOL_IP, IP_TRANSPARENT, &one,
+                          sizeof (one));
+        res |= setsockopt (self->fd, SOL_IPV6, IPV6_TRANSPARENT, &one,
+                           sizeof (one));
+        if (res < 0) {
+            LOG_E ("tproxy transparent: %s", strerror (errno));
+            goto close;
+        }
+    }
+
+    if (bind (self->fd, (struct sockaddr *)&saddr, sizeof (saddr)) < 0) {
+        LOG_E ("tproxy bind: %s", strerror (errno));
+        goto close;
+    }
+
+    if (listen (self->fd, SOMAXCONN) < 0)
+        goto close;
+
+    self->run = 1;
+    self->handler = handler;
+
+    if (pthread_create (&self->thread, NULL, hev_tproxy_thread, self) != 0)
+        goto close;
+
+    LOG_D ("%p tproxy new", self);
+
+    return self;
+
+close:
+    close (self->fd);
+free:
+    hev_free (self);
+#else
+    LOG_E ("tproxy is only supported on linux");
+#endif
+    return NULL;
+}
+
+void
+hev_tproxy_destroy (HevTProxy *self)
+{
+    LOG_D ("%p tproxy destroy", self);
+
+    /* Wakes the blocked accept, which then fails with EINVAL. */
+    self->run = 0;
+    shutdown (self->fd, SHUT_RDWR);
+    pthread_join (self->thread, NULL);
+    close (self->fd);
+
+    LOG_I ("tproxy: %lu accepted", self->accepted);
+
+    hev_free (self);
+}
@@ -0,0 +1,49 @@
+/*
+ ============================================================================
+ Name        : hev-tproxy.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Transparent TCP Listener
+ ============================================================================
+ */
+
+#ifndef __HEV_TPROXY_H__
+#define __HEV_TPROXY_H__
+
+#include <sys/socket.h>
+
+typedef struct _HevTProxy HevTProxy;
+typedef void (*HevTProxyHandler) (int fd);
+
+/**
+ * hev_tproxy_new:
+ * @handler: called on the listener thread for each accepted connection
+ *
+ * Listen on the tproxy address and port for TCP connections that the
+ * kernel terminated on behalf of their original destination, diverted
+ * by a TPROXY or REDIRECT rule. Linux only.
+ *
+ * Returns: new listener instance
+ */
+HevTProxy *hev_tproxy_new (HevTProxyHandler handler);
+
+/**
+ * hev_tproxy_destroy:
+ * @self: listener instance
+ *
+ * Stop accepting and close the listening socket.
+ */
+void hev_tproxy_destroy (HevTProxy *self);
+
+/**
+ * hev_tproxy_get_original_dst:
+ * @fd: accepted connection
+ * @addr: original destination
+ * @len: size of @addr, updated
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int hev_tproxy_get_original_dst (int fd, struct sockaddr_storage *addr,
+                                 socklen_t *len);
+
+#endif /* __HEV_TPROXY_H__ */
@@ -397,6 +397,12 @@ hev_tunnel_io_set_read_callback (HevTunnelIO *io,
     pthread_mutex_unlock (&io->callback_mutex);
 }
 
+int
+hev_tunnel_io_get_write_queue_size (HevTunnelIO *io)
+{
+    return io ? __atomic_load_n (&io->write_queue_size, __ATOMIC_RELAXED) : 0;
+}
+
 void
 hev_tunnel_io_get_stats (HevTunnelIO *io, size_t *tx_packets, size_t *tx_bytes,
                          size_t *rx_packets, size_t *rx_bytes)
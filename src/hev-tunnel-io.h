@@ -73,6 +73,16 @@ void hev_tunnel_io_set_read_callback (HevTunnelIO *io,
                                       void (*callback) (struct pbuf *, void *),
                                       void *user_data);
 
+/**
+ * hev_tunnel_io_get_write_queue_size:
+ * @io: tunnel I/O instance
+ *
+ * Get the number of packets waiting to be written to the tunnel.
+ *
+ * Returns: number of queued packets
+ */
+int hev_tunnel_io_get_write_queue_size (HevTunnelIO *io);
+
 /**
  * hev_tunnel_io_get_stats:
  * @io: tunnel I/O instance
@@ -0,0 +1,136 @@
+/*
+ ============================================================================
+ Name        : hev-udp-slab.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : UDP Buffer Slab
+ ============================================================================
+ */
+
+#include <pthread.h>
+
+#include <hev-memory-allocator.h>
+
+#include "hev-config.h"
+#include "hev-logger.h"
+#include "hev-config-const.h"
+
+#include "hev-udp-slab.h"
+
+#define SLAB_SLOTS (64)
+#define SLOT_ALIGN (64)
+
+typedef struct _HevUDPSlabChunk HevUDPSlabChunk;
+
+struct _HevUDPSlabChunk
+{
+    HevUDPSlabChunk *next;
+};
+
+static int slot_size;
+static void *free_slots;
+static HevUDPSlabChunk *chunks;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned long used;
+static unsigned long peak;
+static unsigned long total;
+
+/* Called with the mutex held. Carves a new chunk into free slots. */
+static int
+hev_udp_slab_grow (void)
+{
+    HevUDPSlabChunk *chunk;
+    char *base;
+    int i;
+
+    chunk = hev_malloc (SLOT_ALIGN + (size_t)slot_size * SLAB_SLOTS);
+    if (!chunk)
+        return -1;
+
+    chunk->next = chunks;
+    chunks = chunk;
+
+    base = (char *)chunk + SLOT_ALIGN;
+    for (i = 0; i < SLAB_SLOTS; i++) {
+        void **slot = (void **)(base + (size_t)slot_size * i);
+
+        *slot = free_slots;
+        free_slots = slot;
+    }
+
+    total += SLAB_SLOTS;
+
+    return 0;
+}
+
+void *
+hev_udp_slab_alloc (void)
+{
+    void **slot;
+
+    pthread_mutex_lock (&mutex);
+    if (!free_slots && (hev_udp_slab_grow () < 0)) {
+        pthread_mutex_unlock (&mutex);
+        return NULL;
+    }
+
+    slot = free_slots;
+    free_slots = *slot;
+    if (++used > peak)
+        peak = used;
+    pthread_mutex_unlock (&mutex);
+
+    return slot;
+}
+
+void
+hev_udp_slab_free (void *slot)
+{
+    pthread_mutex_lock (&mutex);
+    *(void **)slot = free_slots;
+    free_slots = slot;
+    used--;
+    pthread_mutex_unlock (&mutex);
+}
+
+int
+hev_udp_slab_size (void)
+{
+    return slot_size;
+}
+
+int
+hev_udp_slab_init (void)
+{
+    slot_size = hev_config_get_tunnel_mtu ();
+    if (slot_size < UDP_BUF_SIZE)
+        slot_size = UDP_BUF_SIZE;
+    if (slot_size > 65535)
+        slot_size = 65535;
+
+    /* Keep slots cache line aligned. */
+    slot_size = (slot_size + SLOT_ALIGN - 1) & ~(SLOT_ALIGN - 1);
+
+    LOG_I ("udp slab: %d bytes per slot", slot_size);
+
+    return 0;
+}
+
+void
+hev_udp_slab_fini (void)
+{
+    LOG_I ("udp slab: %lu slots %lu peak %lu in use", total, peak, used);
+
+    while (chunks) {
+        HevUDPSlabChunk *chunk = chunks;
+
+        chunks = chunk->next;
+        hev_free (chunk);
+    }
+
+    free_slots = NULL;
+    total = 0;
+    peak = 0;
+    used = 0;
+}
@@ -0,0 +1,48 @@
+/*
+ ============================================================================
+ Name        : hev-udp-slab.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : UDP Buffer Slab
+ ============================================================================
+ */
+
+#ifndef __HEV_UDP_SLAB_H__
+#define __HEV_UDP_SLAB_H__
+
+/**
+ * hev_udp_slab_init:
+ *
+ * Set up the shared pool of UDP datagram slots. Each slot holds a whole
+ * datagram of the tunnel MTU, so jumbo datagrams are never truncated.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int hev_udp_slab_init (void);
+void hev_udp_slab_fini (void);
+
+/**
+ * hev_udp_slab_size:
+ *
+ * Returns: size of each slot in bytes
+ */
+int hev_udp_slab_size (void);
+
+/**
+ * hev_udp_slab_alloc:
+ *
+ * Take a slot from the pool, growing it when empty.
+ *
+ * Returns: slot, or NULL when out of memory
+ */
+void *hev_udp_slab_alloc (void);
+
+/**
+ * hev_udp_slab_free:
+ * @slot: slot from hev_udp_slab_alloc
+ *
+ * Return a slot to the pool for reuse by any session.
+ */
+void hev_udp_slab_free (void *slot);
+
+#endif /* __HEV_UDP_SLAB_H__ */
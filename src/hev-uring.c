@@ -0,0 +1,446 @@
+/*
+ ============================================================================
+ Name        : hev-uring.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Per-thread io_uring
+ ============================================================================
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#include <hev-memory-allocator.h>
+
+#include "hev-config.h"
+#include "hev-logger.h"
+
+#include "hev-uring.h"
+
+#define RING_ENTRIES (8)
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+
+struct _HevUring
+{
+    int fd;
+
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    unsigned int sq_entries;
+    struct io_uring_sqe *sqes;
+
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ptr;
+    void *cq_ptr;
+    size_t sq_len;
+    size_t cq_len;
+    size_t sqes_len;
+
+    unsigned int queued;
+
+    unsigned long enters;
+    unsigned long sqes_num;
+    unsigned long cqes_num;
+};
+
+static pthread_key_t key;
+static int enabled;
+static int failed;
+
+static unsigned long rings;
+static unsigned long enters;
+static unsigned long sqes_num;
+static unsigned long cqes_num;
+
+static void
+hev_uring_destroy (void *data)
+{
+    HevUring *self = data;
+
+    if (!self)
+        return;
+
+    __atomic_add_fetch (&enters, self->enters, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&sqes_num, self->sqes_num, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&cqes_num, self->cqes_num, __ATOMIC_RELAXED);
+
+    munmap (self->sqes, self->sqes_len);
+    if (self->cq_ptr != self->sq_ptr)
+        munmap (self->cq_ptr, self->cq_len);
+    munmap (self->sq_ptr, self->sq_len);
+    close (self->fd);
+
+    hev_free (self);
+}
+
+static HevUring *
+hev_uring_new (void)
+{
+    unsigned int features = IORING_FEAT_NODROP | IORING_FEAT_SUBMIT_STABLE;
+    struct io_uring_params p;
+    HevUring *self;
+    int fds[1] = { -1 };
+    char *sq, *cq;
+
+    self = hev_malloc0 (sizeof (HevUring));
+    if (!self)
+        return NULL;
+
+    memset (&p, 0, sizeof (p));
+    self->fd = syscall (__NR_io_uring_setup, RING_ENTRIES, &p);
+    if (self->fd < 0)
+        goto free;
+
+    /* iovecs are read at submit and completions are never dropped. */
+    if ((p.features & features) != features) {
+        errno = ENOTSUP;
+        goto close;
+    }
+
+    self->sq_len = p.sq_off.array + p.sq_entries * sizeof (unsigned int);
+    self->cq_len = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (self->cq_len > self->sq_len)
+            self->sq_len = self->cq_len;
+        self->cq_len = self->sq_len;
+    }
+
+    self->sq_ptr = mmap (NULL, self->sq_len, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, self->fd, IORING_OFF_SQ_RING);
+    if (self->sq_ptr == MAP_FAILED)
+        goto close;
+
+    self->cq_ptr = self->sq_ptr;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        self->cq_ptr = mmap (NULL, self->cq_len, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, self->fd,
+                             IORING_OFF_CQ_RING);
+        if (self->cq_ptr == MAP_FAILED)
+            goto unmap_sq;
+    }
+
+    self->sqes_len = p.sq_entries * sizeof (struct io_uring_sqe);
+    self->sqes = mmap (NULL, self->sqes_len, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, self->fd, IORING_OFF_SQES);
+    if (self->sqes == MAP_FAILED)
+        goto unmap_cq;
+
+    sq = self->sq_ptr;
+    self->sq_head = (unsigned int *)(sq + p.sq_off.head);
+    self->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+    self->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+    self->sq_array = (unsigned int *)(sq + p.sq_off.array);
+    self->sq_entries = p.sq_entries;
+
+    cq = self->cq_ptr;
+    self->cq_head = (unsigned int *)(cq + p.cq_off.head);
+    self->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+    self->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+    self->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    /* One empty fixed file slot, filled per session. */
+    if (syscall (__NR_io_uring_register, self->fd, IORING_REGISTER_FILES, fds,
+                 1) < 0)
+        goto unmap_sqes;
+
+    __atomic_add_fetch (&rings, 1, __ATOMIC_RELAXED);
+    LOG_D ("%p uring new", self);
+
+    return self;
+
+unmap_sqes:
+    munmap (self->sqes, self->sqes_len);
+unmap_cq:
+    if (self->cq_ptr != self->sq_ptr)
+        munmap (self->cq_ptr, self->cq_len);
+unmap_sq:
+    munmap (self->sq_ptr, self->sq_len);
+close:
+    close (self->fd);
+free:
+    hev_free (self);
+    return NULL;
+}
+
+HevUring *
+hev_uring_get (void)
+{
+    HevUring *self;
+
+    if (!enabled)
+        return NULL;
+
+    self = pthread_getspecific (key);
+    if (self)
+        return self;
+
+    self = hev_uring_new ();
+    if (!self) {
+        if (!__atomic_exchange_n (&failed, 1, __ATOMIC_RELAXED))
+            LOG_W ("uring: %s, using readv/writev", strerror (errno));
+        return NULL;
+    }
+
+    pthread_setspecific (key, self);
+
+    return self;
+}
+
+int
+hev_uring_get_fd (HevUring *self)
+{
+    return self->fd;
+}
+
+int
+hev_uring_set_file (HevUring *self, int fd)
+{
+    struct io_uring_files_update up;
+
+    memset (&up, 0, sizeof (up));
+    up.fds = (unsigned long)&fd;
+
+    if (syscall (__NR_io_uring_register, self->fd,
+                 IORING_REGISTER_FILES_UPDATE, &up, 1) < 0)
+        return -1;
+
+    return 0;
+}
+
+static struct io_uring_sqe *
+hev_uring_get_sqe (HevUring *self)
+{
+    unsigned int tail = *self->sq_tail;
+    unsigned int head;
+    unsigned int idx;
+    struct io_uring_sqe *sqe;
+
+    head = __atomic_load_n (self->sq_head, __ATOMIC_ACQUIRE);
+    if ((tail - head) >= self->sq_entries)
+        return NULL;
+
+    idx = tail & *self->sq_mask;
+    sqe = &self->sqes[idx];
+    memset (sqe, 0, sizeof (*sqe));
+    self->sq_array[idx] = idx;
+
+    return sqe;
+}
+
+static void
+hev_uring_put_sqe (HevUring *self)
+{
+    __atomic_store_n (self->sq_tail, *self->sq_tail + 1, __ATOMIC_RELEASE);
+    self->queued++;
+}
+
+static int
+hev_uring_rw (HevUring *self, int op, const struct iovec *iov, int iovc,
+              unsigned long long data)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = hev_uring_get_sqe (self);
+    if (!sqe)
+        return -1;
+
+    sqe->opcode = op;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = 0;
+    sqe->addr = (unsigned long)iov;
+    sqe->len = iovc;
+    sqe->user_data = data;
+    hev_uring_put_sqe (self);
+
+    return 0;
+}
+
+int
+hev_uring_readv (HevUring *self, const struct iovec *iov, int iovc,
+                 unsigned long long data)
+{
+    return hev_uring_rw (self, IORING_OP_READV, iov, iovc, data);
+}
+
+int
+hev_uring_writev (HevUring *self, const struct iovec *iov, int iovc,
+                  unsigned long long data)
+{
+    return hev_uring_rw (self, IORING_OP_WRITEV, iov, iovc, data);
+}
+
+int
+hev_uring_cancel (HevUring *self, unsigned long long data)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = hev_uring_get_sqe (self);
+    if (!sqe)
+        return -1;
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = data;
+    /* The cancel reports its own completion, tagged with no data. */
+    sqe->user_data = 0;
+    hev_uring_put_sqe (self);
+
+    return 0;
+}
+
+int
+hev_uring_submit (HevUring *self, int wait)
+{
+    unsigned int flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    int res;
+
+    if (!self->queued && !wait)
+        return 0;
+
+    do {
+        res = syscall (__NR_io_uring_enter, self->fd, self->queued, wait ? 1 : 0,
+                       flags, NULL, 0);
+    } while ((res < 0) && (errno == EINTR));
+    if (res < 0)
+        return -1;
+
+    self->enters++;
+    self->sqes_num += res;
+    self->queued -= res;
+
+    return 0;
+}
+
+int
+hev_uring_reap (HevUring *self, unsigned long long *data, int *res)
+{
+    unsigned int head = *self->cq_head;
+    struct io_uring_cqe *cqe;
+
+    if (head == __atomic_load_n (self->cq_tail, __ATOMIC_ACQUIRE))
+        return 0;
+
+    cqe = &self->cqes[head & *self->cq_mask];
+    *data = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n (self->cq_head, head + 1, __ATOMIC_RELEASE);
+    self->cqes_num++;
+
+    return 1;
+}
+
+int
+hev_uring_init (void)
+{
+    if (!hev_config_get_misc_tcp_io_uring ())
+        return 0;
+
+    if (pthread_key_create (&key, hev_uring_destroy) != 0)
+        return -1;
+
+    enabled = 1;
+    failed = 0;
+
+    return 0;
+}
+
+void
+hev_uring_fini (void)
+{
+    if (!enabled)
+        return;
+
+    /* Worker threads have exited and destroyed their rings by now. */
+    LOG_I ("uring: %lu rings %lu enters %lu sqes %lu cqes", rings, enters,
+           sqes_num, cqes_num);
+
+    pthread_key_delete (key);
+    enabled = 0;
+    rings = 0;
+    enters = 0;
+    sqes_num = 0;
+    cqes_num = 0;
+}
+
+#else /* !__linux__ */
+
+HevUring *
+hev_uring_get (void)
+{
+    return NULL;
+}
+
+int
+hev_uring_get_fd (HevUring *self)
+{
+    return -1;
+}
+
+int
+hev_uring_set_file (HevUring *self, int fd)
+{
+    return -1;
+}
+
+int
+hev_uring_readv (HevUring *self, const struct iovec *iov, int iovc,
+                 unsigned long long data)
+{
+    return -1;
+}
+
+int
+hev_uring_writev (HevUring *self, const struct iovec *iov, int iovc,
+                  unsigned long long data)
+{
+    return -1;
+}
+
+int
+hev_uring_cancel (HevUring *self, unsigned long long data)
+{
+    return -1;
+}
+
+int
+hev_uring_submit (HevUring *self, int wait)
+{
+    return -1;
+}
+
+int
+hev_uring_reap (HevUring *self, unsigned long long *data, int *res)
+{
+    return 0;
+}
+
+int
+hev_uring_init (void)
+{
+    if (hev_config_get_misc_tcp_io_uring ())
+        LOG_W ("uring: not supported, using readv/writev");
+
+    return 0;
+}
+
+void
+hev_uring_fini (void)
+{
+}
+
+#endif
@@ -0,0 +1,75 @@
+/*
+ ============================================================================
+ Name        : hev-uring.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Per-thread io_uring
+ ============================================================================
+ */
+
+#ifndef __HEV_URING_H__
+#define __HEV_URING_H__
+
+#include <sys/uio.h>
+
+typedef struct _HevUring HevUring;
+
+int hev_uring_init (void);
+void hev_uring_fini (void);
+
+/**
+ * hev_uring_get:
+ *
+ * Get the ring of the calling thread, set up on first use and torn down
+ * when the thread exits. The ring has a single fixed file slot, see
+ * hev_uring_set_file, and its fd polls readable while completions wait.
+ *
+ * Returns: ring instance, NULL if disabled or not supported by the kernel
+ */
+HevUring *hev_uring_get (void);
+
+int hev_uring_get_fd (HevUring *self);
+
+/**
+ * hev_uring_set_file:
+ * @self: ring instance
+ * @fd: file descriptor, -1 to clear the slot
+ *
+ * Install @fd in the fixed file slot used by readv and writev.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int hev_uring_set_file (HevUring *self, int fd);
+
+/*
+ * Queue an operation on the fixed file. @data comes back with its
+ * completion. Nothing reaches the kernel before hev_uring_submit.
+ */
+int hev_uring_readv (HevUring *self, const struct iovec *iov, int iovc,
+                     unsigned long long data);
+int hev_uring_writev (HevUring *self, const struct iovec *iov, int iovc,
+                      unsigned long long data);
+int hev_uring_cancel (HevUring *self, unsigned long long data);
+
+/**
+ * hev_uring_submit:
+ * @self: ring instance
+ * @wait: block until at least one completion is ready
+ *
+ * Submit everything queued with one io_uring_enter.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int hev_uring_submit (HevUring *self, int wait);
+
+/**
+ * hev_uring_reap:
+ * @self: ring instance
+ * @data: data of the completed operation
+ * @res: result, as the syscall would return or -errno
+ *
+ * Returns: 1 if a completion was taken, 0 if there are none
+ */
+int hev_uring_reap (HevUring *self, unsigned long long *data, int *res);
+
+#endif /* __HEV_URING_H__ */
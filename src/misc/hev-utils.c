@@ -8,11 +8,34 @@
  */
 
 #include <stdio.h>
+#include <errno.h>
 #include <unistd.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/resource.h>
 
+#if defined(__linux__)
+#include <netinet/in.h>
+#include <linux/tcp.h>
+#include <linux/errqueue.h>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY (60)
+#endif
+
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY (0x4000000)
+#endif
+
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY (5)
+#endif
+
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED (1)
+#endif
+#endif
+
 #if defined(__APPLE__)
 #include <Availability.h>
 #include <AvailabilityMacros.h>
@@ -21,8 +44,10 @@
 
 #include <hev-socks5-misc.h>
 
+#include "hev-config.h"
 #include "hev-logger.h"
 #include "hev-mapped-dns.h"
+#include "hev-config-const.h"
 
 #include "hev-utils.h"
 
@@ -72,6 +97,193 @@ set_sock_mark (int fd, unsigned int mark)
     return 0;
 }
 
+int
+set_sock_nodelay (int fd)
+{
+#if defined(__linux__)
+    int one = 1;
+
+    return setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+#endif
+    return 0;
+}
+
+int
+set_sock_fast_open (int fd)
+{
+#if defined(__linux__) && defined(TCP_FASTOPEN_CONNECT)
+    int one = 1;
+
+    return setsockopt (fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &one,
+                       sizeof (one));
+#endif
+    return -1;
+}
+
+int
+get_sock_fast_open (int fd)
+{
+#if defined(__linux__)
+    struct tcp_info info;
+    socklen_t len = sizeof (info);
+
+    if (getsockopt (fd, IPPROTO_TCP, TCP_INFO, &info, &len) < 0)
+        return -1;
+
+    return !!(info.tcpi_options & TCPI_OPT_SYN_DATA);
+#endif
+    return -1;
+}
+
+int
+get_sock_rtt (int fd)
+{
+#if defined(__linux__)
+    struct tcp_info info;
+    socklen_t len = sizeof (info);
+
+    if (getsockopt (fd, IPPROTO_TCP, TCP_INFO, &info, &len) < 0)
+        return -1;
+
+    return info.tcpi_rtt;
+#endif
+    return -1;
+}
+
+int
+set_sock_buffer_size (int fd, int size)
+{
+    int res;
+
+    res = setsockopt (fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof (size));
+    res |= setsockopt (fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof (size));
+
+    return res;
+}
+
+int
+set_sock_zerocopy (int fd)
+{
+#if defined(__linux__)
+    int one = 1;
+
+    return setsockopt (fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof (one));
+#endif
+    return -1;
+}
+
+int
+set_sock_linger_reset (int fd)
+{
+    struct linger l = { 1, 0 };
+
+    return setsockopt (fd, SOL_SOCKET, SO_LINGER, &l, sizeof (l));
+}
+
+ssize_t
+send_zerocopy (int fd, const struct iovec *iov, int iovc)
+{
+#if defined(__linux__)
+    struct msghdr mh = { 0 };
+
+    mh.msg_iov = (struct iovec *)iov;
+    mh.msg_iovlen = iovc;
+
+    return sendmsg (fd, &mh, MSG_ZEROCOPY);
+#endif
+    errno = EOPNOTSUPP;
+    return -1;
+}
+
+int
+get_sock_zerocopy (int fd, unsigned int *lo, unsigned int *hi, int *copied)
+{
+#if defined(__linux__)
+    for (;;) {
+        char buf[CMSG_SPACE (sizeof (struct sock_extended_err) +
+                             sizeof (struct sockaddr_in6))];
+        struct msghdr mh = { 0 };
+        struct cmsghdr *cm;
+
+        mh.msg_control = buf;
+        mh.msg_controllen = sizeof (buf);
+
+        if (recvmsg (fd, &mh, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+            return (errno == EAGAIN) ? 0 : -1;
+
+        for (cm = CMSG_FIRSTHDR (&mh); cm; cm = CMSG_NXTHDR (&mh, cm)) {
+            struct sock_extended_err *serr;
+
+            if (!((cm->cmsg_level == SOL_IP) &&
+                  (cm->cmsg_type == IP_RECVERR)) &&
+                !((cm->cmsg_level == SOL_IPV6) &&
+                  (cm->cmsg_type == IPV6_RECVERR)))
+                continue;
+
+            serr = (struct sock_extended_err *)CMSG_DATA (cm);
+            if (serr->ee_errno || (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY))
+                continue;
+
+            *lo = serr->ee_info;
+            *hi = serr->ee_data;
+            *copied = !!(serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+            return 1;
+        }
+    }
+#endif
+    return 0;
+}
+
+int
+set_sock_profile (int fd, const HevSocks5Addr *addr)
+{
+    HevConfigProfile *profile;
+    int res = 0;
+
+    profile = hev_config_get_profile (hev_socks5_addr_get_port (addr));
+    if (!profile)
+        return 0;
+
+#if defined(__linux__)
+    if (profile->nodelay >= 0)
+        res |= setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &profile->nodelay,
+                           sizeof (int));
+    if (profile->notsent_lowat >= 0)
+        res |= setsockopt (fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+                           &profile->notsent_lowat, sizeof (int));
+    if (profile->congestion[0])
+        res |= setsockopt (fd, IPPROTO_TCP, TCP_CONGESTION,
+                           profile->congestion, strlen (profile->congestion));
+    if (profile->busy_poll >= 0)
+        res |= setsockopt (fd, SOL_SOCKET, SO_BUSY_POLL, &profile->busy_poll,
+                           sizeof (int));
+    if (profile->priority >= 0)
+        res |= setsockopt (fd, SOL_SOCKET, SO_PRIORITY, &profile->priority,
+                           sizeof (int));
+    if (profile->keepalive >= 0) {
+        int on = profile->keepalive > 0;
+
+        res |= setsockopt (fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof (on));
+        if (on) {
+            /* Probe every third of the idle time, give up after three. */
+            int intvl = profile->keepalive / 3;
+            int cnt = 3;
+
+            if (intvl < 1)
+                intvl = 1;
+            res |= setsockopt (fd, IPPROTO_TCP, TCP_KEEPIDLE,
+                               &profile->keepalive, sizeof (int));
+            res |= setsockopt (fd, IPPROTO_TCP, TCP_KEEPINTVL, &intvl,
+                               sizeof (intvl));
+            res |= setsockopt (fd, IPPROTO_TCP, TCP_KEEPCNT, &cnt,
+                               sizeof (cnt));
+        }
+    }
+#endif
+
+    return res ? -1 : 0;
+}
+
 int
 hev_socks5_addr_from_lwip (HevSocks5Addr *addr, const ip_addr_t *ip, u16_t port)
 {
@@ -114,3 +326,14 @@ hev_socks5_addr_into_lwip (const HevSocks5Addr *addr, ip_addr_t *ip,
         return -1;
     }
 }
+
+unsigned short
+hev_socks5_addr_get_port (const HevSocks5Addr *addr)
+{
+    uint16_t port;
+
+    /* The port closes every address type. */
+    memcpy (&port, (const uint8_t *)addr + hev_socks5_addr_len (addr) - 2, 2);
+
+    return ntohs (port);
+}
@@ -10,16 +10,41 @@
 #ifndef __HEV_UTILS_H__
 #define __HEV_UTILS_H__
 
+#include <sys/uio.h>
+
 #include <lwip/ip_addr.h>
 #include <hev-socks5-proto.h>
 
 void run_as_daemon (const char *pid_file);
 int set_limit_nofile (int limit_nofile);
 int set_sock_mark (int fd, unsigned int mark);
+int set_sock_nodelay (int fd);
+int set_sock_fast_open (int fd);
+int get_sock_fast_open (int fd);
+int get_sock_rtt (int fd);
+int set_sock_buffer_size (int fd, int size);
+int set_sock_zerocopy (int fd);
+int set_sock_linger_reset (int fd);
+
+/*
+ * Send with MSG_ZEROCOPY, the pages of @iov must stay untouched until
+ * get_sock_zerocopy reports the send id, one per successful call.
+ * Returns 1 with the range of completed ids, 0 when none are pending.
+ */
+ssize_t send_zerocopy (int fd, const struct iovec *iov, int iovc);
+int get_sock_zerocopy (int fd, unsigned int *lo, unsigned int *hi, int *copied);
+
+/*
+ * Apply the socket profile matching the destination port of @addr. Best
+ * effort, returns -1 if any option was refused, e.g. a congestion control
+ * that isn't loaded.
+ */
+int set_sock_profile (int fd, const HevSocks5Addr *addr);
 
 int hev_socks5_addr_from_lwip (HevSocks5Addr *addr, const ip_addr_t *ip,
                                u16_t port);
 int hev_socks5_addr_into_lwip (const HevSocks5Addr *addr, ip_addr_t *ip,
                                u16_t *port);
+unsigned short hev_socks5_addr_get_port (const HevSocks5Addr *addr);
 
 #endif /* __HEV_UTILS_H__ */
@@ -0,0 +1,30 @@
+/*
+ ============================================================================
+ Name        : hev-test.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Unit Test Helpers
+ ============================================================================
+ */
+
+#ifndef __HEV_TEST_H__
+#define __HEV_TEST_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TEST_CHECK(expr)                                                       \
+    do {                                                                       \
+        if (!(expr)) {                                                         \
+            fprintf (stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #expr); \
+            exit (1);                                                          \
+        }                                                                      \
+    } while (0)
+
+#define TEST_RUN(func)                                                         \
+    do {                                                                       \
+        func ();                                                               \
+        printf ("ok %s\n", #func);                                             \
+    } while (0)
+
+#endif /* __HEV_TEST_H__ */
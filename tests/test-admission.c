@@ -0,0 +1,220 @@
+/*
+ ============================================================================
+ Name        : test-admission.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Admission Control Tests
+ ============================================================================
+ */
+
+#include "hev-admission.c"
+
+#include "hev-test.h"
+
+static int cfg_run_queue;
+static int cfg_source_rate;
+static int cfg_source_burst;
+static int rst_count;
+
+int
+hev_config_get_admission_run_queue (void)
+{
+    return cfg_run_queue;
+}
+
+int
+hev_config_get_admission_write_queue (void)
+{
+    return 0;
+}
+
+int
+hev_config_get_admission_buffer_usage (void)
+{
+    return 0;
+}
+
+int
+hev_config_get_admission_connect_latency (void)
+{
+    return 0;
+}
+
+int
+hev_config_get_admission_source_rate (void)
+{
+    return cfg_source_rate;
+}
+
+int
+hev_config_get_admission_source_burst (void)
+{
+    return cfg_source_burst;
+}
+
+int
+hev_tcp_buffer_get_usage (void)
+{
+    return 0;
+}
+
+unsigned int
+hev_socks5_upstream_get_latency (void)
+{
+    return 0;
+}
+
+void
+tcp_rst (const struct tcp_pcb *pcb, u32_t seqno, u32_t ackno,
+         const ip_addr_t *local_ip, const ip_addr_t *remote_ip,
+         u16_t local_port, u16_t remote_port)
+{
+    TEST_CHECK (IP_IS_V4 (remote_ip));
+    TEST_CHECK (remote_port == 40000);
+    TEST_CHECK (local_port == 443);
+    TEST_CHECK (ackno == 1001);
+    rst_count++;
+}
+
+static void
+setup (int run_queue, int source_rate, int source_burst)
+{
+    hev_admission_fini ();
+    cfg_run_queue = run_queue;
+    cfg_source_rate = source_rate;
+    cfg_source_burst = source_burst;
+    TEST_CHECK (hev_admission_init () == 0);
+}
+
+static int
+syn (uint8_t flags)
+{
+    static const uint8_t src[4] = { 10, 0, 0, 2 };
+    static const uint8_t dst[4] = { 192, 0, 2, 1 };
+    uint8_t buf[40] = { 0 };
+    struct pbuf p = { 0 };
+
+    buf[0] = 0x45;
+    buf[9] = IP_PROTO_TCP;
+    memcpy (&buf[12], src, 4);
+    memcpy (&buf[16], dst, 4);
+    buf[20] = 40000 >> 8;
+    buf[21] = 40000 & 0xff;
+    buf[22] = 443 >> 8;
+    buf[23] = 443 & 0xff;
+    buf[26] = 1000 >> 8;
+    buf[27] = 1000 & 0xff;
+    buf[33] = flags;
+
+    p.payload = buf;
+    p.len = sizeof (buf);
+    p.tot_len = p.len;
+
+    return hev_admission_filter (&p);
+}
+
+static void
+test_rate (void)
+{
+    static const uint8_t a[4] = { 10, 0, 0, 1 };
+    static const uint8_t b[4] = { 10, 0, 0, 2 };
+    uint32_t now = 5000;
+    int i;
+
+    /* Two per second, bursts of three. */
+    setup (0, 2, 3);
+    for (i = 0; i < SOURCE_BUCKETS; i++)
+        buckets[i].stamp = now;
+
+    for (i = 0; i < 3; i++)
+        TEST_CHECK (hev_admission_rate (a, 4, now) == 0);
+    TEST_CHECK (hev_admission_rate (a, 4, now) < 0);
+    TEST_CHECK (hev_admission_rate (b, 4, now) == 0);
+
+    TEST_CHECK (hev_admission_rate (a, 4, now + 499) < 0);
+    TEST_CHECK (hev_admission_rate (a, 4, now + 500) == 0);
+    TEST_CHECK (hev_admission_rate (a, 4, now + 500) < 0);
+
+    /* A long idle source gets its burst back, no more. */
+    now += 100000;
+    for (i = 0; i < 3; i++)
+        TEST_CHECK (hev_admission_rate (a, 4, now) == 0);
+    TEST_CHECK (hev_admission_rate (a, 4, now) < 0);
+}
+
+static void
+test_rate_wrap (void)
+{
+    static const uint8_t a[4] = { 10, 0, 0, 1 };
+    uint32_t now = 0xffffff00u;
+    int i;
+
+    setup (0, 1000, 1);
+    for (i = 0; i < SOURCE_BUCKETS; i++)
+        buckets[i].stamp = now;
+
+    TEST_CHECK (hev_admission_rate (a, 4, now) == 0);
+    TEST_CHECK (hev_admission_rate (a, 4, now) < 0);
+    TEST_CHECK (hev_admission_rate (a, 4, now + 0x200) == 0);
+}
+
+static void
+test_overload (void)
+{
+    setup (100, 0, 0);
+    TEST_CHECK (hev_admission_shed () == 0);
+
+    hev_admission_update (99, 0);
+    TEST_CHECK (hev_admission_shed () == 0);
+    hev_admission_update (100, 0);
+    TEST_CHECK (hev_admission_shed () == 1);
+
+    /* Recovery waits until the signal is under three quarters. */
+    hev_admission_update (75, 0);
+    TEST_CHECK (hev_admission_shed () == 1);
+    hev_admission_update (74, 0);
+    TEST_CHECK (hev_admission_shed () == 0);
+}
+
+static void
+test_filter (void)
+{
+    setup (100, 0, 0);
+    rst_count = 0;
+    hev_admission_update (100, 0);
+
+    TEST_CHECK (syn (TCP_SYN) == 1);
+    TEST_CHECK (rst_count == 1);
+    TEST_CHECK (syn (TCP_SYN | TCP_ACK) == 0);
+    TEST_CHECK (syn (TCP_ACK) == 0);
+    TEST_CHECK (rst_count == 1);
+
+    /* One SYN per probe interval goes through to keep signals fresh. */
+    probe_time -= PROBE_INTERVAL;
+    TEST_CHECK (syn (TCP_SYN) == 0);
+    TEST_CHECK (syn (TCP_SYN) == 1);
+
+    hev_admission_update (0, 0);
+    TEST_CHECK (syn (TCP_SYN) == 0);
+
+    /* Over the source rate: dropped, not reset. */
+    setup (0, 1, 1);
+    rst_count = 0;
+    TEST_CHECK (syn (TCP_SYN) == 0);
+    TEST_CHECK (syn (TCP_SYN) == 1);
+    TEST_CHECK (rst_count == 0);
+    TEST_CHECK (drops == 1);
+}
+
+int
+main (int argc, char *argv[])
+{
+    TEST_RUN (test_rate);
+    TEST_RUN (test_rate_wrap);
+    TEST_RUN (test_overload);
+    TEST_RUN (test_filter);
+
+    hev_admission_fini ();
+
+    return 0;
+}
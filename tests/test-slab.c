@@ -0,0 +1,139 @@
+/*
+ ============================================================================
+ Name        : test-slab.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Fixed Size Object Slab Tests
+ ============================================================================
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "hev-slab.c"
+
+#include "hev-test.h"
+
+#define OBJECTS (CHUNK_OBJECTS * 5 + 3)
+
+static void
+test_size (void)
+{
+    HevSlab *slab;
+
+    slab = hev_slab_new ("test", 1);
+    TEST_CHECK (slab->size == OBJECT_ALIGN);
+    hev_slab_destroy (slab);
+
+    slab = hev_slab_new ("test", OBJECT_ALIGN + 1);
+    TEST_CHECK (slab->size == OBJECT_ALIGN * 2);
+    hev_slab_destroy (slab);
+}
+
+static void
+test_alloc (void)
+{
+    static void *objs[OBJECTS];
+    HevSlab *slab = hev_slab_new ("test", 40);
+    unsigned long chunks;
+    int i, j;
+
+    for (i = 0; i < OBJECTS; i++) {
+        objs[i] = hev_slab_alloc (slab);
+        TEST_CHECK (objs[i]);
+        TEST_CHECK (((uintptr_t)objs[i] % OBJECT_ALIGN) == 0);
+        memset (objs[i], i, 40);
+    }
+
+    /* Objects never overlap: each still holds its own pattern. */
+    for (i = 0; i < OBJECTS; i++)
+        for (j = 0; j < 40; j++)
+            TEST_CHECK (((uint8_t *)objs[i])[j] == (uint8_t)i);
+
+    for (i = 0; i < OBJECTS; i++)
+        hev_slab_free (slab, objs[i]);
+    chunks = slab->chunks_num;
+
+    /* Freed objects are reused before the slab grows again. */
+    for (i = 0; i < OBJECTS; i++)
+        objs[i] = hev_slab_alloc (slab);
+    TEST_CHECK (slab->chunks_num == chunks);
+    for (i = 0; i < OBJECTS; i++)
+        hev_slab_free (slab, objs[i]);
+
+    hev_slab_destroy (slab);
+}
+
+static void
+test_cache (void)
+{
+    static void *objs[CACHE_BATCH * 3];
+    HevSlab *slab = hev_slab_new ("test", 32);
+    HevSlabCache *cache;
+    int i;
+
+    for (i = 0; i < (CACHE_BATCH * 3); i++)
+        objs[i] = hev_slab_alloc (slab);
+    cache = pthread_getspecific (slab->key);
+    TEST_CHECK (cache);
+
+    /* The cache keeps fewer than two batches, the rest go to the depot. */
+    for (i = 0; i < (CACHE_BATCH * 3); i++) {
+        hev_slab_free (slab, objs[i]);
+        TEST_CHECK (cache->num < (CACHE_BATCH * 2));
+    }
+    TEST_CHECK (slab->drains > 0);
+
+    hev_slab_destroy (slab);
+}
+
+static void *
+free_thread (void *data)
+{
+    void **objs = data;
+    int i;
+
+    for (i = 0; i < OBJECTS; i++)
+        hev_slab_free (objs[OBJECTS], objs[i]);
+
+    return NULL;
+}
+
+static void
+test_thread (void)
+{
+    static void *objs[OBJECTS + 1];
+    HevSlab *slab = hev_slab_new ("test", 64);
+    unsigned long chunks;
+    pthread_t thread;
+    int i;
+
+    for (i = 0; i < OBJECTS; i++)
+        objs[i] = hev_slab_alloc (slab);
+    objs[OBJECTS] = slab;
+    chunks = slab->chunks_num;
+
+    /* Objects freed on another thread come back through the depot. */
+    TEST_CHECK (pthread_create (&thread, NULL, free_thread, objs) == 0);
+    TEST_CHECK (pthread_join (thread, NULL) == 0);
+    TEST_CHECK (slab->frees == OBJECTS);
+
+    for (i = 0; i < OBJECTS; i++)
+        objs[i] = hev_slab_alloc (slab);
+    TEST_CHECK (slab->chunks_num == chunks);
+    for (i = 0; i < OBJECTS; i++)
+        hev_slab_free (slab, objs[i]);
+
+    hev_slab_destroy (slab);
+}
+
+int
+main (int argc, char *argv[])
+{
+    TEST_RUN (test_size);
+    TEST_RUN (test_alloc);
+    TEST_RUN (test_cache);
+    TEST_RUN (test_thread);
+
+    return 0;
+}
@@ -0,0 +1,215 @@
+/*
+ ============================================================================
+ Name        : test-tcp-time-wait.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Compact TCP TIME_WAIT Table Tests
+ ============================================================================
+ */
+
+#include "hev-tcp-time-wait.c"
+
+#include "hev-test.h"
+
+#define TCP_ACK (0x10)
+#define TCP_FIN (0x01)
+
+static const uint8_t remote4[4] = { 10, 0, 0, 2 };
+static const uint8_t local4[4] = { 192, 0, 2, 1 };
+static const uint8_t remote6[16] = { 0xfd, 0, [15] = 2 };
+static const uint8_t local6[16] = { 0x20, 0x01, 0x0d, 0xb8, [15] = 1 };
+
+static void
+make_pcb (struct tcp_pcb *pcb, int v6, uint16_t rport, uint16_t lport)
+{
+    memset (pcb, 0, sizeof (*pcb));
+    if (v6) {
+        memcpy (ip_2_ip6 (&pcb->remote_ip)->addr, remote6, 16);
+        memcpy (ip_2_ip6 (&pcb->local_ip)->addr, local6, 16);
+        IP_SET_TYPE_VAL (pcb->remote_ip, IPADDR_TYPE_V6);
+        IP_SET_TYPE_VAL (pcb->local_ip, IPADDR_TYPE_V6);
+    } else {
+        memcpy (&ip_2_ip4 (&pcb->remote_ip)->addr, remote4, 4);
+        memcpy (&ip_2_ip4 (&pcb->local_ip)->addr, local4, 4);
+        IP_SET_TYPE_VAL (pcb->remote_ip, IPADDR_TYPE_V4);
+        IP_SET_TYPE_VAL (pcb->local_ip, IPADDR_TYPE_V4);
+    }
+    pcb->remote_port = rport;
+    pcb->local_port = lport;
+}
+
+/* Builds a segment from the remote end of the pcb above into @buf. */
+static void
+make_segment (struct pbuf *p, uint8_t *buf, int v6, uint16_t rport,
+              uint16_t lport, uint8_t flags)
+{
+    uint8_t *tcp;
+
+    memset (buf, 0, 60);
+    if (v6) {
+        buf[0] = 0x60;
+        buf[6] = IP_PROTO_TCP;
+        memcpy (&buf[8], remote6, 16);
+        memcpy (&buf[24], local6, 16);
+        tcp = buf + 40;
+    } else {
+        buf[0] = 0x45;
+        buf[9] = IP_PROTO_TCP;
+        memcpy (&buf[12], remote4, 4);
+        memcpy (&buf[16], local4, 4);
+        tcp = buf + 20;
+    }
+    tcp[0] = rport >> 8;
+    tcp[1] = rport;
+    tcp[2] = lport >> 8;
+    tcp[3] = lport;
+    tcp[13] = flags;
+
+    memset (p, 0, sizeof (*p));
+    p->payload = buf;
+    p->len = v6 ? 60 : 40;
+    p->tot_len = p->len;
+}
+
+static int
+filter (HevTCPTimeWait *tw, int v6, uint16_t rport, uint16_t lport,
+        uint8_t flags)
+{
+    uint8_t buf[60];
+    struct pbuf p;
+
+    make_segment (&p, buf, v6, rport, lport, flags);
+
+    return hev_tcp_time_wait_filter (tw, &p);
+}
+
+static void
+test_late_segments (void)
+{
+    HevTCPTimeWait *tw = hev_tcp_time_wait_new (60000);
+    struct tcp_pcb pcb;
+    int v6;
+
+    for (v6 = 0; v6 < 2; v6++) {
+        make_pcb (&pcb, v6, 40000, 443);
+        hev_tcp_time_wait_store (tw, &pcb);
+    }
+    TEST_CHECK (hev_tcp_time_wait_get_use (tw) == 2);
+
+    for (v6 = 0; v6 < 2; v6++) {
+        TEST_CHECK (filter (tw, v6, 40000, 443, TCP_ACK) == 1);
+        TEST_CHECK (filter (tw, v6, 40000, 443, TCP_FIN | TCP_ACK) == 1);
+        TEST_CHECK (filter (tw, v6, 40001, 443, TCP_ACK) == 0);
+        TEST_CHECK (filter (tw, v6, 40000, 80, TCP_ACK) == 0);
+    }
+    TEST_CHECK (tw->drops == 4);
+    TEST_CHECK (hev_tcp_time_wait_get_use (tw) == 2);
+
+    hev_tcp_time_wait_destroy (tw);
+}
+
+static void
+test_reopen (void)
+{
+    HevTCPTimeWait *tw = hev_tcp_time_wait_new (60000);
+    struct tcp_pcb pcb;
+
+    make_pcb (&pcb, 0, 40000, 443);
+    hev_tcp_time_wait_store (tw, &pcb);
+    TEST_CHECK (filter (tw, 0, 40000, 443, TCP_SYN) == 0);
+    TEST_CHECK (hev_tcp_time_wait_get_use (tw) == 0);
+    TEST_CHECK (filter (tw, 0, 40000, 443, TCP_ACK) == 0);
+
+    hev_tcp_time_wait_store (tw, &pcb);
+    TEST_CHECK (filter (tw, 0, 40000, 443, TCP_RST) == 0);
+    TEST_CHECK (hev_tcp_time_wait_get_use (tw) == 0);
+    TEST_CHECK (tw->reopens == 2);
+
+    /* A 4-tuple stored again restarts its wait, it is not kept twice. */
+    hev_tcp_time_wait_store (tw, &pcb);
+    hev_tcp_time_wait_store (tw, &pcb);
+    TEST_CHECK (hev_tcp_time_wait_get_use (tw) == 1);
+
+    hev_tcp_time_wait_destroy (tw);
+}
+
+static void
+test_expire (void)
+{
+    HevTCPTimeWait *tw = hev_tcp_time_wait_new (0);
+    struct tcp_pcb pcb;
+
+    make_pcb (&pcb, 0, 40000, 443);
+    hev_tcp_time_wait_store (tw, &pcb);
+    TEST_CHECK (filter (tw, 0, 40000, 443, TCP_ACK) == 0);
+    TEST_CHECK (hev_tcp_time_wait_get_use (tw) == 0);
+
+    make_pcb (&pcb, 1, 40000, 443);
+    hev_tcp_time_wait_store (tw, &pcb);
+    hev_tcp_time_wait_expire (tw);
+    TEST_CHECK (hev_tcp_time_wait_get_use (tw) == 0);
+    TEST_CHECK (tw->head == tw->tail);
+
+    hev_tcp_time_wait_destroy (tw);
+}
+
+static void
+test_full (void)
+{
+    HevTCPTimeWait *tw = hev_tcp_time_wait_new (60000);
+    struct tcp_pcb pcb;
+    int i;
+
+    for (i = 0; i <= TW_ENTRIES; i++) {
+        make_pcb (&pcb, 0, 1024 + i, 443);
+        hev_tcp_time_wait_store (tw, &pcb);
+    }
+    TEST_CHECK (hev_tcp_time_wait_get_use (tw) == TW_ENTRIES);
+    TEST_CHECK (tw->evicts == 1);
+
+    /* The oldest entry made room for the newest one. */
+    TEST_CHECK (filter (tw, 0, 1024, 443, TCP_ACK) == 0);
+    TEST_CHECK (filter (tw, 0, 1025, 443, TCP_ACK) == 1);
+    TEST_CHECK (filter (tw, 0, 1024 + TW_ENTRIES, 443, TCP_ACK) == 1);
+
+    hev_tcp_time_wait_destroy (tw);
+}
+
+static void
+test_not_tcp (void)
+{
+    HevTCPTimeWait *tw = hev_tcp_time_wait_new (60000);
+    struct tcp_pcb pcb;
+    uint8_t buf[60];
+    struct pbuf p;
+
+    make_pcb (&pcb, 0, 40000, 443);
+    hev_tcp_time_wait_store (tw, &pcb);
+
+    /* Later fragments carry no ports. */
+    make_segment (&p, buf, 0, 40000, 443, TCP_ACK);
+    buf[7] = 1;
+    TEST_CHECK (hev_tcp_time_wait_filter (tw, &p) == 0);
+
+    make_segment (&p, buf, 0, 40000, 443, TCP_ACK);
+    buf[9] = 17;
+    TEST_CHECK (hev_tcp_time_wait_filter (tw, &p) == 0);
+
+    make_segment (&p, buf, 0, 40000, 443, TCP_ACK);
+    p.len = 39;
+    TEST_CHECK (hev_tcp_time_wait_filter (tw, &p) == 0);
+
+    hev_tcp_time_wait_destroy (tw);
+}
+
+int
+main (int argc, char *argv[])
+{
+    TEST_RUN (test_late_segments);
+    TEST_RUN (test_reopen);
+    TEST_RUN (test_expire);
+    TEST_RUN (test_full);
+    TEST_RUN (test_not_tcp);
+
+    return 0;
+}
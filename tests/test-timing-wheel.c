@@ -0,0 +1,158 @@
+/*
+ ============================================================================
+ Name        : test-timing-wheel.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Hashed Timing Wheel Tests
+ ============================================================================
+ */
+
+#include "hev-timing-wheel.c"
+
+#include "hev-test.h"
+
+static int expired;
+
+static void
+count_handler (HevTimingWheelNode *node, void *data)
+{
+    expired++;
+}
+
+static void
+readd_handler (HevTimingWheelNode *node, void *data)
+{
+    HevTimingWheel *wheel = data;
+
+    expired++;
+    hev_timing_wheel_add (wheel, node, node->timeout);
+}
+
+static int
+tick_until_expired (HevTimingWheel *wheel, int max)
+{
+    int i;
+
+    for (i = 1; i <= max; i++) {
+        hev_timing_wheel_tick (wheel, count_handler, NULL);
+        if (expired)
+            return i;
+    }
+
+    return -1;
+}
+
+static void
+test_expire (void)
+{
+    HevTimingWheel *wheel = hev_timing_wheel_new ();
+    HevTimingWheelNode node;
+
+    expired = 0;
+    hev_timing_wheel_add (wheel, &node, 3);
+    TEST_CHECK (tick_until_expired (wheel, 10) == 3);
+    TEST_CHECK (node.slot == -1);
+
+    /* Expired nodes are off the wheel, deleting them is harmless. */
+    hev_timing_wheel_del (wheel, &node);
+    expired = 0;
+    TEST_CHECK (tick_until_expired (wheel, 10) == -1);
+
+    hev_timing_wheel_destroy (wheel);
+}
+
+static void
+test_touch (void)
+{
+    HevTimingWheel *wheel = hev_timing_wheel_new ();
+    HevTimingWheelNode node;
+
+    expired = 0;
+    hev_timing_wheel_add (wheel, &node, 4);
+    hev_timing_wheel_tick (wheel, count_handler, NULL);
+    hev_timing_wheel_tick (wheel, count_handler, NULL);
+    hev_timing_wheel_touch (wheel, &node);
+    TEST_CHECK (tick_until_expired (wheel, 10) == 4);
+
+    hev_timing_wheel_destroy (wheel);
+}
+
+static void
+test_del (void)
+{
+    HevTimingWheel *wheel = hev_timing_wheel_new ();
+    HevTimingWheelNode a, b;
+
+    expired = 0;
+    hev_timing_wheel_add (wheel, &a, 2);
+    hev_timing_wheel_add (wheel, &b, 2);
+    hev_timing_wheel_del (wheel, &a);
+    TEST_CHECK (a.slot == -1);
+    TEST_CHECK (tick_until_expired (wheel, 10) == 2);
+    TEST_CHECK (expired == 1);
+    TEST_CHECK (b.slot == -1);
+
+    hev_timing_wheel_destroy (wheel);
+}
+
+static void
+test_long_timeout (void)
+{
+    HevTimingWheel *wheel = hev_timing_wheel_new ();
+    HevTimingWheelNode node;
+    int timeout = WHEEL_SLOTS * 2 + 7;
+
+    expired = 0;
+    hev_timing_wheel_add (wheel, &node, timeout);
+    TEST_CHECK (tick_until_expired (wheel, timeout * 2) == timeout);
+
+    hev_timing_wheel_destroy (wheel);
+}
+
+static void
+test_zero_timeout (void)
+{
+    HevTimingWheel *wheel = hev_timing_wheel_new ();
+    HevTimingWheelNode node;
+
+    expired = 0;
+    hev_timing_wheel_add (wheel, &node, 0);
+    TEST_CHECK (tick_until_expired (wheel, 10) == 1);
+
+    hev_timing_wheel_destroy (wheel);
+}
+
+static void
+test_readd (void)
+{
+    HevTimingWheel *wheel = hev_timing_wheel_new ();
+    HevTimingWheelNode node;
+    int i;
+
+    expired = 0;
+    hev_timing_wheel_add (wheel, &node, 5);
+    for (i = 0; i < 20; i++)
+        hev_timing_wheel_tick (wheel, readd_handler, wheel);
+    TEST_CHECK (expired == 4);
+    TEST_CHECK (node.slot >= 0);
+
+    hev_timing_wheel_del (wheel, &node);
+    for (i = 0; i < 20; i++)
+        hev_timing_wheel_tick (wheel, readd_handler, wheel);
+    TEST_CHECK (expired == 4);
+
+    hev_timing_wheel_destroy (wheel);
+}
+
+int
+main (int argc, char *argv[])
+{
+    TEST_RUN (test_expire);
+    TEST_RUN (test_touch);
+    TEST_RUN (test_del);
+    TEST_RUN (test_long_timeout);
+    TEST_RUN (test_zero_timeout);
+    TEST_RUN (test_readd);
+
+    return 0;
+}